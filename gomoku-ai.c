@@ -0,0 +1,554 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "gomoku-ai.h"
+
+#define AI_MAX_SIZE 19
+#define AI_MAX_CELLS (AI_MAX_SIZE * AI_MAX_SIZE)
+#define AI_MAX_LINES (6 * AI_MAX_SIZE)
+#define AI_NEAR 2                 // candidates are within this many cells of a stone
+#define AI_BEAM 12                // moves tried at an interior node
+#define AI_ROOT_BEAM 24
+#define AI_CHECK_EVERY 1024       // nodes between clock checks, power of two
+#define AI_WIN 1000000            // five in a row, less the plies to get there
+#define AI_WIN_BOUND (AI_WIN - 1000)
+#define AI_INFINITY (AI_WIN + 1)
+#define AI_FIVE 10000000          // cellValue of a move that makes five
+#define AI_BLOCK (AI_FIVE / 2)    // ordering score of a cell that stops one
+
+enum { BOUND_EXACT = 1, BOUND_LOWER, BOUND_UPPER };
+
+// A line of at least five cells: row, column or either diagonal
+typedef struct AILINE {
+    int16_t start;
+    int16_t step;
+    int16_t len;
+} AiLine;
+
+// The search's own board: a byte per cell, undone move by move
+typedef struct AIPOSITION {
+    int size;
+    int nStones;
+    uint64_t hash;
+    uint8_t cells[AI_MAX_CELLS];   // 0 empty, 1 B, 2 W
+    uint8_t near[AI_MAX_CELLS];    // stones within AI_NEAR cells
+    int nLines;
+    AiLine lines[AI_MAX_LINES];
+    uint8_t lineStones[AI_MAX_LINES];       // evaluation skips empty lines
+    int16_t cellLines[AI_MAX_CELLS][4];     // lines through each cell, -1 if too short
+} AiPosition;
+
+typedef struct AIMOVE {
+    int cell;
+    int score;
+} AiMove;
+
+typedef struct AIENTRY {
+    _Atomic uint64_t check;   // key ^ data
+    _Atomic uint64_t data;    // move + 1, depth, bound, score; see packEntry
+} AiEntry;
+
+struct AITABLE {
+    AiEntry *entries;
+    uint64_t mask;
+};
+
+typedef struct AITHREAD {
+    struct AIENGINE *engine;
+    int id;                   // 0 runs on the caller's thread
+    AiPosition pos;
+    uint64_t nodes;
+    int rootCell;             // best root move of the iteration in progress
+    int bestCell;             // of the last finished iteration
+    int bestScore;
+    int depth;
+} AiThread;
+
+struct AIENGINE {
+    AiTable *table;
+    int nThreads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned int generation;  // bumped to hand the helpers a new search
+    int running;              // helpers still searching
+    atomic_int stop;
+    uint64_t deadline;        // monotonic ns
+    int side;
+    AiPosition root;
+    AiThread threads[AI_MAX_THREADS];
+};
+
+// Value of the run a stone would extend, by length and open ends
+static const int runValue[5][3] = {
+    { 0, 0, 0 },
+    { 0, 1, 4 },
+    { 0, 10, 100 },
+    { 0, 150, 1500 },
+    { 0, 2000, 50000 },
+};
+
+// Evaluation: every five-cell window holding one color scores by its stones
+static const int windowValue[5] = { 0, 1, 8, 64, 512 };
+
+static const int dirX[4] = { 0, 1, 1, 1 };
+static const int dirY[4] = { 1, 0, 1, -1 };
+
+static uint64_t zobrist[2][AI_MAX_CELLS];
+static uint64_t sizeKeys[AI_MAX_SIZE + 1];
+static uint64_t whiteKey;     // side to move
+static pthread_once_t zobristOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// splitmix64 from a fixed seed, so keys are the same on every run
+static void initZobrist() {
+    uint64_t state = 0x676f6d6f6b75ULL;
+    uint64_t *keys[] = { zobrist[0], zobrist[1], sizeKeys, &whiteKey };
+    size_t counts[] = { AI_MAX_CELLS, AI_MAX_CELLS, AI_MAX_SIZE + 1, 1 };
+
+    for (int k = 0; k < 4; k++) {
+        for (size_t i = 0; i < counts[k]; i++) {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            keys[k][i] = z ^ (z >> 31);
+        }
+    }
+}
+
+/* Position */
+
+static void addLine(AiPosition *pos, int dir, int start, int step, int len) {
+    if (len < 5) return;
+    pos->lines[pos->nLines].start = (int16_t)start;
+    pos->lines[pos->nLines].step = (int16_t)step;
+    pos->lines[pos->nLines].len = (int16_t)len;
+    for (int i = 0; i < len; i++) {
+        pos->cellLines[start + i * step][dir] = (int16_t)pos->nLines;
+    }
+    pos->nLines++;
+}
+
+static void adjustNear(AiPosition *pos, int cell, int delta) {
+    int n = pos->size, x0 = cell / n, y0 = cell % n;
+
+    for (int x = x0 - AI_NEAR; x <= x0 + AI_NEAR; x++) {
+        if (x < 0 || x >= n) continue;
+        for (int y = y0 - AI_NEAR; y <= y0 + AI_NEAR; y++) {
+            if (y >= 0 && y < n) pos->near[x * n + y] += delta;
+        }
+    }
+}
+
+static void adjustLines(AiPosition *pos, int cell, int delta) {
+    for (int d = 0; d < 4; d++) {
+        if (pos->cellLines[cell][d] >= 0) pos->lineStones[pos->cellLines[cell][d]] += delta;
+    }
+}
+
+static void makeMove(AiPosition *pos, int cell, int color) {
+    pos->cells[cell] = (uint8_t)(color + 1);
+    pos->hash ^= zobrist[color][cell];
+    pos->nStones++;
+    adjustNear(pos, cell, 1);
+    adjustLines(pos, cell, 1);
+}
+
+static void unmakeMove(AiPosition *pos, int cell, int color) {
+    pos->cells[cell] = 0;
+    pos->hash ^= zobrist[color][cell];
+    pos->nStones--;
+    adjustNear(pos, cell, -1);
+    adjustLines(pos, cell, -1);
+}
+
+static void setupPosition(AiPosition *pos, const BoardGeometry *geo, const void *board) {
+    int n = geo->size;
+
+    memset(pos, 0, sizeof(*pos));
+    pos->size = n;
+    pos->hash = sizeKeys[n];
+    memset(pos->cellLines, 0xff, sizeof(pos->cellLines));
+
+    // Cell (x, y) is x * n + y, so a row steps by 1 and a column by n
+    for (int i = 0; i < n; i++) {
+        addLine(pos, 0, i * n, 1, n);
+        addLine(pos, 1, i, n, n);
+    }
+    for (int i = 0; i < n; i++) {
+        addLine(pos, 2, i, n + 1, n - i);                  // down-right from the top row
+        addLine(pos, 3, i, n - 1, i + 1);                  // down-left from the top row
+        if (i > 0) {
+            addLine(pos, 2, i * n, n + 1, n - i);          // down-right from the left column
+            addLine(pos, 3, i * n + n - 1, n - 1, n - i);  // down-left from the right column
+        }
+    }
+
+    for (int x = 0; x < n; x++) {
+        for (int y = 0; y < n; y++) {
+            char c = geo->cell(board, x, y);
+            if (c != '.') makeMove(pos, x * n + y, c == 'W');
+        }
+    }
+}
+
+static uint64_t positionKey(const AiPosition *pos, int side) {
+    return side ? pos->hash ^ whiteKey : pos->hash;
+}
+
+// What a stone of color at cell would make along the four lines through it
+static int cellValue(const AiPosition *pos, int cell, int color) {
+    int n = pos->size, x0 = cell / n, y0 = cell % n, total = 0;
+    uint8_t stone = (uint8_t)(color + 1);
+
+    for (int d = 0; d < 4; d++) {
+        int run = 1, open = 0;
+        for (int sign = -1; sign <= 1; sign += 2) {
+            int x = x0 + sign * dirX[d], y = y0 + sign * dirY[d];
+            while (x >= 0 && x < n && y >= 0 && y < n && pos->cells[x * n + y] == stone) {
+                run++;
+                x += sign * dirX[d];
+                y += sign * dirY[d];
+            }
+            if (x >= 0 && x < n && y >= 0 && y < n && pos->cells[x * n + y] == 0) open++;
+        }
+        if (run >= 5) return AI_FIVE;
+        total += runValue[run][open];
+    }
+    return total;
+}
+
+// Score for side to move; a window with four of its stones and a gap is a
+// five next move, so that is scored as the win it is
+static int evaluate(const AiPosition *pos, int side, int ply) {
+    int total[2] = { 0, 0 };
+    int fours[2] = { 0, 0 };
+
+    for (int l = 0; l < pos->nLines; l++) {
+        if (pos->lineStones[l] == 0) continue;
+        const AiLine *line = &pos->lines[l];
+        const uint8_t *cell = pos->cells + line->start;
+        int count[3] = { 0, 0, 0 };
+        for (int i = 0; i < line->len; i++) {
+            count[cell[i * line->step]]++;
+            if (i >= 5) count[cell[(i - 5) * line->step]]--;
+            if (i < 4) continue;
+            if (count[2] == 0) {
+                total[0] += windowValue[count[1] > 4 ? 4 : count[1]];
+                fours[0] += count[1] == 4;
+            } else if (count[1] == 0) {
+                total[1] += windowValue[count[2] > 4 ? 4 : count[2]];
+                fours[1] += count[2] == 4;
+            }
+        }
+    }
+    if (fours[side]) return AI_WIN - ply - 1;
+    return total[side] - total[!side];
+}
+
+/* Transposition table */
+
+static uint64_t packEntry(int cell, int depth, int bound, int score) {
+    return (uint64_t)(cell + 1) | (uint64_t)depth << 16 | (uint64_t)bound << 24 | (uint64_t)(uint32_t)score << 32;
+}
+
+// Win scores are stored relative to the node, not the root
+static int scoreToTable(int score, int ply) {
+    if (score >= AI_WIN_BOUND) return score + ply;
+    if (score <= -AI_WIN_BOUND) return score - ply;
+    return score;
+}
+
+static int scoreFromTable(int score, int ply) {
+    if (score >= AI_WIN_BOUND) return score - ply;
+    if (score <= -AI_WIN_BOUND) return score + ply;
+    return score;
+}
+
+static int probeTable(AiTable *table, uint64_t key, uint64_t *data) {
+    AiEntry *entry = &table->entries[key & table->mask];
+    *data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    return (atomic_load_explicit(&entry->check, memory_order_relaxed) ^ *data) == key;
+}
+
+// Keeps the deeper result for the same position; anything else is replaced
+static void storeTable(AiTable *table, uint64_t key, int cell, int depth, int bound, int score) {
+    AiEntry *entry = &table->entries[key & table->mask];
+    uint64_t old = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    if ((atomic_load_explicit(&entry->check, memory_order_relaxed) ^ old) == key &&
+        (int)((old >> 16) & 0xff) > depth) {
+        return;
+    }
+    uint64_t data = packEntry(cell, depth, bound, score);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+}
+
+/* Search */
+
+// Fills moves with the empty cells near stones, scored for ordering, and
+// returns how many. If side can make five, returns -1 with that cell first;
+// if the opponent threatens five, only the cells that stop it are kept.
+static int generateMoves(AiThread *t, int side, AiMove *moves) {
+    const AiPosition *pos = &t->pos;
+    int cells = pos->size * pos->size, count = 0, blocks = 0;
+
+    for (int cell = 0; cell < cells; cell++) {
+        if (pos->cells[cell] != 0 || pos->near[cell] == 0) continue;
+        int attack = cellValue(pos, cell, side);
+        if (attack >= AI_FIVE) {
+            moves[0].cell = cell;
+            return -1;
+        }
+        int defense = cellValue(pos, cell, !side);
+        int score = (defense >= AI_FIVE) ? AI_BLOCK : attack * 2 + defense;
+        if (defense >= AI_FIVE) blocks++;
+        // Helpers break ties differently so they explore different trees
+        if (t->id > 0) score += (int)(((uint32_t)cell * 2654435761u + (uint32_t)t->id * 40503u) >> 29);
+        moves[count].cell = cell;
+        moves[count].score = score;
+        count++;
+    }
+
+    if (blocks > 0) {
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (moves[i].score >= AI_BLOCK) moves[kept++] = moves[i];
+        }
+        count = kept;
+    }
+    return count;
+}
+
+// Moves the best of moves[from..count) to from
+static void pickMove(AiMove *moves, int from, int count) {
+    int best = from;
+    for (int i = from + 1; i < count; i++) {
+        if (moves[i].score > moves[best].score) best = i;
+    }
+    AiMove tmp = moves[from];
+    moves[from] = moves[best];
+    moves[best] = tmp;
+}
+
+static int search(AiThread *t, int side, int depth, int alpha, int beta, int ply) {
+    AiEngine *engine = t->engine;
+    AiPosition *pos = &t->pos;
+    AiMove moves[AI_MAX_CELLS];
+
+    if ((++t->nodes & (AI_CHECK_EVERY - 1)) == 0 && now_ns() >= engine->deadline) {
+        atomic_store_explicit(&engine->stop, 1, memory_order_relaxed);
+    }
+    if (atomic_load_explicit(&engine->stop, memory_order_relaxed)) return 0;
+
+    if (depth <= 0) return evaluate(pos, side, ply);
+
+    int count = generateMoves(t, side, moves);
+    if (count < 0) {
+        if (ply == 0) t->rootCell = moves[0].cell;
+        return AI_WIN - ply - 1;
+    }
+    if (count == 0) return 0;   // board full
+
+    uint64_t key = positionKey(pos, side);
+    uint64_t data;
+    int hashCell = -1;
+    if (probeTable(engine->table, key, &data)) {
+        int stored = (int)(data & 0xffff) - 1;
+        int storedDepth = (int)((data >> 16) & 0xff);
+        int bound = (int)((data >> 24) & 3);
+        int score = scoreFromTable((int32_t)(data >> 32), ply);
+        hashCell = stored;
+        if (ply > 0 && storedDepth >= depth &&
+            (bound == BOUND_EXACT || (bound == BOUND_LOWER && score >= beta) ||
+             (bound == BOUND_UPPER && score <= alpha))) {
+            return score;
+        }
+    }
+    if (ply == 0 && t->bestCell >= 0) hashCell = t->bestCell;
+    for (int i = 0; i < count && hashCell >= 0; i++) {
+        if (moves[i].cell == hashCell) moves[i].score = AI_FIVE;
+    }
+
+    int limit = ply == 0 ? AI_ROOT_BEAM : AI_BEAM;
+    if (limit > count) limit = count;
+    int alphaIn = alpha, best = -AI_INFINITY, bestCell = moves[0].cell;
+
+    for (int i = 0; i < limit; i++) {
+        pickMove(moves, i, count);
+        int cell = moves[i].cell;
+        makeMove(pos, cell, side);
+        int score = -search(t, !side, depth - 1, -beta, -alpha, ply + 1);
+        unmakeMove(pos, cell, side);
+        if (atomic_load_explicit(&engine->stop, memory_order_relaxed)) return 0;
+
+        if (score > best) {
+            best = score;
+            bestCell = cell;
+            if (ply == 0) t->rootCell = cell;
+            if (score > alpha) alpha = score;
+            if (alpha >= beta) break;
+        }
+    }
+
+    int bound = best >= beta ? BOUND_LOWER : (best > alphaIn ? BOUND_EXACT : BOUND_UPPER);
+    storeTable(engine->table, key, bestCell, depth, bound, scoreToTable(best, ply));
+    return best;
+}
+
+// Deepens until told to stop or the result is decided; only the main thread
+// watches the soft limit, since starting an iteration it cannot finish is waste
+static void iterate(AiThread *t, int firstDepth, uint64_t started) {
+    AiEngine *engine = t->engine;
+
+    for (int depth = firstDepth; depth <= AI_MAX_DEPTH; depth++) {
+        int score = search(t, engine->side, depth, -AI_INFINITY, AI_INFINITY, 0);
+        if (atomic_load_explicit(&engine->stop, memory_order_relaxed)) break;
+        t->bestCell = t->rootCell;
+        t->bestScore = score;
+        t->depth = depth;
+        if (score >= AI_WIN_BOUND || score <= -AI_WIN_BOUND) break;
+        if (t->id == 0 && now_ns() - started > (engine->deadline - started) / 2) break;
+    }
+}
+
+static void resetThread(AiThread *t) {
+    t->pos = t->engine->root;
+    t->nodes = 0;
+    t->rootCell = -1;
+    t->bestCell = -1;
+    t->bestScore = 0;
+    t->depth = 0;
+}
+
+static void *helper(void *ptr) {
+    AiThread *t = (AiThread *)ptr;
+    AiEngine *engine = t->engine;
+    unsigned int seen = 0;
+
+    while (1) {
+        pthread_mutex_lock(&engine->lock);
+        while (engine->generation == seen) {
+            pthread_cond_wait(&engine->start, &engine->lock);
+        }
+        seen = engine->generation;
+        pthread_mutex_unlock(&engine->lock);
+
+        resetThread(t);
+        iterate(t, 1 + t->id % 2, now_ns());
+
+        pthread_mutex_lock(&engine->lock);
+        if (--engine->running == 0) pthread_cond_signal(&engine->finished);
+        pthread_mutex_unlock(&engine->lock);
+    }
+    return NULL;
+}
+
+/* API */
+
+AiTable *aiCreateTable(size_t megabytes) {
+    size_t count = 1;
+
+    pthread_once(&zobristOnce, initZobrist);
+    while (count * 2 * sizeof(AiEntry) <= (megabytes << 20)) count *= 2;
+
+    AiTable *table = (AiTable *)malloc(sizeof(AiTable));
+    if (table == NULL) return NULL;
+    table->entries = (AiEntry *)calloc(count, sizeof(AiEntry));
+    if (table->entries == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->mask = count - 1;
+    return table;
+}
+
+AiEngine *aiCreateEngine(AiTable *table, int nThreads) {
+    pthread_once(&zobristOnce, initZobrist);
+    if (nThreads < 1) nThreads = 1;
+    if (nThreads > AI_MAX_THREADS) nThreads = AI_MAX_THREADS;
+
+    AiEngine *engine = (AiEngine *)calloc(1, sizeof(AiEngine));
+    if (engine == NULL) return NULL;
+    engine->table = table;
+    engine->nThreads = nThreads;
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->start, NULL);
+    pthread_cond_init(&engine->finished, NULL);
+
+    for (int i = 0; i < nThreads; i++) {
+        engine->threads[i].engine = engine;
+        engine->threads[i].id = i;
+        if (i == 0) continue;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, helper, &engine->threads[i]) != 0) {
+            return NULL;  // helpers already started keep waiting; the engine is leaked with them
+        }
+        pthread_detach(thread);
+    }
+    return engine;
+}
+
+void aiSearch(AiEngine *engine, const BoardGeometry *geo, const void *board, int color, int budgetMs,
+              AiResult *result) {
+    AiThread *lead = &engine->threads[0];
+    AiMove moves[AI_MAX_CELLS];
+    uint64_t started = now_ns();
+    int n = geo->size;
+
+    setupPosition(&engine->root, geo, board);
+    engine->side = color;
+    engine->deadline = started + (uint64_t)budgetMs * 1000000;
+    atomic_store(&engine->stop, 0);
+    resetThread(lead);
+    memset(result, 0, sizeof(*result));
+
+    // Opening, immediate wins and forced blocks need no search
+    int count = engine->root.nStones == 0 ? 0 : generateMoves(lead, color, moves);
+    if (engine->root.nStones == 0) {
+        lead->bestCell = (n / 2) * n + n / 2;
+    } else if (count < 0 || count == 1) {
+        lead->bestCell = moves[0].cell;
+    } else if (count == 0) {
+        for (int cell = 0; cell < n * n && lead->bestCell < 0; cell++) {
+            if (engine->root.cells[cell] == 0) lead->bestCell = cell;
+        }
+    } else {
+        pthread_mutex_lock(&engine->lock);
+        engine->running = engine->nThreads - 1;
+        engine->generation++;
+        pthread_cond_broadcast(&engine->start);
+        pthread_mutex_unlock(&engine->lock);
+
+        iterate(lead, 1, started);
+        atomic_store(&engine->stop, 1);
+
+        pthread_mutex_lock(&engine->lock);
+        while (engine->running > 0) {
+            pthread_cond_wait(&engine->finished, &engine->lock);
+        }
+        pthread_mutex_unlock(&engine->lock);
+
+        for (int i = 1; i < engine->nThreads; i++) {
+            result->nodes += engine->threads[i].nodes;
+        }
+        // Depth 1 always finishes unless the budget is absurdly small
+        if (lead->bestCell < 0) lead->bestCell = lead->rootCell >= 0 ? lead->rootCell : moves[0].cell;
+    }
+
+    result->x = lead->bestCell / n;
+    result->y = lead->bestCell % n;
+    result->score = lead->bestScore;
+    result->depth = lead->depth;
+    result->nodes += lead->nodes;
+    result->micros = (now_ns() - started) / 1000;
+}
@@ -0,0 +1,41 @@
+#ifndef GOMOKU_AI_H
+#define GOMOKU_AI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gomoku-board.h"
+
+// Computer opponent: iterative-deepening alpha-beta that only looks at
+// empty cells near existing stones, most promising first.
+//
+// Positions are keyed by Zobrist hashes into a transposition table that
+// any number of searches share without locks. An entry is two words with
+// the key stored XORed with the data, so a torn write reads as a miss.
+// Each engine searches with several threads (lazy SMP): helpers run the
+// same iterative deepening staggered by a ply and with shuffled move
+// order, and help the main thread only through the table.
+
+#define AI_MAX_THREADS 16
+#define AI_MAX_DEPTH 24
+
+typedef struct AITABLE AiTable;
+typedef struct AIENGINE AiEngine;
+
+typedef struct AIRESULT {
+    int x, y;
+    int score;            // for the side that moved, higher is better
+    int depth;            // last iteration the main thread finished, 0 if forced
+    uint64_t nodes;       // over all threads
+    uint64_t micros;
+} AiResult;
+
+// Rounded down to a power-of-two number of entries; NULL if out of memory
+AiTable *aiCreateTable(size_t megabytes);
+// nThreads counts the caller's thread; NULL if a helper could not start
+AiEngine *aiCreateEngine(AiTable *table, int nThreads);
+// Picks a move for color (0 = B, 1 = W) within budgetMs. The board needs an
+// empty cell. One search at a time per engine.
+void aiSearch(AiEngine *engine, const BoardGeometry *geo, const void *board, int color, int budgetMs,
+              AiResult *result);
+
+#endif
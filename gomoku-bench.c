@@ -0,0 +1,985 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "gomoku-ai.h"
+#include "gomoku-board.h"
+#include "gomoku-slab.h"
+#include "gomoku-store.h"
+#include "gomoku-timer.h"
+#include "gomoku-vcf.h"
+
+#define DEFAULT_PLAYERS 200000
+#define DEFAULT_SECONDS 1.0
+#define MAX_THREADS 64
+#define RESULT_PLAYERS 10000
+#define SLAB_BATCH 8          // games each thread holds at once
+#define DEFAULT_POSITIONS 20000
+#define DEFAULT_ROUNDS 20
+#define THREADED_POSITIONS 2000  // the thread-per-check baseline is slow
+#define DEFAULT_AI_POSITIONS 20
+#define DEFAULT_AI_MOVE_MS 200
+#define AI_TABLE_MB 64
+#define DEFAULT_VCF_POSITIONS 2000
+#define VCF_CACHE_MB 16
+#define VCF_MAX_NODES 20000      // the server's limit for a hint
+#define DEFAULT_TIMER_SESSIONS 1000000
+#define TIMER_CHURN 4000000      // moves per run: each cancels a clock and arms the next
+#define TIMER_MOVE_MS 120000     // the server's default move limit
+#define TIMER_MOVES_PER_MS 200
+
+// Stands in for the server's Game: a lock and room for the largest board
+typedef struct BENCHGAME {
+    pthread_mutex_t lock;
+    int nMoves;
+    int gameOver;
+    uint64_t board[BOARD_BYTES_MAX / sizeof(uint64_t) + 1];
+} BenchGame;
+
+// One generated position; the last move was played at (x, y) by color and
+// may be the winning one
+typedef struct POSITION {
+    int x, y, color;
+    int checkX, checkY;       // a probe for move validation
+} Position;
+
+// Positions for one board size in both representations, each packed densely
+// so neither kernel family pays for the other's bytes
+typedef struct CORPUS {
+    const BoardGeometry *geo;
+    long count;
+    Position *positions;
+    char *grids;              // the original '.', 'B', 'W' arrays, size * size each
+    uint8_t *boards;          // line bitboards, geo->boardBytes each
+} Corpus;
+
+// Binary min-heap of deadlines with each session's position in it, the usual
+// alternative to a wheel: O(log n) arm and cancel
+typedef struct TIMERHEAP {
+    uint64_t *expires;
+    uint32_t *session;        // by heap position
+    uint32_t *position;       // by session; UINT32_MAX when not armed
+    uint32_t count;
+} TimerHeap;
+
+// Arguments for the original check functions
+typedef struct LEGACYCHECK {
+    const char *grid;
+    int n;
+    int x, y;
+    char stone;
+    int gameOver;
+} LegacyCheck;
+
+typedef struct BENCHTHREAD {
+    pthread_t thread;
+    uint64_t seed;
+    long ops;
+    long hits;
+} BenchThread;
+
+// Shared by the benchmark threads
+char (*emails)[51];
+long nEmails;
+PlayerRecord **resultPlayers;
+pthread_mutex_t resultLock = PTHREAD_MUTEX_INITIALIZER;
+int nullFd = -1;
+Slab gameSlab;
+atomic_long allocations;      // heap allocations while counting, see malloc below
+volatile int countAllocations;   // set only while the kernel benchmark measures
+volatile long sink;           // keeps kernel results alive
+volatile int stop;
+
+// Benchmarks
+int bench_store(int argc, char *argv[]);
+int bench_results(int argc, char *argv[]);
+int bench_slab(int argc, char *argv[]);
+int bench_kernels(int argc, char *argv[]);
+int bench_ai(int argc, char *argv[]);
+int bench_vcf(int argc, char *argv[]);
+int bench_timers(int argc, char *argv[]);
+
+// Helpers
+double now_seconds();
+uint64_t next_random(uint64_t *state);
+double run_threads(int nThreads, double seconds, void *(*body)(void *), BenchThread *threads);
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "store") == 0) {
+        return bench_store(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "results") == 0) {
+        return bench_results(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "slab") == 0) {
+        return bench_slab(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "kernels") == 0) {
+        return bench_kernels(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "ai") == 0) {
+        return bench_ai(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "vcf") == 0) {
+        return bench_vcf(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "timers") == 0) {
+        return bench_timers(argc - 2, argv + 2);
+    }
+    
+    fprintf(stderr, "Usage: %s store [players] [seconds per run]\n", argv[0]);
+    fprintf(stderr, "       %s results [seconds per run]\n", argv[0]);
+    fprintf(stderr, "       %s slab [seconds per run]\n", argv[0]);
+    fprintf(stderr, "       %s kernels [positions per size] [rounds]\n", argv[0]);
+    fprintf(stderr, "       %s ai [positions] [ms per move] [max threads]\n", argv[0]);
+    fprintf(stderr, "       %s vcf [positions]\n", argv[0]);
+    fprintf(stderr, "       %s timers [sessions]\n", argv[0]);
+    return 1;
+}
+
+// Count every heap allocation, including ones made inside libc, so the
+// kernel benchmark can report allocations per operation. Only while it
+// measures: the shared counter would otherwise tax every malloc the
+// store and slab benchmarks make, the baseline they compare against.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    if (countAllocations) atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    if (countAllocations) atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (countAllocations) atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64*
+uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Runs body on nThreads threads for about the given time; returns elapsed seconds
+double run_threads(int nThreads, double seconds, void *(*body)(void *), BenchThread *threads) {
+    stop = 0;
+    double start = now_seconds();
+    for (int i = 0; i < nThreads; i++) {
+        threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        threads[i].ops = 0;
+        threads[i].hits = 0;
+        pthread_create(&threads[i].thread, NULL, body, &threads[i]);
+    }
+    struct timespec pause = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&pause, NULL);
+    stop = 1;
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    return now_seconds() - start;
+}
+
+void *store_lookups(void *ptr) {
+    BenchThread *self = (BenchThread *)ptr;
+    while (!stop) {
+        // Check the stop flag every 256 lookups
+        for (int i = 0; i < 256; i++) {
+            long n = (long)(next_random(&self->seed) % (uint64_t)nEmails);
+            if (find_player_by_email(emails[n]) != NULL) {
+                self->hits++;
+            }
+        }
+        self->ops += 256;
+    }
+    return NULL;
+}
+
+// Login lookups per second against the sharded store, by thread count
+int bench_store(int argc, char *argv[]) {
+    long players = argc >= 1 ? atol(argv[0]) : DEFAULT_PLAYERS;
+    double seconds = argc >= 2 ? atof(argv[1]) : DEFAULT_SECONDS;
+    BenchThread threads[MAX_THREADS];
+    
+    if (players <= 0 || seconds <= 0) {
+        fprintf(stderr, "players and seconds must be positive\n");
+        return 1;
+    }
+    
+    initialize_scoreboard();
+    emails = calloc(players, sizeof(*emails));
+    if (emails == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    nEmails = players;
+    
+    double start = now_seconds();
+    for (long i = 0; i < players; i++) {
+        snprintf(emails[i], sizeof(emails[i]), "player%ld@example.com", i);
+        if (add_player_to_scoreboard(emails[i], "$6$rounds=5000$randomsaltstring$x", "bench") != 0) {
+            fprintf(stderr, "Failed to add player %ld\n", i);
+            return 1;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    printf("store: %ld players added in %.3f s (%.0f adds/s)\n",
+           count_players(), elapsed, players / elapsed);
+    
+    printf("%8s %16s %16s\n", "threads", "lookups/s", "per thread");
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        elapsed = run_threads(n, seconds, store_lookups, threads);
+        long ops = 0, hits = 0;
+        for (int i = 0; i < n; i++) {
+            ops += threads[i].ops;
+            hits += threads[i].hits;
+        }
+        if (hits != ops) {
+            fprintf(stderr, "lookup missed %ld players\n", ops - hits);
+            return 1;
+        }
+        printf("%8d %16.0f %16.0f\n", n, ops / elapsed, ops / elapsed / n);
+    }
+    
+    free(emails);
+    return 0;
+}
+
+// One finished game between two random players: update both records, then
+// format and send the result line to each, the way handle_game does
+static void finish_game(BenchThread *self, int locked) {
+    char buffer[256];
+    PlayerScore winnerScore, loserScore;
+    PlayerRecord *winner = resultPlayers[next_random(&self->seed) % RESULT_PLAYERS];
+    PlayerRecord *loser = resultPlayers[next_random(&self->seed) % RESULT_PLAYERS];
+    
+    if (locked) {
+        // The old scheme: one global lock held across formatting and sends
+        pthread_mutex_lock(&resultLock);
+        winner->wins++;
+        loser->losses++;
+        for (int i = 0; i < 2; i++) {
+            snprintf(buffer, sizeof(buffer), "You won and %s lost\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
+                     loser->name, winner->name, (int)winner->wins, (int)winner->losses, (int)winner->ties,
+                     loser->name, (int)loser->wins, (int)loser->losses, (int)loser->ties);
+            if (write(nullFd, buffer, strlen(buffer)) < 0) self->hits++;
+        }
+        pthread_mutex_unlock(&resultLock);
+    } else {
+        add_player_result(winner, 1, 0, 0, &winnerScore);
+        add_player_result(loser, 0, 1, 0, &loserScore);
+        for (int i = 0; i < 2; i++) {
+            snprintf(buffer, sizeof(buffer), "You won and %s lost\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
+                     loser->name, winner->name, winnerScore.wins, winnerScore.losses, winnerScore.ties,
+                     loser->name, loserScore.wins, loserScore.losses, loserScore.ties);
+            if (write(nullFd, buffer, strlen(buffer)) < 0) self->hits++;
+        }
+    }
+}
+
+void *locked_results(void *ptr) {
+    BenchThread *self = (BenchThread *)ptr;
+    while (!stop) {
+        finish_game(self, 1);
+        self->ops++;
+    }
+    return NULL;
+}
+
+void *atomic_results(void *ptr) {
+    BenchThread *self = (BenchThread *)ptr;
+    while (!stop) {
+        finish_game(self, 0);
+        self->ops++;
+    }
+    return NULL;
+}
+
+// Finished games per second by number of concurrently finishing games,
+// global scoreboard lock versus lock-free counters with sends outside
+int bench_results(int argc, char *argv[]) {
+    double seconds = argc >= 1 ? atof(argv[0]) : DEFAULT_SECONDS;
+    BenchThread threads[MAX_THREADS];
+    char email[51];
+    
+    if (seconds <= 0) {
+        fprintf(stderr, "seconds must be positive\n");
+        return 1;
+    }
+    nullFd = open("/dev/null", O_WRONLY);
+    resultPlayers = calloc(RESULT_PLAYERS, sizeof(PlayerRecord *));
+    if (nullFd < 0 || resultPlayers == NULL) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    
+    initialize_scoreboard();
+    for (int i = 0; i < RESULT_PLAYERS; i++) {
+        snprintf(email, sizeof(email), "player%d@example.com", i);
+        add_player_to_scoreboard(email, "x", "bench");
+        resultPlayers[i] = find_player_by_email(email);
+    }
+    
+    printf("%8s %16s %16s %8s\n", "games", "locked games/s", "atomic games/s", "speedup");
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        double elapsed = run_threads(n, seconds, locked_results, threads);
+        long locked = 0;
+        for (int i = 0; i < n; i++) locked += threads[i].ops;
+        double lockedRate = locked / elapsed;
+        
+        elapsed = run_threads(n, seconds, atomic_results, threads);
+        long atomic = 0;
+        for (int i = 0; i < n; i++) atomic += threads[i].ops;
+        double atomicRate = atomic / elapsed;
+        
+        printf("%8d %16.0f %16.0f %7.2fx\n", n, lockedRate, atomicRate, atomicRate / lockedRate);
+    }
+    
+    close(nullFd);
+    free(resultPlayers);
+    return 0;
+}
+
+// What the server did per game before the slab: allocate, set up the lock,
+// tear both down when the game ends
+void *malloc_games(void *ptr) {
+    BenchThread *self = (BenchThread *)ptr;
+    BenchGame *games[SLAB_BATCH];
+    
+    while (!stop) {
+        for (int i = 0; i < SLAB_BATCH; i++) {
+            games[i] = (BenchGame *)malloc(sizeof(BenchGame));
+            pthread_mutex_init(&games[i]->lock, NULL);
+            games[i]->nMoves = 0;
+            games[i]->gameOver = 0;
+            memset(games[i]->board, 0, sizeof(board8_t));  // as initializeBoard does for 8x8
+        }
+        for (int i = 0; i < SLAB_BATCH; i++) {
+            pthread_mutex_destroy(&games[i]->lock);
+            free(games[i]);
+        }
+        self->ops += SLAB_BATCH;
+    }
+    return NULL;
+}
+
+static void construct_bench_game(void *object) {
+    pthread_mutex_init(&((BenchGame *)object)->lock, NULL);
+}
+
+// The slab path: pop a slot, reset it in place, push it back
+void *slab_games(void *ptr) {
+    BenchThread *self = (BenchThread *)ptr;
+    BenchGame *games[SLAB_BATCH];
+    
+    while (!stop) {
+        for (int i = 0; i < SLAB_BATCH; i++) {
+            games[i] = (BenchGame *)slab_alloc(&gameSlab);
+            games[i]->nMoves = 0;
+            games[i]->gameOver = 0;
+            memset(games[i]->board, 0, sizeof(board8_t));  // as initializeBoard does for 8x8
+        }
+        for (int i = 0; i < SLAB_BATCH; i++) {
+            slab_free(&gameSlab, games[i]);
+        }
+        self->ops += SLAB_BATCH;
+    }
+    return NULL;
+}
+
+// Game create/destroy pairs per second by thread count, malloc versus slab
+int bench_slab(int argc, char *argv[]) {
+    double seconds = argc >= 1 ? atof(argv[0]) : DEFAULT_SECONDS;
+    BenchThread threads[MAX_THREADS];
+    SlabStats stats;
+    
+    if (seconds <= 0) {
+        fprintf(stderr, "seconds must be positive\n");
+        return 1;
+    }
+    if (slab_init(&gameSlab, sizeof(BenchGame), MAX_THREADS * SLAB_BATCH, construct_bench_game) == -1) {
+        fprintf(stderr, "slab_init failed\n");
+        return 1;
+    }
+    
+    printf("%8s %16s %16s %8s\n", "threads", "malloc games/s", "slab games/s", "speedup");
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        double elapsed = run_threads(n, seconds, malloc_games, threads);
+        long total = 0;
+        for (int i = 0; i < n; i++) total += threads[i].ops;
+        double mallocRate = total / elapsed;
+        
+        elapsed = run_threads(n, seconds, slab_games, threads);
+        total = 0;
+        for (int i = 0; i < n; i++) total += threads[i].ops;
+        double slabRate = total / elapsed;
+        
+        printf("%8d %16.0f %16.0f %7.2fx\n", n, mallocRate, slabRate, slabRate / mallocRate);
+    }
+    
+    slab_stats(&gameSlab, &stats);
+    printf("slab: %ld slots of %zu bytes, %zu KiB reserved, peak %ld in use\n",
+           stats.capacity, stats.slotSize, stats.bytes / 1024, stats.peak);
+    return 0;
+}
+
+// The original kernels, generalized from 8 to n cells per side. Each scans
+// whole lines of the char array for five of the stone in a row.
+void *horizontalCheck(void *ptr) {
+    LegacyCheck *check = (LegacyCheck *)ptr;
+    const char *row = check->grid + check->x * check->n;
+    int count = 0;
+    
+    for (int j = 0; j < check->n; j++) {
+        if (row[j] == check->stone) {
+            if (++count == 5) {
+                check->gameOver = 1;
+                return NULL;
+            }
+        } else {
+            count = 0;
+        }
+    }
+    return NULL;
+}
+
+void *verticalCheck(void *ptr) {
+    LegacyCheck *check = (LegacyCheck *)ptr;
+    int count = 0;
+    
+    for (int i = 0; i < check->n; i++) {
+        if (check->grid[i * check->n + check->y] == check->stone) {
+            if (++count == 5) {
+                check->gameOver = 1;
+                return NULL;
+            }
+        } else {
+            count = 0;
+        }
+    }
+    return NULL;
+}
+
+// Walks every diagonal and anti-diagonal of the board, as the original did
+void *diagonalCheck(void *ptr) {
+    LegacyCheck *check = (LegacyCheck *)ptr;
+    int n = check->n;
+    
+    for (int dir = 1; dir >= -1; dir -= 2) {
+        // Diagonals start on the top row, then down the first (or last) column
+        for (int start = 0; start < 2 * n - 1; start++) {
+            int i = (start < n) ? 0 : start - n + 1;
+            int j = (start < n) ? (dir == 1 ? start : n - 1 - start) : (dir == 1 ? 0 : n - 1);
+            int count = 0;
+            for (; i < n && j >= 0 && j < n; i++, j += dir) {
+                if (check->grid[i * n + j] == check->stone) {
+                    if (++count == 5) {
+                        check->gameOver = 1;
+                        return NULL;
+                    }
+                } else {
+                    count = 0;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static int legacy_check_move(const char *grid, int n, int x, int y) {
+    if (x < 0 || x >= n || y < 0 || y >= n) {
+        return 1;
+    }
+    return grid[x * n + y] != '.';
+}
+
+// The original sendBoard formatting, one snprintf per cell, minus the send
+static int legacy_render(const char *grid, int n, char *buffer, size_t len) {
+    int offset = snprintf(buffer, len, "\n ");
+    for (int j = 0; j < n; j++) offset += snprintf(buffer + offset, len - offset, " %d", j);
+    offset += snprintf(buffer + offset, len - offset, "\n");
+    for (int i = 0; i < n; i++) {
+        offset += snprintf(buffer + offset, len - offset, "%d ", i);
+        for (int j = 0; j < n; j++) {
+            offset += snprintf(buffer + offset, len - offset, "%c ", grid[i * n + j]);
+        }
+        offset += snprintf(buffer + offset, len - offset, "\n");
+    }
+    return offset;
+}
+
+// Plays random games and keeps the position after a random number of
+// moves, or right after a win. A win can only run through the last move.
+static int generate_corpus(Corpus *corpus, const BoardGeometry *geo, long count, uint64_t *seed) {
+    int n = geo->size;
+    
+    corpus->geo = geo;
+    corpus->count = count;
+    corpus->positions = (Position *)malloc(count * sizeof(Position));
+    corpus->grids = (char *)malloc(count * geo->cells);
+    corpus->boards = (uint8_t *)aligned_alloc(8, count * geo->boardBytes);
+    if (corpus->positions == NULL || corpus->grids == NULL || corpus->boards == NULL) return -1;
+    
+    for (long p = 0; p < count; p++) {
+        Position *pos = &corpus->positions[p];
+        char *grid = corpus->grids + p * geo->cells;
+        void *board = corpus->boards + p * geo->boardBytes;
+        int moves = 1 + (int)(next_random(seed) % (uint64_t)(geo->cells * 3 / 5));
+        
+        memset(grid, '.', geo->cells);
+        geo->clear(board);
+        for (int m = 0; m < moves; m++) {
+            int x, y;
+            do {
+                x = (int)(next_random(seed) % n);
+                y = (int)(next_random(seed) % n);
+            } while (grid[x * n + y] != '.');
+            pos->color = m & 1;
+            pos->x = x;
+            pos->y = y;
+            grid[x * n + y] = pos->color ? 'W' : 'B';
+            geo->place(board, pos->color, x, y);
+            if (geo->checkWin(board, pos->color, x, y)) break;
+        }
+        
+        // Mostly on the board, some outside it
+        pos->checkX = (int)(next_random(seed) % (n + 2)) - 1;
+        pos->checkY = (int)(next_random(seed) % (n + 2)) - 1;
+    }
+    return 0;
+}
+
+static void free_corpus(Corpus *corpus) {
+    free(corpus->positions);
+    free(corpus->grids);
+    free(corpus->boards);
+}
+
+typedef enum {
+    KERNEL_HORIZONTAL,
+    KERNEL_VERTICAL,
+    KERNEL_DIAGONAL,
+    KERNEL_LEGACY_WIN,        // all three, one after the other
+    KERNEL_THREADED_WIN,      // all three on their own threads, as the original server ran them
+    KERNEL_BITBOARD_WIN,
+    KERNEL_LEGACY_MOVE,
+    KERNEL_BITBOARD_MOVE,
+    KERNEL_LEGACY_RENDER,
+    KERNEL_TEXT_RENDER,
+    KERNEL_PACK,
+    KERNEL_COUNT
+} Kernel;
+
+static const char *kernelNames[KERNEL_COUNT] = {
+    "horizontalCheck (scan)",
+    "verticalCheck (scan)",
+    "diagonalCheck (scan)",
+    "win check, scan x3",
+    "win check, scan x3 threads",
+    "win check, bitboard",
+    "checkMove, char array",
+    "checkMove, bitboard",
+    "sendBoard, snprintf",
+    "render, bitboard text",
+    "pack, binary board frame",
+};
+
+// Runs one kernel over the first count positions; returns the result sum
+static long run_kernel(Kernel kernel, const Corpus *corpus, long count) {
+    const BoardGeometry *geo = corpus->geo;
+    char buffer[BOARD_RENDER_MAX * 2];
+    long result = 0;
+    
+    for (long p = 0; p < count; p++) {
+        const Position *pos = &corpus->positions[p];
+        const char *grid = corpus->grids + p * geo->cells;
+        const void *board = corpus->boards + p * geo->boardBytes;
+        LegacyCheck check = { grid, geo->size, pos->x, pos->y, pos->color ? 'W' : 'B', 0 };
+        
+        switch (kernel) {
+            case KERNEL_HORIZONTAL:
+                horizontalCheck(&check);
+                result += check.gameOver;
+                break;
+            case KERNEL_VERTICAL:
+                verticalCheck(&check);
+                result += check.gameOver;
+                break;
+            case KERNEL_DIAGONAL:
+                diagonalCheck(&check);
+                result += check.gameOver;
+                break;
+            case KERNEL_LEGACY_WIN:
+                horizontalCheck(&check);
+                verticalCheck(&check);
+                diagonalCheck(&check);
+                result += check.gameOver;
+                break;
+            case KERNEL_THREADED_WIN: {
+                pthread_t h, v, d;
+                pthread_create(&h, NULL, horizontalCheck, &check);
+                pthread_create(&v, NULL, verticalCheck, &check);
+                pthread_create(&d, NULL, diagonalCheck, &check);
+                pthread_join(h, NULL);
+                pthread_join(v, NULL);
+                pthread_join(d, NULL);
+                result += check.gameOver;
+                break;
+            }
+            case KERNEL_BITBOARD_WIN:
+                result += geo->checkWin(board, pos->color, pos->x, pos->y);
+                break;
+            case KERNEL_LEGACY_MOVE:
+                result += legacy_check_move(grid, geo->size, pos->checkX, pos->checkY);
+                break;
+            case KERNEL_BITBOARD_MOVE:
+                result += geo->checkMove(board, pos->checkX, pos->checkY);
+                break;
+            case KERNEL_LEGACY_RENDER:
+                result += legacy_render(grid, geo->size, buffer, sizeof(buffer));
+                break;
+            case KERNEL_TEXT_RENDER:
+                result += geo->render(board, buffer);
+                break;
+            case KERNEL_PACK:
+                result += (long)geo->pack(board, (uint8_t *)buffer);
+                break;
+            default:
+                break;
+        }
+    }
+    return result;
+}
+
+// ns/op and allocations/op for each kernel on generated positions of every
+// board size, the original scan implementations next to the current ones
+int bench_kernels(int argc, char *argv[]) {
+    long count = argc >= 1 ? atol(argv[0]) : DEFAULT_POSITIONS;
+    int rounds = argc >= 2 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    uint64_t seed = 42;
+    Corpus corpus;
+    
+    if (count <= 0 || rounds <= 0) {
+        fprintf(stderr, "positions and rounds must be positive\n");
+        return 1;
+    }
+    
+    for (size_t g = 0; g < BOARD_GEOMETRY_COUNT; g++) {
+        const BoardGeometry *geo = &boardGeometries[g];
+        if (generate_corpus(&corpus, geo, count, &seed) == -1) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 1;
+        }
+        
+        // Both families must agree before their timings mean anything
+        long wins = run_kernel(KERNEL_BITBOARD_WIN, &corpus, count);
+        if (wins != run_kernel(KERNEL_LEGACY_WIN, &corpus, count) ||
+            run_kernel(KERNEL_BITBOARD_MOVE, &corpus, count) != run_kernel(KERNEL_LEGACY_MOVE, &corpus, count)) {
+            fprintf(stderr, "%dx%d: bitboard and scan kernels disagree\n", geo->size, geo->size);
+            return 1;
+        }
+        
+        printf("%dx%d: %ld positions, %ld wins, %d rounds\n", geo->size, geo->size, count, wins, rounds);
+        printf("  %-28s %10s %10s\n", "kernel", "ns/op", "allocs/op");
+        for (int k = 0; k < KERNEL_COUNT; k++) {
+            long n = (k == KERNEL_THREADED_WIN && count > THREADED_POSITIONS) ? THREADED_POSITIONS : count;
+            int r = (k == KERNEL_THREADED_WIN) ? 1 : rounds;
+            
+            run_kernel((Kernel)k, &corpus, n);  // warm up
+            long before = atomic_load(&allocations);
+            countAllocations = 1;
+            double start = now_seconds();
+            for (int i = 0; i < r; i++) {
+                sink += run_kernel((Kernel)k, &corpus, n);
+            }
+            double elapsed = now_seconds() - start;
+            countAllocations = 0;
+            long allocs = atomic_load(&allocations) - before;
+            double ops = (double)n * r;
+            printf("  %-28s %10.1f %10.3f\n", kernelNames[k], elapsed * 1e9 / ops, allocs / ops);
+        }
+        printf("\n");
+        free_corpus(&corpus);
+    }
+    return 0;
+}
+
+static int has_neighbor(const BoardGeometry *geo, const void *board, int x, int y) {
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            int nx = x + dx, ny = y + dy;
+            if (nx >= 0 && nx < geo->size && ny >= 0 && ny < geo->size && geo->cell(board, nx, ny) != '.') return 1;
+        }
+    }
+    return 0;
+}
+
+// Opening-like positions: stones dropped next to earlier ones around the
+// center. Returns the stones placed (B is to move when even), or -1 if the
+// game was won on the way.
+static int generate_ai_position(const BoardGeometry *geo, void *board, uint64_t *seed) {
+    int n = geo->size, moves = 8 + (int)(next_random(seed) % 17);
+    
+    geo->clear(board);
+    geo->place(board, 0, n / 2, n / 2);
+    for (int m = 1; m < moves; m++) {
+        int x, y;
+        do {
+            x = n / 2 + (int)(next_random(seed) % 9) - 4;
+            y = n / 2 + (int)(next_random(seed) % 9) - 4;
+        } while (geo->checkMove(board, x, y) || !has_neighbor(geo, board, x, y));
+        geo->place(board, m & 1, x, y);
+        if (geo->checkWin(board, m & 1, x, y)) return -1;
+    }
+    return moves;
+}
+
+// Nodes/sec and depth reached per move for 1, 2, 4... search threads, each
+// count starting from an empty transposition table
+int bench_ai(int argc, char *argv[]) {
+    int count = argc >= 1 ? atoi(argv[0]) : DEFAULT_AI_POSITIONS;
+    int moveMs = argc >= 2 ? atoi(argv[1]) : DEFAULT_AI_MOVE_MS;
+    int maxThreads = argc >= 3 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const BoardGeometry *geo = findBoardGeometry(15);
+    
+    if (count <= 0 || moveMs <= 0) {
+        fprintf(stderr, "positions and ms per move must be positive\n");
+        return 1;
+    }
+    if (maxThreads < 1) maxThreads = 1;
+    if (maxThreads > AI_MAX_THREADS) maxThreads = AI_MAX_THREADS;
+    
+    uint8_t *boards = (uint8_t *)aligned_alloc(8, count * geo->boardBytes);
+    int *colors = (int *)malloc(count * sizeof(int));
+    if (boards == NULL || colors == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    uint64_t seed = 42;
+    for (int p = 0; p < count; p++) {
+        int moves;
+        while ((moves = generate_ai_position(geo, boards + p * geo->boardBytes, &seed)) < 0) {
+        }
+        colors[p] = moves & 1;
+    }
+    
+    printf("%dx%d: %d positions, %d ms per move\n", geo->size, geo->size, count, moveMs);
+    printf("  %8s %12s %10s %10s\n", "threads", "knodes/s", "depth", "ms/move");
+    for (int t = 1; t <= maxThreads; t *= 2) {
+        AiTable *table = aiCreateTable(AI_TABLE_MB);
+        AiEngine *engine = table ? aiCreateEngine(table, t) : NULL;
+        if (engine == NULL) {
+            fprintf(stderr, "Failed to start the engine\n");
+            return 1;
+        }
+        uint64_t nodes = 0, micros = 0;
+        long depth = 0;
+        for (int p = 0; p < count; p++) {
+            AiResult result;
+            aiSearch(engine, geo, boards + p * geo->boardBytes, colors[p], moveMs, &result);
+            nodes += result.nodes;
+            micros += result.micros;
+            depth += result.depth;
+        }
+        printf("  %8d %12.1f %10.1f %10.1f\n", t, micros ? nodes * 1000.0 / micros : 0.0,
+               (double)depth / count, micros / 1000.0 / count);
+        // Engines and tables stay alive: helper threads are parked, not joined
+    }
+    free(boards);
+    free(colors);
+    return 0;
+}
+
+// Solves random positions for both sides, first against an empty cache and
+// then again with the proofs from the first pass in it
+int bench_vcf(int argc, char *argv[]) {
+    int count = argc >= 1 ? atoi(argv[0]) : DEFAULT_VCF_POSITIONS;
+    const BoardGeometry *geo = findBoardGeometry(15);
+    
+    if (count <= 0) {
+        fprintf(stderr, "positions must be positive\n");
+        return 1;
+    }
+    uint8_t *boards = (uint8_t *)aligned_alloc(8, count * geo->boardBytes);
+    VcfCache *cache = vcfCreateCache(VCF_CACHE_MB);
+    if (boards == NULL || cache == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    uint64_t seed = 7;
+    for (int p = 0; p < count; p++) {
+        while (generate_ai_position(geo, boards + p * geo->boardBytes, &seed) < 0) {
+        }
+    }
+    
+    printf("%dx%d: %d positions, both sides, up to %d nodes\n", geo->size, geo->size, count, VCF_MAX_NODES);
+    printf("  %6s %8s %10s %10s %10s %10s\n", "pass", "wins", "gave up", "nodes", "us/solve", "max us");
+    for (int pass = 1; pass <= 2; pass++) {
+        uint64_t nodes = 0, micros = 0, maxMicros = 0;
+        long wins = 0, gaveUp = 0;
+        for (int p = 0; p < count; p++) {
+            for (int color = 0; color < 2; color++) {
+                VcfResult result;
+                wins += vcfSolve(cache, geo, boards + p * geo->boardBytes, color, VCF_MAX_NODES, &result);
+                gaveUp += !result.complete;
+                nodes += result.nodes;
+                micros += result.micros;
+                if (result.micros > maxMicros) maxMicros = result.micros;
+            }
+        }
+        printf("  %6s %8ld %10ld %10.1f %10.1f %10llu\n", pass == 1 ? "cold" : "cached", wins, gaveUp,
+               (double)nodes / (2 * count), (double)micros / (2 * count), (unsigned long long)maxMicros);
+    }
+    free(boards);
+    return 0;
+}
+
+static void heap_swap(TimerHeap *heap, uint32_t a, uint32_t b) {
+    uint64_t expires = heap->expires[a];
+    uint32_t session = heap->session[a];
+    heap->expires[a] = heap->expires[b];
+    heap->session[a] = heap->session[b];
+    heap->expires[b] = expires;
+    heap->session[b] = session;
+    heap->position[heap->session[a]] = a;
+    heap->position[heap->session[b]] = b;
+}
+
+static void heap_fix(TimerHeap *heap, uint32_t i) {
+    while (i > 0 && heap->expires[(i - 1) / 2] > heap->expires[i]) {
+        heap_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        uint32_t least = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heap->count && heap->expires[left] < heap->expires[least]) least = left;
+        if (right < heap->count && heap->expires[right] < heap->expires[least]) least = right;
+        if (least == i) break;
+        heap_swap(heap, i, least);
+        i = least;
+    }
+}
+
+static void heap_cancel(TimerHeap *heap, uint32_t session) {
+    uint32_t i = heap->position[session];
+    if (i == UINT32_MAX) return;
+    heap->position[session] = UINT32_MAX;
+    if (i == --heap->count) return;
+    heap->expires[i] = heap->expires[heap->count];
+    heap->session[i] = heap->session[heap->count];
+    heap->position[heap->session[i]] = i;
+    heap_fix(heap, i);
+}
+
+static void heap_arm(TimerHeap *heap, uint32_t session, uint64_t expires) {
+    heap_cancel(heap, session);
+    uint32_t i = heap->count++;
+    heap->expires[i] = expires;
+    heap->session[i] = session;
+    heap->position[session] = i;
+    heap_fix(heap, i);
+}
+
+static void count_expiry(void *data) {
+    (void)data;
+    sink++;
+}
+
+// The reactor's timer load with every session's clock running: every move cancels
+// the mover's clock and arms the opponent's, and time advances as it would
+// with TIMER_MOVES_PER_MS moves a millisecond. Heap versus wheel.
+int bench_timers(int argc, char *argv[]) {
+    long sessions = argc >= 1 ? atol(argv[0]) : DEFAULT_TIMER_SESSIONS;
+    uint64_t seed = 11;
+    
+    if (sessions <= 0 || sessions >= UINT32_MAX) {
+        fprintf(stderr, "sessions must be positive\n");
+        return 1;
+    }
+    TimerHeap heap;
+    heap.expires = (uint64_t *)malloc(sessions * sizeof(uint64_t));
+    heap.session = (uint32_t *)malloc(sessions * sizeof(uint32_t));
+    heap.position = (uint32_t *)malloc(sessions * sizeof(uint32_t));
+    Timer *timers = (Timer *)calloc(sessions, sizeof(Timer));
+    TimerWheel *wheel = (TimerWheel *)malloc(sizeof(TimerWheel));
+    uint32_t *movers = (uint32_t *)malloc(TIMER_CHURN * sizeof(uint32_t));
+    if (heap.expires == NULL || heap.session == NULL || heap.position == NULL || timers == NULL || wheel == NULL ||
+        movers == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    for (long i = 0; i < TIMER_CHURN; i++) movers[i] = (uint32_t)(next_random(&seed) % sessions);
+    
+    // Heap: every session starts with a clock somewhere in the next move limit
+    uint64_t now = 0;
+    heap.count = 0;
+    for (long i = 0; i < sessions; i++) heap.position[i] = UINT32_MAX;
+    double start = now_seconds();
+    for (long i = 0; i < sessions; i++) heap_arm(&heap, (uint32_t)i, next_random(&seed) % TIMER_MOVE_MS);
+    double heapFill = now_seconds() - start;
+    long heapFired = 0;
+    start = now_seconds();
+    for (long i = 0; i < TIMER_CHURN; i++) {
+        if (i % TIMER_MOVES_PER_MS == 0) {
+            now++;
+            while (heap.count > 0 && heap.expires[0] <= now) {
+                heap_cancel(&heap, heap.session[0]);
+                heapFired++;
+            }
+        }
+        heap_arm(&heap, movers[i], now + TIMER_MOVE_MS);
+    }
+    double heapChurn = now_seconds() - start;
+    
+    // Wheel: the same deadlines in the same order
+    seed = 11;
+    for (long i = 0; i < TIMER_CHURN; i++) next_random(&seed);
+    now = 0;
+    timer_wheel_init(wheel, now);
+    start = now_seconds();
+    for (long i = 0; i < sessions; i++) {
+        timer_arm(wheel, &timers[i], now, next_random(&seed) % TIMER_MOVE_MS, count_expiry, NULL);
+    }
+    double wheelFill = now_seconds() - start;
+    sink = 0;
+    start = now_seconds();
+    for (long i = 0; i < TIMER_CHURN; i++) {
+        if (i % TIMER_MOVES_PER_MS == 0) timer_advance(wheel, ++now);
+        timer_arm(wheel, &timers[movers[i]], now, TIMER_MOVE_MS, count_expiry, NULL);
+    }
+    double wheelChurn = now_seconds() - start;
+    
+    printf("%ld sessions, %d moves over %.1f s of clock time, %ld vs %ld clocks ran out\n", sessions, TIMER_CHURN,
+           now / 1000.0, heapFired, (long)sink);
+    printf("  %6s %14s %14s\n", "", "ns/arm (fill)", "ns/move");
+    printf("  %6s %14.1f %14.1f\n", "heap", heapFill * 1e9 / sessions, heapChurn * 1e9 / TIMER_CHURN);
+    printf("  %6s %14.1f %14.1f\n", "wheel", wheelFill * 1e9 / sessions, wheelChurn * 1e9 / TIMER_CHURN);
+    
+    free(heap.expires);
+    free(heap.session);
+    free(heap.position);
+    free(timers);
+    free(wheel);
+    free(movers);
+    return 0;
+}
@@ -0,0 +1,114 @@
+// Board kernels for one size, included by gomoku-board.h once per size with
+// BOARD_N (cells per side) and BOARD_WORD (an unsigned type of at least
+// BOARD_N bits) defined. No include guard on purpose.
+
+#define BOARD_PASTE2(a, b, c) a##b##c
+#define BOARD_PASTE(a, b, c) BOARD_PASTE2(a, b, c)
+#define BOARD_FN(f) BOARD_PASTE(board, BOARD_N, _##f)
+#define BOARD_T BOARD_PASTE(board, BOARD_N, _t)
+#define BOARD_LABEL (BOARD_N > 10 ? 2 : 1)
+
+// rows[c][x] bit y, cols[c][y] bit x, diag[c][x - y + N - 1] bit y, anti[c][x + y] bit x
+typedef struct {
+    BOARD_WORD rows[2][BOARD_N];
+    BOARD_WORD cols[2][BOARD_N];
+    BOARD_WORD diag[2][2 * BOARD_N - 1];
+    BOARD_WORD anti[2][2 * BOARD_N - 1];
+} BOARD_T;
+
+static void BOARD_FN(clear)(void *board) {
+    memset(board, 0, sizeof(BOARD_T));
+}
+
+static int BOARD_FN(checkMove)(const void *board, int x, int y) {
+    const BOARD_T *b = (const BOARD_T *)board;
+    if (x < 0 || x >= BOARD_N || y < 0 || y >= BOARD_N) {
+        return 1;
+    }
+    return ((b->rows[0][x] | b->rows[1][x]) >> y) & 1;
+}
+
+static void BOARD_FN(place)(void *board, int color, int x, int y) {
+    BOARD_T *b = (BOARD_T *)board;
+    b->rows[color][x] |= (BOARD_WORD)(1u << y);
+    b->cols[color][y] |= (BOARD_WORD)(1u << x);
+    b->diag[color][x - y + BOARD_N - 1] |= (BOARD_WORD)(1u << y);
+    b->anti[color][x + y] |= (BOARD_WORD)(1u << x);
+}
+
+// Only the four lines through (x, y) are examined
+static int BOARD_FN(checkWin)(const void *board, int color, int x, int y) {
+    const BOARD_T *b = (const BOARD_T *)board;
+    return fiveInRow(b->rows[color][x]) != 0
+        || fiveInRow(b->cols[color][y]) != 0
+        || fiveInRow(b->diag[color][x - y + BOARD_N - 1]) != 0
+        || fiveInRow(b->anti[color][x + y]) != 0;
+}
+
+static char BOARD_FN(cell)(const void *board, int x, int y) {
+    const BOARD_T *b = (const BOARD_T *)board;
+    if ((b->rows[0][x] >> y) & 1) return 'B';
+    if ((b->rows[1][x] >> y) & 1) return 'W';
+    return '.';
+}
+
+// Packs the cells 2 bits each (0 empty, 1 B, 2 W), row by row, four to a
+// byte from the low bits; returns the bytes written
+static size_t BOARD_FN(pack)(const void *board, uint8_t *out) {
+    const BOARD_T *b = (const BOARD_T *)board;
+    size_t len = (BOARD_N * BOARD_N + 3) / 4;
+    memset(out, 0, len);
+    for (int i = 0; i < BOARD_N; i++) {
+        unsigned int black = b->rows[0][i], white = b->rows[1][i];
+        while (black | white) {
+            int j = __builtin_ctz(black | white);
+            int k = i * BOARD_N + j;
+            out[k / 4] |= (uint8_t)((((black >> j) & 1) ? 1 : 2) << (k % 4 * 2));
+            black &= ~(1u << j);
+            white &= ~(1u << j);
+        }
+    }
+    return len;
+}
+
+// Writes the text board (same layout as the original 8x8 one) into buf,
+// which must hold BOARD_RENDER_MAX bytes
+static int BOARD_FN(render)(const void *board, char *buf) {
+    const BOARD_T *b = (const BOARD_T *)board;
+    char *o = buf;
+
+    *o++ = '\n';
+    for (int i = 0; i <= BOARD_LABEL; i++) *o++ = ' ';
+    for (int j = 0; j < BOARD_N; j++) {
+        if (j >= 10) *o++ = (char)('0' + j / 10);
+        *o++ = (char)('0' + j % 10);
+        if (j < BOARD_N - 1) {
+            if (BOARD_LABEL == 2 && j < 10) *o++ = ' ';
+            *o++ = ' ';
+        }
+    }
+    *o++ = '\n';
+
+    for (int i = 0; i < BOARD_N; i++) {
+        if (BOARD_LABEL == 2) *o++ = (i >= 10) ? (char)('0' + i / 10) : ' ';
+        *o++ = (char)('0' + i % 10);
+        *o++ = ' ';
+        unsigned int black = b->rows[0][i], white = b->rows[1][i];
+        for (int j = 0; j < BOARD_N; j++) {
+            *o++ = ((black >> j) & 1) ? 'B' : ((white >> j) & 1) ? 'W' : '.';
+            if (BOARD_LABEL == 2) *o++ = ' ';
+            *o++ = ' ';
+        }
+        *o++ = '\n';
+    }
+    *o = '\0';
+    return (int)(o - buf);
+}
+
+#undef BOARD_PASTE2
+#undef BOARD_PASTE
+#undef BOARD_FN
+#undef BOARD_T
+#undef BOARD_LABEL
+#undef BOARD_N
+#undef BOARD_WORD
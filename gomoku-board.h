@@ -0,0 +1,76 @@
+#ifndef GOMOKU_BOARD_H
+#define GOMOKU_BOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Board geometry layer: every supported size gets its own set of kernels,
+// generated from gomoku-board-kernels.h with the size as a compile-time
+// constant, and a match picks one geometry when it is created.
+//
+// A board is stored as line bitboards, one word per row, column, diagonal
+// and anti-diagonal for each color, so its footprint grows with the size.
+// Colors are 0 = B and 1 = W.
+
+#define BOARD_RENDER_MAX 2048
+
+typedef struct BOARDGEOMETRY {
+    int size;              // cells per side
+    int cells;             // size * size, moves until a draw
+    size_t boardBytes;     // bytes of line storage behind Game.board
+    const char *range;     // coordinate range shown in prompts, e.g. "0-7"
+    void (*clear)(void *board);
+    int (*checkMove)(const void *board, int x, int y);   // 1 if invalid
+    void (*place)(void *board, int color, int x, int y);
+    int (*checkWin)(const void *board, int color, int x, int y);
+    char (*cell)(const void *board, int x, int y);
+    int (*render)(const void *board, char *buf);          // returns length
+    size_t (*pack)(const void *board, uint8_t *out);      // 2 bits per cell, returns length
+} BoardGeometry;
+
+// A set bit in the result marks the first of five consecutive set bits
+static inline unsigned int fiveInRow(unsigned int w) {
+    return w & (w >> 1) & (w >> 2) & (w >> 3) & (w >> 4);
+}
+
+#define BOARD_N 8
+#define BOARD_WORD uint8_t
+#include "gomoku-board-kernels.h"
+
+#define BOARD_N 15
+#define BOARD_WORD uint16_t
+#include "gomoku-board-kernels.h"
+
+#define BOARD_N 19
+#define BOARD_WORD uint32_t
+#include "gomoku-board-kernels.h"
+
+#define BOARD_GEOMETRY(n, range) \
+    { n, n * n, sizeof(board##n##_t), range, board##n##_clear, board##n##_checkMove, \
+      board##n##_place, board##n##_checkWin, board##n##_cell, board##n##_render, board##n##_pack }
+
+static const BoardGeometry boardGeometries[] = {
+    BOARD_GEOMETRY(8, "0-7"),
+    BOARD_GEOMETRY(15, "0-14"),
+    BOARD_GEOMETRY(19, "0-18"),
+};
+
+#undef BOARD_GEOMETRY
+
+// Room for the line storage of the largest board
+#define BOARD_BYTES_MAX sizeof(board19_t)
+
+#define BOARD_GEOMETRY_COUNT (sizeof(boardGeometries) / sizeof(boardGeometries[0]))
+
+// Returns NULL for unsupported sizes
+static inline const BoardGeometry *findBoardGeometry(int size) {
+    for (size_t i = 0; i < BOARD_GEOMETRY_COUNT; i++) {
+        if (boardGeometries[i].size == size) {
+            return &boardGeometries[i];
+        }
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "gomoku-board.h"
+#include "gomoku-record.h"
+#include "gomoku-book.h"
+
+// Opening book builder: replays finished games from game logs and counts,
+// for every position in the first plies, which replies were played and how
+// the game ended for the side that played them. Replies seen fewer than the
+// minimum number of times are left out, the rest are written sorted for
+// the server to map from its data directory.
+
+#define DEFAULT_PLIES 12
+#define DEFAULT_MIN_GAMES 2
+
+typedef struct BOOKTALLY {
+    BookEntry *entries;        // open addressing on (key, cell); games == 0 is empty
+    size_t cap;
+    size_t count;
+} BookTally;
+
+BookTally tally;
+
+int build_book(const char *out, int plies, int minGames, int nLogs, char **logs);
+int dump_book(const char *path);
+void tally_add(uint64_t key, int cell, int won, int drawn);
+size_t tally_slot(const BookTally *t, uint64_t key, int cell);
+int compare_entries(const void *a, const void *b);
+
+int main(int argc, char *argv[]) {
+    int plies = DEFAULT_PLIES, minGames = DEFAULT_MIN_GAMES;
+    int opt;
+
+    if (argc >= 3 && strcmp(argv[1], "dump") == 0) {
+        return dump_book(argv[2]);
+    }
+    if (argc >= 2 && strcmp(argv[1], "build") == 0) {
+        argc--;
+        argv++;
+        while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+            switch (opt) {
+                case 'p': plies = atoi(optarg); break;
+                case 'n': minGames = atoi(optarg); break;
+                default: plies = 0; break;  // print usage
+            }
+        }
+        argc -= optind;
+        argv += optind;
+        if (argc >= 2 && plies > 0 && minGames > 0) {
+            return build_book(argv[0], plies, minGames, argc - 1, argv + 1);
+        }
+    }
+
+    fprintf(stderr, "Usage: gomoku-book-build build [-p plies] [-n min games] book games.rec...\n"
+                    "       gomoku-book-build dump book\n"
+                    "  defaults: %d plies, replies seen in at least %d games\n",
+            DEFAULT_PLIES, DEFAULT_MIN_GAMES);
+    return 1;
+}
+
+int build_book(const char *out, int plies, int minGames, int nLogs, char **logs) {
+    static GameRecord record;
+    uint8_t board[BOARD_BYTES_MAX];
+    long games = 0, skipped = 0;
+
+    for (int i = 0; i < nLogs; i++) {
+        RecordReader *reader = open_record_reader(logs[i]);
+        if (reader == NULL) {
+            fprintf(stderr, "%s: cannot read games\n", logs[i]);
+            return 1;
+        }
+        int status;
+        while ((status = read_game_record(reader, &record)) != 0) {
+            const BoardGeometry *geo = (status == 1) ? findBoardGeometry(record.size) : NULL;
+            if (geo == NULL) {
+                skipped++;
+                continue;
+            }
+            games++;
+            geo->clear(board);
+            for (int ply = 0; ply < record.nMoves && ply < plies; ply++) {
+                int color = ply % 2;
+                int x = record.moves[ply][0], y = record.moves[ply][1];
+                if (geo->checkMove(board, x, y)) {
+                    break;  // not a legal game past this point
+                }
+                int symmetry;
+                uint64_t key = bookKey(geo, board, color, &symmetry);
+                int cx = x, cy = y;
+                bookTransform(symmetry, geo->size, &cx, &cy);
+                tally_add(key, cx * geo->size + cy,
+                          record.result == (color == 0 ? RESULT_B_WON : RESULT_W_WON),
+                          record.result == RESULT_DRAW);
+                geo->place(board, color, x, y);
+            }
+        }
+        close_record_reader(reader);
+    }
+
+    // Compact the kept replies to the front and sort them
+    size_t kept = 0;
+    for (size_t i = 0; i < tally.cap; i++) {
+        if (tally.entries[i].games >= (uint32_t)minGames) {
+            tally.entries[kept++] = tally.entries[i];
+        }
+    }
+    if (kept > 0) {
+        qsort(tally.entries, kept, sizeof(BookEntry), compare_entries);
+    }
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        perror(tmp);
+        return 1;
+    }
+    BookHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+    header.entrySize = sizeof(BookEntry);
+    header.count = kept;
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        (kept > 0 && fwrite(tally.entries, sizeof(BookEntry), kept, fp) != kept) ||
+        fclose(fp) != 0 || rename(tmp, out) != 0) {
+        perror(out);
+        unlink(tmp);
+        return 1;
+    }
+
+    printf("%ld games (%ld skipped), %zu distinct replies, %zu kept in %s\n",
+           games, skipped, tally.count, kept, out);
+    return 0;
+}
+
+int dump_book(const char *path) {
+    Book *book = open_book(path);
+    if (book == NULL) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return 1;
+    }
+    printf("%llu entries\n", (unsigned long long)book->count);
+    for (uint64_t i = 0; i < book->count; i++) {
+        const BookEntry *e = &book->entries[i];
+        printf("%016llx cell %4u  games %6u  wins %6u  draws %6u  score %.3f\n",
+               (unsigned long long)e->key, e->cell, e->games, e->wins, e->draws, bookScore(e));
+    }
+    return 0;
+}
+
+void tally_add(uint64_t key, int cell, int won, int drawn) {
+    if (tally.count * 2 >= tally.cap) {
+        BookTally grown;
+        grown.cap = tally.cap ? tally.cap * 2 : 4096;
+        grown.count = 0;
+        grown.entries = (BookEntry *)calloc(grown.cap, sizeof(BookEntry));
+        if (grown.entries == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < tally.cap; i++) {
+            if (tally.entries[i].games == 0) continue;
+            size_t slot = tally_slot(&grown, tally.entries[i].key, tally.entries[i].cell);
+            grown.entries[slot] = tally.entries[i];
+            grown.count++;
+        }
+        free(tally.entries);
+        tally = grown;
+    }
+
+    BookEntry *e = &tally.entries[tally_slot(&tally, key, cell)];
+    if (e->games == 0) {
+        e->key = key;
+        e->cell = (uint16_t)cell;
+        tally.count++;
+    }
+    e->games++;
+    e->wins += won;
+    e->draws += drawn;
+}
+
+// The slot holding (key, cell), or the empty one where it goes
+size_t tally_slot(const BookTally *t, uint64_t key, int cell) {
+    size_t slot = (key ^ (uint64_t)cell * 0x9e3779b97f4a7c15ULL) & (t->cap - 1);
+    while (t->entries[slot].games != 0 &&
+           (t->entries[slot].key != key || t->entries[slot].cell != cell)) {
+        slot = (slot + 1) & (t->cap - 1);
+    }
+    return slot;
+}
+
+// By key, and within a key best reply first
+int compare_entries(const void *a, const void *b) {
+    const BookEntry *ea = (const BookEntry *)a, *eb = (const BookEntry *)b;
+    if (ea->key != eb->key) return ea->key < eb->key ? -1 : 1;
+    double sa = bookScore(ea), sb = bookScore(eb);
+    if (sa != sb) return sa > sb ? -1 : 1;
+    return (int)ea->cell - (int)eb->cell;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gomoku-book.h"
+
+#define BOOK_MAX_CELLS (19 * 19)
+
+void bookTransform(int symmetry, int size, int *x, int *y) {
+    if (symmetry & 4) {
+        int t = *x;
+        *x = *y;
+        *y = t;
+    }
+    if (symmetry & 1) *x = size - 1 - *x;
+    if (symmetry & 2) *y = size - 1 - *y;
+}
+
+void bookInverse(int symmetry, int size, int *x, int *y) {
+    if (symmetry & 2) *y = size - 1 - *y;
+    if (symmetry & 1) *x = size - 1 - *x;
+    if (symmetry & 4) {
+        int t = *x;
+        *x = *y;
+        *y = t;
+    }
+}
+
+// FNV-1a over the cells read in each orientation, then a final mix; the
+// lowest result wins
+uint64_t bookKey(const BoardGeometry *geo, const void *board, int color, int *symmetry) {
+    int n = geo->size;
+    char cells[BOOK_MAX_CELLS];
+    uint64_t best = 0;
+
+    for (int x = 0; x < n; x++) {
+        for (int y = 0; y < n; y++) {
+            cells[x * n + y] = geo->cell(board, x, y);
+        }
+    }
+
+    *symmetry = 0;
+    for (int s = 0; s < 8; s++) {
+        uint64_t h = 14695981039346656037ULL ^ (uint64_t)(n * 2 + color);
+        for (int cx = 0; cx < n; cx++) {
+            for (int cy = 0; cy < n; cy++) {
+                int x = cx, y = cy;
+                bookInverse(s, n, &x, &y);
+                h ^= (unsigned char)cells[x * n + y];
+                h *= 1099511628211ULL;
+            }
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        if (s == 0 || h < best) {
+            best = h;
+            *symmetry = s;
+        }
+    }
+    return best;
+}
+
+// Wins count whole, draws half, with one win and one loss assumed up front
+// so a reply seen once does not beat one that won 40 of 50
+double bookScore(const BookEntry *entry) {
+    return (entry->wins + 0.5 * entry->draws + 1.0) / (entry->games + 2.0);
+}
+
+Book *open_book(const char *path) {
+    struct stat st;
+    BookHeader header;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(header) ||
+        read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, BOOK_MAGIC, sizeof(header.magic)) != 0 ||
+        header.entrySize != sizeof(BookEntry) ||
+        header.count != (st.st_size - sizeof(header)) / sizeof(BookEntry)) {
+        fprintf(stderr, "%s: not an opening book, ignored\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    Book *book = (Book *)calloc(1, sizeof(Book));
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (book == NULL || map == MAP_FAILED) {
+        if (map != MAP_FAILED) munmap(map, st.st_size);
+        free(book);
+        return NULL;
+    }
+    book->map = map;
+    book->mapBytes = st.st_size;
+    book->entries = (const BookEntry *)((const char *)map + sizeof(header));
+    book->count = header.count;
+    return book;
+}
+
+int bookMove(const Book *book, const BoardGeometry *geo, const void *board, int color, int *x, int *y) {
+    int symmetry;
+    uint64_t key = bookKey(geo, board, color, &symmetry);
+    uint64_t lo = 0, hi = book->count;
+
+    // First entry with this key; the builder put the best reply there
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (book->entries[mid].key < key) lo = mid + 1; else hi = mid;
+    }
+    for (; lo < book->count && book->entries[lo].key == key; lo++) {
+        int cx = book->entries[lo].cell / geo->size, cy = book->entries[lo].cell % geo->size;
+        bookInverse(symmetry, geo->size, &cx, &cy);
+        // A different position with the same key would show up as an occupied cell
+        if (geo->checkMove(board, cx, cy) == 0) {
+            *x = cx;
+            *y = cy;
+            return 1;
+        }
+    }
+    return 0;
+}
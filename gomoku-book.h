@@ -0,0 +1,59 @@
+#ifndef GOMOKU_BOOK_H
+#define GOMOKU_BOOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gomoku-board.h"
+
+// Opening book: for positions seen early in recorded games, the replies
+// that were played and how they turned out.
+//
+// The file is a header and then entries sorted by key, several per key
+// (one per reply), best reply first. gomoku-book builds it from game logs;
+// the server maps it read-only, so any thread looks positions up with a
+// binary search and no locks. Keys cover the board size, the side to move
+// and the stones, taken in whichever of the board's eight symmetries hashes
+// lowest, so rotated and mirrored openings share entries. Replies are
+// stored in that orientation too.
+
+#define BOOK_FILE "opening.book"
+#define BOOK_MAGIC "GMKBOOK1"
+
+typedef struct BOOKHEADER {
+    char magic[8];
+    uint32_t entrySize;    // sizeof(BookEntry) of the writer
+    uint32_t reserved;
+    uint64_t count;
+} BookHeader;
+
+typedef struct BOOKENTRY {
+    uint64_t key;
+    uint16_t cell;         // reply, x * size + y in the key's orientation
+    uint16_t reserved;
+    uint32_t games;
+    uint32_t wins;         // for the side that played the reply
+    uint32_t draws;
+} BookEntry;
+
+typedef struct BOOK {
+    const BookEntry *entries;
+    uint64_t count;
+    void *map;
+    size_t mapBytes;
+} Book;
+
+// Key for the position with color to move; symmetry gets the orientation
+// the key was taken in, for bookTransform
+uint64_t bookKey(const BoardGeometry *geo, const void *board, int color, int *symmetry);
+// Maps a cell into (inverse: out of) the orientation of a symmetry
+void bookTransform(int symmetry, int size, int *x, int *y);
+void bookInverse(int symmetry, int size, int *x, int *y);
+// How good a reply is for the side playing it, between 0 and 1
+double bookScore(const BookEntry *entry);
+
+// NULL if the file is missing or not a book
+Book *open_book(const char *path);
+// The book's best reply for color in this position; 0 if it has none
+int bookMove(const Book *book, const BoardGeometry *geo, const void *board, int color, int *x, int *y);
+
+#endif
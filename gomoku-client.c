@@ -3,242 +3,634 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 
-int get_server_connection(char *hostname, char *port);
+#include "gomoku-protocol.h"
+#include "gomoku-link.h"
+
+// Interactive client, or with -s a batch of scripted sessions: every
+// session logs in, plays its games by the script and the totals are
+// printed at the end, for regression and soak runs against a server.
+
+#define INPUT_READY 256            // from next_event: a line of input, above every message type
+#define SCRIPT_MAX_MOVES 361       // a full 19x19 board
+#define BATCH_EVENTS 256
+#define BATCH_RETRY_MS 1000        // before dialling again when a busy server did not say
+#define BATCH_BACKOFF_MAX 3        // doublings of that wait at most
+#define TRUE 1
+#define FALSE 0
+
+// Standard input cut into lines; read only when a line is wanted, so the
+// socket is still served while the player thinks
+typedef struct INPUT {
+    char buf[256];
+    size_t len;
+    int eof;
+} Input;
+
+// A batch game by move number: whoever is to move plays the move the
+// script has for that number, or the first empty cell if it has none
+// or that one is taken
+typedef struct SCRIPT {
+    uint8_t moves[SCRIPT_MAX_MOVES][2];
+    int nMoves;
+    int size;                  // 0 for the server default
+} Script;
+
+typedef enum {
+    SESSION_IDLE,              // between connections, until retryAt
+    SESSION_CONNECTING,
+    SESSION_REGISTERING,       // opening sent, waiting for the registration result
+    SESSION_LOGGING_IN,
+    SESSION_PLAYING,           // queued or in a game
+    SESSION_DONE
+} SessionState;
+
+typedef struct BATCHSESSION {
+    ServerLink link;
+    int id;
+    SessionState state;
+    int registered;            // account exists, log in from now on
+    int gamesLeft;
+    int events;                // what epoll watches for
+    int color;
+    const BoardGeometry *geo;
+    uint64_t board[BOARD_BYTES_MAX / sizeof(uint64_t) + 1];
+    unsigned int moves;        // number of the last move applied to board
+    int resyncing;
+    int busyStreak;            // busy answers in a row, each doubling the wait
+    uint64_t retryAt;          // ms
+} BatchSession;
+
+typedef struct BATCHTOTALS {
+    long games;
+    long won;
+    long lost;
+    long drawn;
+    long offScript;            // moves the script had no free cell for
+    long busy;                 // times the server was too busy and the session dialled again
+    long errors;               // failed connects, refusals, dropped connections
+} BatchTotals;
+
+// Batch settings and state; one thread runs every session
+Script script;
+struct addrinfo *batch_addr;
+const char *batch_prefix;
+int batch_opponent;
+int batch_epoll = -1;
+int batch_idle;                // sessions in SESSION_IDLE
+int batch_active;              // sessions not yet done
+BatchTotals totals;
+
+// Interactive client
+int get_server_connection(ServerLink *link, char *hostname, char *port);
 void print_ip(struct addrinfo *ai);
+int next_event(ServerLink *link, Input *input, int wantInput, Payload *payload);
+int read_frame(ServerLink *link, Payload *payload);
+int send_frame(ServerLink *link, Frame *frame);
+int read_line(Input *input, char *line, size_t size);
+int prompt_word(Input *input, const char *prompt, char *word, size_t size);
+int expect_auth_result(ServerLink *link, const char *success);
+int join_game(ServerLink *link, Input *input, int defaultSize, int opponent);
+int resume_session(ServerLink *link, char *hostname, char *port, const uint8_t *token, int graceSeconds);
+void print_result(Payload *payload, int spectating);
+void print_error(int code, unsigned int retryMs);
+
+// Batch mode
+int run_batch(const char *path, int nSessions, int games, char *hostname, char *port);
+int load_script(const char *path, Script *script);
+void session_dial(BatchSession *session);
+void session_connected(BatchSession *session);
+void session_input(BatchSession *session);
+void session_message(BatchSession *session, int type, Payload *payload);
+void session_move(BatchSession *session);
+void session_send(BatchSession *session, Frame *frame);
+void session_watch(BatchSession *session);
+void session_next(BatchSession *session, uint64_t delayMs);
+void session_fail(BatchSession *session, const char *problem);
+void session_busy(BatchSession *session, unsigned int retryMs);
+uint64_t now_ms();
 
 int main(int argc, char *argv[]) {
-    ssize_t sent, received;
-    char buffer[512];
-    int sockfd;
+    ServerLink link;
+    Input input;
+    Payload payload;
+    Frame frame;
+    int type;
+    int defaultSize;
+    char name[51];
+    char buffer[BOARD_RENDER_MAX];
+    uint64_t board[BOARD_BYTES_MAX / sizeof(uint64_t) + 1];  // our copy, updated by deltas
+    const BoardGeometry *geo = NULL;
+    unsigned int moves = 0;    // number of the last move applied to board
+    int resyncing = 0;         // asked for a full board, deltas before it are stale
+    int wantMove = FALSE;      // prompted for a move, none sent yet
+    int opponent = OPPONENT_ANY;
+    const char *watch = NULL;  // spectate this player's game; "" for the featured one
+    const char *scriptPath = NULL;
+    int nSessions = 1, games = 1;
+    char prefix[64];
+    uint8_t token[PROTO_TOKEN_BYTES];   // from the last SESSION, to resume with
+    int haveToken = 0;
+    int graceSeconds = 0;      // how long the server keeps our seat after a drop
+    int opt;
 
-    if (argc != 3) {
-        fprintf(stderr, "arg requirement: %s hostname port#\n", argv[0]);
+    snprintf(prefix, sizeof(prefix), "batch%ld", (long)time(NULL));
+    batch_prefix = prefix;
+
+    while ((opt = getopt(argc, argv, "bw:s:c:g:p:")) != -1) {
+        switch (opt) {
+            case 'b': opponent = OPPONENT_BOT; break;
+            case 'w': watch = strcmp(optarg, "-") == 0 ? "" : optarg; break;
+            case 's': scriptPath = optarg; break;
+            case 'c': nSessions = atoi(optarg); break;
+            case 'g': games = atoi(optarg); break;
+            case 'p': batch_prefix = optarg; break;
+            default: argc = 0; break;  // print usage
+        }
+    }
+    if (argc - optind != 2 || nSessions < 1 || games < 1 || (watch != NULL && (opponent != OPPONENT_ANY || scriptPath))) {
+        fprintf(stderr, "Usage: gomoku-client [-b | -w player] hostname port\n"
+                        "       gomoku-client -s script [-c sessions] [-g games] [-b] [-p email prefix] hostname port\n"
+                        "  -b plays the bot, -w watches a player's game or with - the featured one\n"
+                        "  -s plays each session's games by the script, - reading it from stdin\n");
         return 1;
     }
+    argv += optind - 1;  // hostname and port in argv[1] and argv[2]
+
+    if (scriptPath != NULL) {
+        batch_opponent = opponent;
+        return run_batch(scriptPath, nSessions, games, argv[1], argv[2]);
+    }
 
-    sockfd = get_server_connection(argv[1], argv[2]);
-    if (sockfd < 0) {
+    link_init(&link);
+    memset(&input, 0, sizeof(input));
+    if (get_server_connection(&link, argv[1], argv[2]) == -1) {
         perror("connection failed!");
         return 1;
     }
 
     printf("Connected to server.\n");
 
-    // Login or Register
-    received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
-        perror("recv failed");
-        close(sockfd);
+    // Version handshake
+    frameBegin(&frame, MSG_HELLO);
+    framePutU8(&frame, PROTO_VERSION);
+    if (send_frame(&link, &frame) == -1) {
+        link_close(&link);
         return 1;
     }
-    buffer[received] = '\0';
-    printf("%s", buffer);
-
-    // Send choice
-    int choice;
-    scanf("%d", &choice);
-    snprintf(buffer, sizeof(buffer), "%d", choice);
-    sent = send(sockfd, buffer, strlen(buffer), 0);
-    if (sent == -1) {
-        perror("send failed");
-        close(sockfd);
+    type = read_frame(&link, &payload);
+    if (type != MSG_WELCOME) {
+        if (type == MSG_ERROR) {
+            int code = (int)payloadU8(&payload);
+            print_error(code, payloadU16(&payload));
+        }
+        else fprintf(stderr, "Unexpected reply from server\n");
+        link_close(&link);
         return 1;
     }
+    payloadU8(&payload);  // version
+    defaultSize = (int)payloadU8(&payload);
 
-    if (choice == 2) {
-        // Registration flow
-        // Email
-        received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
-            perror("recv failed");
-            close(sockfd);
-            return 1;
-        }
-        buffer[received] = '\0';
-        printf("%s", buffer);
-
-        char email[51];
-        scanf("%50s", email);
-        sent = send(sockfd, email, strlen(email), 0);
-        if (sent == -1) {
-            perror("send failed");
-            close(sockfd);
+    if (watch != NULL) {
+        // Spectators skip the login
+        frameBegin(&frame, MSG_SPECTATE);
+        framePutString(&frame, watch);
+        if (send_frame(&link, &frame) == -1) {
+            link_close(&link);
             return 1;
         }
+    } else if (join_game(&link, &input, defaultSize, opponent) == -1) {
+        link_close(&link);
+        return 1;
+    }
 
-        // Password
-        received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
-            perror("recv failed");
-            close(sockfd);
-            return 1;
+    // Game loop; a connection lost mid-game is resumed with the session token
+    while (1) {
+        while ((type = next_event(&link, &input, wantMove, &payload)) > 0) {
+            if (type == INPUT_READY) {
+                char line[64], word[16];
+                int x, y;
+                if (read_line(&input, line, sizeof(line)) == -1) {
+                    fprintf(stderr, "Invalid input\n");
+                    break;
+                }
+                if (sscanf(line, "%15s", word) == 1 && (strcmp(word, "hint") == 0 || strcmp(word, "claim") == 0)) {
+                    frameBegin(&frame, word[0] == 'h' ? MSG_HINT : MSG_ADJUDICATE);
+                } else if (sscanf(line, "%d %d", &x, &y) == 2) {
+                    // Out of range coordinates are sent as 255 and rejected by the server
+                    frameBegin(&frame, MSG_MOVE);
+                    framePutU8(&frame, (x < 0 || x > 254) ? 255 : x);
+                    framePutU8(&frame, (y < 0 || y > 254) ? 255 : y);
+                } else {
+                    printf("Invalid input. Enter x and y (%s), hint or claim: ", geo != NULL ? geo->range : "?");
+                    fflush(stdout);
+                    continue;
+                }
+                wantMove = FALSE;
+                if (send_frame(&link, &frame) == -1) {
+                    type = -1;  // reconnect below
+                    break;
+                }
+            } else if (type == MSG_WAITING) {
+                if (payloadU8(&payload)) printf("Opponent left, finding a new match...\n");
+                else printf("Waiting for an opponent...\n");
+            } else if (type == MSG_GAME_START) {
+                char opponent[51];
+                geo = findBoardGeometry((int)payloadU8(&payload));
+                payloadU8(&payload);  // our color, announced again with each turn
+                payloadString(&payload, name, sizeof(name));
+                payloadString(&payload, opponent, sizeof(opponent));
+                if (geo == NULL || payload.error) break;
+                printf("Your name: %s, Opponent name: %s\n", name, opponent);
+            } else if (type == MSG_SPECTATING) {
+                char players[2][51];
+                geo = findBoardGeometry((int)payloadU8(&payload));
+                payloadString(&payload, players[0], sizeof(players[0]));
+                payloadString(&payload, players[1], sizeof(players[1]));
+                if (geo == NULL || payload.error) break;
+                printf("Watching %s (B) against %s (W)\n", players[0], players[1]);
+            } else if (type == MSG_BOARD) {
+                moves = payloadU16(&payload);
+                geo = payloadBoard(&payload, board);
+                if (geo == NULL) break;
+                resyncing = 0;
+                geo->render(board, buffer);
+                printf("%s", buffer);
+            } else if (type == MSG_MOVE_PLAYED) {
+                unsigned int number = payloadU16(&payload);
+                int color = (int)payloadU8(&payload);
+                int x = (int)payloadU8(&payload);
+                int y = (int)payloadU8(&payload);
+                if (resyncing || geo == NULL) continue;
+                if (payload.error || number != moves + 1 || color > 1 || geo->checkMove(board, x, y)) {
+                    // Missed or garbled update: ask for the whole board again
+                    frameBegin(&frame, MSG_RESYNC);
+                    if (send_frame(&link, &frame) == -1) break;
+                    resyncing = 1;
+                    continue;
+                }
+                geo->place(board, color, x, y);
+                moves = number;
+                geo->render(board, buffer);
+                printf("%s", buffer);
+            } else if (type == MSG_YOUR_TURN) {
+                int white = (int)payloadU8(&payload);
+                uint32_t msLeft = payloadU32(&payload);  // absent from older servers
+                printf("\n%c stone's turn", white ? 'W' : 'B');
+                if (msLeft > 0) printf(" (%u s left)", (msLeft + 999) / 1000);
+                printf(". Enter x and y (%s), hint or claim: ", geo != NULL ? geo->range : "?");
+                fflush(stdout);
+                wantMove = TRUE;
+            } else if (type == MSG_HINT_RESULT) {
+                int kind = (int)payloadU8(&payload);
+                int x = (int)payloadU8(&payload);
+                int y = (int)payloadU8(&payload);
+                int moves = (int)payloadU8(&payload);
+                if (kind == HINT_WIN) printf("Play %d %d: five in %d moves, every one a four.\n", x, y, moves);
+                else if (kind == HINT_DEFEND) printf("Careful: your opponent wins by fours starting at %d %d.\n", x, y);
+                else printf("No forced win by fours for either side.\n");
+            } else if (type == MSG_SESSION) {
+                const uint8_t *bytes = payloadBytes(&payload, PROTO_TOKEN_BYTES);
+                graceSeconds = (int)payloadU16(&payload);
+                int resuming = (int)payloadU8(&payload);
+                if (bytes != NULL) memcpy(token, bytes, sizeof(token));
+                haveToken = bytes != NULL && !payload.error;
+                if (geo != NULL && !resuming) {
+                    printf("The game did not wait for you.\n");
+                    break;
+                }
+            } else if (type == MSG_OPPONENT_AWAY) {
+                printf("Opponent disconnected; waiting up to %u seconds for them to come back.\n", payloadU16(&payload));
+            } else if (type == MSG_OPPONENT_BACK) {
+                printf("Opponent is back.\n");
+            } else if (type == MSG_ERROR) {
+                int code = (int)payloadU8(&payload);
+                print_error(code, payloadU16(&payload));
+                if (code == ERR_TIMEOUT) {
+                    // Lost on time or dropped; either way nothing to resume
+                    wantMove = FALSE;
+                    haveToken = 0;
+                }
+                if (code == ERR_NO_GAME) break;
+            } else if (type == MSG_GAME_OVER) {
+                print_result(&payload, watch != NULL);
+                break;
+            }
         }
-        buffer[received] = '\0';
-        printf("%s", buffer);
+        if (type > 0 || !haveToken || geo == NULL || watch != NULL) break;
+        printf("Connection lost, reconnecting...\n");
+        if (resume_session(&link, argv[1], argv[2], token, graceSeconds) == -1) break;
+        resyncing = 0;
+        wantMove = FALSE;  // the turn is announced again
+    }
+    if (type <= 0) {
+        printf("Connection closed by server\n");
+    }
 
-        char password[51];
-        scanf("%50s", password);
-        sent = send(sockfd, password, strlen(password), 0);
-        if (sent == -1) {
-            perror("send failed");
-            close(sockfd);
-            return 1;
-        }
+    link_close(&link);
+    return 0;
+}
 
-        // First name
-        received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
-            perror("recv failed");
-            close(sockfd);
-            return 1;
-        }
-        buffer[received] = '\0';
-        printf("%s", buffer);
+// Logs in (registering first if asked) and picks the board size; -1 if
+// the server refused or hung up, or the input ran out
+int join_game(ServerLink *link, Input *input, int defaultSize, int opponent) {
+    char email[51], password[51], name[51], word[16];
+    Frame frame;
 
-        char name[51];
-        scanf("%50s", name);
-        sent = send(sockfd, name, strlen(name), 0);
-        if (sent == -1) {
-            perror("send failed");
-            close(sockfd);
-            return 1;
-        }
+    // Login or Register
+    if (prompt_word(input, "1. Login\n2. Register\nChoice: ", word, sizeof(word)) == -1) return -1;
+    int choice = atoi(word);
 
-        // Registration result
-        received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
-            perror("recv failed");
-            close(sockfd);
-            return 1;
+    if (choice == 2) {
+        // Registration flow
+        if (prompt_word(input, "Enter email: ", email, sizeof(email)) == -1 ||
+            prompt_word(input, "Enter password: ", password, sizeof(password)) == -1 ||
+            prompt_word(input, "Enter first name: ", name, sizeof(name)) == -1) {
+            return -1;
         }
-        buffer[received] = '\0';
-        printf("%s", buffer);
 
-        // Check if registration failed
-        if (strstr(buffer, "already registered") != NULL || 
-            strstr(buffer, "full") != NULL) {
-            close(sockfd);
-            return 1;
+        frameBegin(&frame, MSG_REGISTER);
+        framePutString(&frame, email);
+        framePutString(&frame, password);
+        framePutString(&frame, name);
+        if (send_frame(link, &frame) == -1 ||
+            expect_auth_result(link, "Registration successful!\n") == -1) {
+            return -1;
         }
 
-        // After successful registration, continue to login (no extra prompt)
+        // After successful registration, continue to login
     }
 
     // Login flow (for both new registrations and existing users)
-    // Email
-    received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
-        perror("recv failed");
-        close(sockfd);
-        return 1;
+    if (prompt_word(input, "Enter email: ", email, sizeof(email)) == -1 ||
+        prompt_word(input, "Enter password: ", password, sizeof(password)) == -1) {
+        return -1;
     }
-    buffer[received] = '\0';
-    printf("%s", buffer);
 
-    char email[51];
-    scanf("%50s", email);
-    sent = send(sockfd, email, strlen(email), 0);
-    if (sent == -1) {
-        perror("send failed");
-        close(sockfd);
-        return 1;
+    frameBegin(&frame, MSG_LOGIN);
+    framePutString(&frame, email);
+    framePutString(&frame, password);
+    if (send_frame(link, &frame) == -1 ||
+        expect_auth_result(link, "Login successful!\n") == -1) {
+        return -1;
     }
 
-    // Password
-    received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
-        perror("recv failed");
-        close(sockfd);
-        return 1;
+    // Board size
+    snprintf(name, sizeof(name), "Board size (8, 15, 19; default %d): ", defaultSize);
+    int size = prompt_word(input, name, word, sizeof(word)) == 0 ? atoi(word) : 0;
+    if (size < 0 || size > 255) {
+        size = 0;  // server default
     }
-    buffer[received] = '\0';
-    printf("%s", buffer);
+    frameBegin(&frame, MSG_BOARD_SIZE);
+    framePutU8(&frame, size);
+    framePutU8(&frame, opponent);
+    if (send_frame(link, &frame) == -1) {
+        return -1;
+    }
+    return 0;
+}
 
-    char password[51];
-    scanf("%50s", password);
-    sent = send(sockfd, password, strlen(password), 0);
-    if (sent == -1) {
-        perror("send failed");
-        close(sockfd);
-        return 1;
+// Reconnects and sends the token instead of a password, once a second for
+// as long as the server keeps the seat. The game follows the AUTH_RESULT on
+// the new connection. -1 if it cannot be resumed.
+int resume_session(ServerLink *link, char *hostname, char *port, const uint8_t *token, int graceSeconds) {
+    Payload payload;
+    Frame frame;
+
+    for (int attempt = 0; attempt <= graceSeconds; attempt++) {
+        if (attempt > 0) sleep(1);
+        if (get_server_connection(link, hostname, port) == -1) continue;
+
+        frameBegin(&frame, MSG_HELLO);
+        framePutU8(&frame, PROTO_VERSION);
+        if (send_frame(link, &frame) == -1 || read_frame(link, &payload) != MSG_WELCOME) {
+            link_close(link);
+            continue;
+        }
+        frameBegin(&frame, MSG_RESUME);
+        framePutBytes(&frame, token, PROTO_TOKEN_BYTES);
+        if (send_frame(link, &frame) == -1) {
+            link_close(link);
+            continue;
+        }
+        if (expect_auth_result(link, "Reconnected.\n") == -1) {
+            link_close(link);
+            return -1;  // the token was refused, retrying will not help
+        }
+        return 0;
     }
+    return -1;
+}
 
-    // Login result
-    received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
-        perror("recv failed");
-        close(sockfd);
-        return 1;
+// Waits for whatever comes first: a frame from the server, or a line of
+// input while one is wanted. Returns the frame's type with payload
+// pointing at its body, INPUT_READY, or 0 when the server hangs up and -1
+// on errors.
+int next_event(ServerLink *link, Input *input, int wantInput, Payload *payload) {
+    struct pollfd fds[2];
+
+    while (1) {
+        int type = link_next(link, payload);
+        if (type < 0) {
+            fprintf(stderr, "Oversized message from server\n");
+            return -1;
+        }
+        if (type > 0) return type;
+        if (wantInput && (input->eof || memchr(input->buf, '\n', input->len) != NULL ||
+                          input->len == sizeof(input->buf))) {
+            return INPUT_READY;
+        }
+
+        fds[0].fd = link->fd;
+        fds[0].events = link_events(link);
+        fds[1].fd = STDIN_FILENO;
+        fds[1].events = POLLIN;
+        if (poll(fds, wantInput ? 2 : 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll failed");
+            return -1;
+        }
+        if ((fds[0].revents & POLLOUT) && link_flush(link) == -1) {
+            perror("send failed");
+            return -1;
+        }
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && link_receive(link) == -1) return 0;
+        if (wantInput && fds[1].revents) {
+            ssize_t n = read(STDIN_FILENO, input->buf + input->len, sizeof(input->buf) - input->len);
+            if (n <= 0) input->eof = TRUE;
+            else input->len += n;
+        }
     }
-    buffer[received] = '\0';
-    printf("%s", buffer);
+}
 
-    // Check if login failed
-    if (strstr(buffer, "Invalid") != NULL) {
-        close(sockfd);
-        return 1;
+int read_frame(ServerLink *link, Payload *payload) {
+    return next_event(link, NULL, FALSE, payload);
+}
+
+// Queues the frame and waits until all of it is written
+int send_frame(ServerLink *link, Frame *frame) {
+    int status = link_send(link, frame);
+
+    while (status == 0 && (status = link_flush(link)) == 1) {
+        if (link_wait(link, -1) == -1) status = -1;
+        else status = 0;
+    }
+    if (status == -1) {
+        perror("send failed");
+        return -1;
     }
+    return 0;
+}
 
-    // Receive player name and opponent info
-    received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
-        perror("recv failed");
-        close(sockfd);
-        return 1;
+// Moves the next buffered line, without its newline, into line; 1 if there
+// was one, 0 if not yet, -1 at the end of input. A line longer than the
+// buffer is handed out in pieces.
+int read_line(Input *input, char *line, size_t size) {
+    char *newline = memchr(input->buf, '\n', input->len);
+    size_t len = newline != NULL ? (size_t)(newline - input->buf) : input->len;
+
+    if (newline == NULL && !input->eof && input->len < sizeof(input->buf)) return 0;
+    if (newline == NULL && input->len == 0) return -1;
+    size_t copy = len < size - 1 ? len : size - 1;
+    memcpy(line, input->buf, copy);
+    line[copy] = '\0';
+    if (newline != NULL) len++;
+    memmove(input->buf, input->buf + len, input->len - len);
+    input->len -= len;
+    return 1;
+}
+
+// Prompts and reads the first word of the next line; -1 at the end of input
+int prompt_word(Input *input, const char *prompt, char *word, size_t size) {
+    char line[sizeof(input->buf) + 1];
+    int status;
+
+    printf("%s", prompt);
+    fflush(stdout);
+    while ((status = read_line(input, line, sizeof(line))) == 0) {
+        ssize_t n = read(STDIN_FILENO, input->buf + input->len, sizeof(input->buf) - input->len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) input->eof = TRUE;
+        else input->len += n;
     }
-    buffer[received] = '\0';
-    printf("%s", buffer);
+    if (status == -1) return -1;
 
-    // Game loop
-    while (1) {
-        // Receive board or prompt
-        received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
-            printf("Connection closed by server\n");
+    char *start = line + strspn(line, " \t\r");
+    size_t len = strcspn(start, " \t\r");
+    if (len > size - 1) len = size - 1;
+    memcpy(word, start, len);
+    word[len] = '\0';
+    return 0;
+}
+
+// Prints the outcome of a login or registration; -1 if it failed
+int expect_auth_result(ServerLink *link, const char *success) {
+    Payload payload;
+    int type = read_frame(link, &payload);
+
+    if (type == MSG_ERROR) {
+        int code = (int)payloadU8(&payload);
+        print_error(code, payloadU16(&payload));
+        return -1;
+    }
+    if (type != MSG_AUTH_RESULT) {
+        fprintf(stderr, "Unexpected reply from server\n");
+        return -1;
+    }
+    int status = (int)payloadU8(&payload);
+    switch (status) {
+        case AUTH_OK:
+            printf("%s", success);
+            return 0;
+        case AUTH_INVALID:
+            printf("Invalid credentials!\n");
             break;
-        }
-        buffer[received] = '\0';
-        printf("%s", buffer);
-        
-        // Check if game is over (look for final scores in format "XW/YL/ZT")
-        if (strstr(buffer, "W/") != NULL && strstr(buffer, "L/") != NULL && 
-            strstr(buffer, "T") != NULL) {
+        case AUTH_TAKEN:
+            printf("Email already registered!\n");
             break;
-        }
-        
-        // If it's a turn prompt, send move
-        if (strstr(buffer, "turn") != NULL) {
-            int x, y;
-            if (scanf("%d", &x) != 1) {
-                fprintf(stderr, "Invalid input\n");
-                continue;
-            }
-            if (scanf("%d", &y) != 1) {
-                fprintf(stderr, "Invalid input\n");
-                continue;
-            }
-            
-            snprintf(buffer, sizeof(buffer), "%d %d", x, y);
-            sent = send(sockfd, buffer, strlen(buffer), 0);
-            if (sent == -1) {
-                perror("send failed");
-                break;
-            }
+        case AUTH_FULL:
+            printf("Scoreboard full!\n");
+            break;
+        case AUTH_BUSY:
+            print_error(ERR_BUSY, payloadU16(&payload));
+            break;
+        case AUTH_EXPIRED:
+            printf("Session expired, log in again.\n");
+            break;
+        default:
+            printf("Registration failed!\n");
+            break;
+    }
+    return -1;
+}
+
+void print_result(Payload *payload, int spectating) {
+    char names[2][51];
+    uint32_t scores[2][3];
+    int outcome = (int)payloadU8(payload);
+
+    for (int i = 0; i < 2; i++) {
+        payloadString(payload, names[i], sizeof(names[i]));
+        for (int j = 0; j < 3; j++) {
+            scores[i][j] = payloadU32(payload);
         }
     }
+    if (payload->error) {
+        printf("Game over\n");
+        return;
+    }
 
-    close(sockfd);
-    return 0;
+    // The winner is listed first
+    if (spectating && outcome != OUTCOME_DRAW) printf("%s won against %s\n", names[0], names[1]);
+    else if (outcome == OUTCOME_WIN) printf("You won and %s lost\n", names[1]);
+    else if (outcome == OUTCOME_LOSS) printf("You lost and %s won\n", names[0]);
+    else printf("It was a draw\n");
+    printf("%s: %uW/%uL/%uT - %s: %uW/%uL/%uT\n",
+           names[0], scores[0][0], scores[0][1], scores[0][2],
+           names[1], scores[1][0], scores[1][1], scores[1][2]);
 }
 
-int get_server_connection(char *hostname, char *port) {
-    int serverfd;
+// retryMs is how long a busy server asked us to wait, 0 if it did not say
+void print_error(int code, unsigned int retryMs) {
+    switch (code) {
+        case ERR_NOT_YOUR_TURN:
+            printf("Wait for your turn.\n");
+            break;
+        case ERR_INVALID_MOVE:
+            printf("Invalid move. Try again.\n");
+            break;
+        case ERR_VERSION:
+            printf("Server does not speak protocol version %d\n", PROTO_VERSION);
+            break;
+        case ERR_BUSY:
+            if (retryMs > 0) printf("Server busy, try again in %.1f s.\n", retryMs / 1000.0);
+            else printf("Server busy, try again later.\n");
+            break;
+        case ERR_NOT_PROVEN:
+            printf("No forced win found; play on.\n");
+            break;
+        case ERR_NO_GAME:
+            printf("No such game in play.\n");
+            break;
+        case ERR_TIMEOUT:
+            printf("Out of time.\n");
+            break;
+        default:
+            printf("Server rejected a message\n");
+            break;
+    }
+}
+
+int get_server_connection(ServerLink *link, char *hostname, char *port) {
     struct addrinfo hints, *servinfo, *p;
     int status;
 
@@ -252,27 +644,20 @@ int get_server_connection(char *hostname, char *port) {
     }
 
     print_ip(servinfo);
+    status = -1;
     for (p = servinfo; p != NULL; p = p->ai_next) {
-        // create a socket
-        if ((serverfd = socket(p->ai_family, p->ai_socktype,
-                            p->ai_protocol)) == -1) {
-            printf("socket socket \n");
-            continue;
-        }
-
-        // connect to the server
-        if ((status = connect(serverfd, p->ai_addr, p->ai_addrlen)) == -1) {
-            close(serverfd);
+        // start the connect and wait for it to go through
+        if (link_connect(link, p) == -1 || link_wait(link, -1) != 1 || link_connected(link) == -1) {
+            link_close(link);
             printf("socket connect \n");
             continue;
         }
+        status = 0;
         break;
     }
 
     freeaddrinfo(servinfo);
-   
-    if (status != -1) return serverfd;
-    else return -1;
+    return status;
 }
 
 void print_ip(struct addrinfo *ai) {
@@ -301,3 +686,363 @@ void print_ip(struct addrinfo *ai) {
         printf("serv ip info: %s - %s @%d\n", ipstr, ipver, ntohs(port));
     }
 }
+
+// Runs every session on one epoll loop until each has played its games;
+// 0 if none of them ran into an error
+int run_batch(const char *path, int nSessions, int games, char *hostname, char *port) {
+    struct epoll_event events[BATCH_EVENTS];
+    struct addrinfo hints;
+
+    if (load_script(path, &script) == -1) return 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(hostname, port, &hints, &batch_addr);
+    if (status != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+        return 1;
+    }
+
+    // A session per descriptor, and then some
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    BatchSession *sessions = (BatchSession *)calloc(nSessions, sizeof(BatchSession));
+    batch_epoll = epoll_create1(0);
+    if (sessions == NULL || batch_epoll == -1) {
+        fprintf(stderr, "Cannot set up %d sessions\n", nSessions);
+        return 1;
+    }
+
+    // Every session starts idle and is dialled on the first pass
+    for (int i = 0; i < nSessions; i++) {
+        link_init(&sessions[i].link);
+        sessions[i].id = i;
+        sessions[i].state = SESSION_IDLE;
+        sessions[i].gamesLeft = games;
+    }
+    batch_idle = batch_active = nSessions;
+
+    uint64_t start = now_ms();
+    while (batch_active > 0) {
+        // Sessions that hung up dial again only here, as the last batch of
+        // events may have held more for their old connections
+        if (batch_idle > 0) {
+            uint64_t now = now_ms();
+            for (int i = 0; i < nSessions; i++) {
+                if (sessions[i].state == SESSION_IDLE && sessions[i].retryAt <= now) session_dial(&sessions[i]);
+            }
+        }
+        if (batch_active == 0) break;
+
+        int n = epoll_wait(batch_epoll, events, BATCH_EVENTS, batch_idle > 0 ? 10 : 1000);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            BatchSession *session = (BatchSession *)events[i].data.ptr;
+            if (session->link.state == LINK_CONNECTING) {
+                session_connected(session);
+            } else if (session->link.state == LINK_OPEN) {
+                if ((events[i].events & EPOLLOUT) && link_flush(&session->link) == -1) {
+                    session_fail(session, "send failed");
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) session_input(session);
+            }
+            if (session->link.state != LINK_CLOSED) session_watch(session);
+        }
+    }
+    double elapsed = (now_ms() - start) / 1000.0;
+
+    printf("%d sessions, %ld games in %.1f s: %ld won, %ld lost, %ld drawn\n",
+           nSessions, totals.games, elapsed, totals.won, totals.lost, totals.drawn);
+    printf("%ld moves off script, %ld busy retries, %ld errors\n", totals.offScript, totals.busy, totals.errors);
+
+    freeaddrinfo(batch_addr);
+    close(batch_epoll);
+    free(sessions);
+    return totals.errors > 0 ? 2 : 0;
+}
+
+// Reads "x y" pairs, one move after another, and an optional "size n";
+// # starts a comment. "-" reads standard input.
+int load_script(const char *path, Script *script) {
+    char line[256];
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    int lineNo = 0, status = 0;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    memset(script, 0, sizeof(*script));
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        int x, y;
+        lineNo++;
+        if (comment != NULL) *comment = '\0';
+        if (line[strspn(line, " \t\r\n")] == '\0') continue;
+
+        if (sscanf(line, " size %d", &script->size) == 1) {
+            if (findBoardGeometry(script->size) == NULL) {
+                fprintf(stderr, "%s:%d: unsupported board size\n", path, lineNo);
+                status = -1;
+            }
+        } else if (sscanf(line, "%d %d", &x, &y) == 2 && x >= 0 && x < 255 && y >= 0 && y < 255) {
+            if (script->nMoves == SCRIPT_MAX_MOVES) {
+                fprintf(stderr, "%s:%d: more moves than a board holds\n", path, lineNo);
+                status = -1;
+            } else {
+                script->moves[script->nMoves][0] = (uint8_t)x;
+                script->moves[script->nMoves][1] = (uint8_t)y;
+                script->nMoves++;
+            }
+        } else {
+            fprintf(stderr, "%s:%d: expected x y or size n\n", path, lineNo);
+            status = -1;
+        }
+    }
+    if (file != stdin) fclose(file);
+    return status;
+}
+
+// Starts a connect; completion shows up as writability
+void session_dial(BatchSession *session) {
+    struct epoll_event ev;
+
+    batch_idle--;
+    if (link_connect(&session->link, batch_addr) == -1) {
+        session->state = SESSION_CONNECTING;
+        session_fail(session, "cannot connect");
+        return;
+    }
+    session->state = SESSION_CONNECTING;
+    session->geo = NULL;
+    session->resyncing = FALSE;
+    session->events = EPOLLOUT;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = session;
+    epoll_ctl(batch_epoll, EPOLL_CTL_ADD, session->link.fd, &ev);
+}
+
+// Sends the whole opening in one go; the server holds back what follows
+// the registration or login until the password has been checked
+void session_connected(BatchSession *session) {
+    char email[96];
+    Frame frame;
+
+    if (link_connected(&session->link) == -1) {
+        session_fail(session, "cannot connect");
+        return;
+    }
+    snprintf(email, sizeof(email), "%s-%d@batch", batch_prefix, session->id);
+
+    frameBegin(&frame, MSG_HELLO);
+    framePutU8(&frame, PROTO_VERSION);
+    session_send(session, &frame);
+    if (!session->registered) {
+        frameBegin(&frame, MSG_REGISTER);
+        framePutString(&frame, email);
+        framePutString(&frame, "batch");
+        framePutString(&frame, "Batch");
+        session_send(session, &frame);
+    }
+    frameBegin(&frame, MSG_LOGIN);
+    framePutString(&frame, email);
+    framePutString(&frame, "batch");
+    session_send(session, &frame);
+    frameBegin(&frame, MSG_BOARD_SIZE);
+    framePutU8(&frame, script.size);
+    framePutU8(&frame, batch_opponent);
+    session_send(session, &frame);
+
+    if (session->link.state == LINK_OPEN) {
+        session->state = session->registered ? SESSION_LOGGING_IN : SESSION_REGISTERING;
+    }
+}
+
+void session_input(BatchSession *session) {
+    Payload payload;
+    int type;
+
+    if (link_receive(&session->link) == -1) {
+        session_fail(session, "connection lost");
+        return;
+    }
+    // Hanging up empties the link's buffer, which ends the loop
+    while ((type = link_next(&session->link, &payload)) != 0) {
+        if (type == -1) {
+            session_fail(session, "garbled message");
+            return;
+        }
+        session_message(session, type, &payload);
+    }
+}
+
+void session_message(BatchSession *session, int type, Payload *payload) {
+    char problem[64];
+
+    switch (type) {
+        case MSG_AUTH_RESULT: {
+            int status = (int)payloadU8(payload);
+            if (session->state == SESSION_REGISTERING && (status == AUTH_OK || status == AUTH_TAKEN)) {
+                // The login result follows, unless the account was there
+                // already: then the server hangs up and we log in next time
+                session->registered = TRUE;
+                session->state = SESSION_LOGGING_IN;
+                if (status == AUTH_TAKEN) session_next(session, 0);
+            } else if (status == AUTH_OK) {
+                session->state = SESSION_PLAYING;
+                session->busyStreak = 0;
+            } else if (status == AUTH_BUSY) {
+                session_busy(session, payloadU16(payload));
+            } else {
+                snprintf(problem, sizeof(problem), "login refused (%d)", status);
+                session_fail(session, problem);
+            }
+            break;
+        }
+        case MSG_GAME_START:
+            session->geo = findBoardGeometry((int)payloadU8(payload));
+            session->color = (int)payloadU8(payload);
+            break;
+        case MSG_BOARD:
+            session->moves = payloadU16(payload);
+            session->geo = payloadBoard(payload, session->board);
+            session->resyncing = FALSE;
+            if (session->geo == NULL) session_fail(session, "garbled board");
+            break;
+        case MSG_MOVE_PLAYED: {
+            unsigned int number = payloadU16(payload);
+            int color = (int)payloadU8(payload);
+            int x = (int)payloadU8(payload);
+            int y = (int)payloadU8(payload);
+            const BoardGeometry *geo = session->geo;
+            if (session->resyncing || geo == NULL) break;
+            if (payload->error || number != session->moves + 1 || color > 1 || geo->checkMove(session->board, x, y)) {
+                Frame frame;
+                frameBegin(&frame, MSG_RESYNC);
+                session_send(session, &frame);
+                session->resyncing = TRUE;
+                break;
+            }
+            geo->place(session->board, color, x, y);
+            session->moves = number;
+            break;
+        }
+        case MSG_YOUR_TURN:
+            session_move(session);
+            break;
+        case MSG_ERROR: {
+            int code = (int)payloadU8(payload);
+            if (code == ERR_BUSY) {
+                session_busy(session, payloadU16(payload));
+                break;
+            }
+            snprintf(problem, sizeof(problem), "server error %d after move %u", code, session->moves);
+            session_fail(session, problem);
+            break;
+        }
+        case MSG_GAME_OVER: {
+            int outcome = (int)payloadU8(payload);
+            if (outcome == OUTCOME_WIN) totals.won++;
+            else if (outcome == OUTCOME_LOSS) totals.lost++;
+            else totals.drawn++;
+            totals.games++;
+            session->gamesLeft--;
+            session_next(session, 0);
+            break;
+        }
+        default:
+            break;  // WELCOME, WAITING, SESSION, OPPONENT_AWAY, OPPONENT_BACK
+    }
+}
+
+// Plays the script's move for this move number, or the first empty cell
+// when the script has run out or the cell is taken
+void session_move(BatchSession *session) {
+    const BoardGeometry *geo = session->geo;
+    int next = (int)session->moves;
+    Frame frame;
+
+    if (geo == NULL || session->resyncing) return;  // the turn comes again with the board
+    frameBegin(&frame, MSG_MOVE);
+    if (next < script.nMoves && !geo->checkMove(session->board, script.moves[next][0], script.moves[next][1])) {
+        framePutU8(&frame, script.moves[next][0]);
+        framePutU8(&frame, script.moves[next][1]);
+    } else {
+        int cell = 0;
+        while (cell < geo->cells && geo->checkMove(session->board, cell / geo->size, cell % geo->size)) cell++;
+        framePutU8(&frame, cell / geo->size);
+        framePutU8(&frame, cell % geo->size);
+        totals.offScript++;
+    }
+    session_send(session, &frame);
+}
+
+// A server that hangs up straight away may have said why, busy most
+// likely; that is read before the failure counts
+void session_send(BatchSession *session, Frame *frame) {
+    if (link_send(&session->link, frame) == 0) return;
+    if (session->link.state == LINK_OPEN) session_input(session);
+    session_fail(session, "send failed");
+}
+
+// Asks epoll for writability only while output is queued
+void session_watch(BatchSession *session) {
+    struct epoll_event ev;
+    short wanted = link_events(&session->link);
+    int events = ((wanted & POLLIN) ? EPOLLIN : 0) | ((wanted & POLLOUT) ? EPOLLOUT : 0);
+
+    if (events == session->events) return;
+    ev.events = events;
+    ev.data.ptr = session;
+    epoll_ctl(batch_epoll, EPOLL_CTL_MOD, session->link.fd, &ev);
+    session->events = events;
+}
+
+// Hangs up; the next game, if one is left, is dialled after delayMs
+void session_next(BatchSession *session, uint64_t delayMs) {
+    if (session->link.fd >= 0) epoll_ctl(batch_epoll, EPOLL_CTL_DEL, session->link.fd, NULL);
+    link_close(&session->link);
+    if (session->gamesLeft > 0) {
+        session->state = SESSION_IDLE;
+        session->retryAt = now_ms() + delayMs;
+        batch_idle++;
+    } else {
+        session->state = SESSION_DONE;
+        batch_active--;
+    }
+}
+
+// The game in hand is given up as failed
+void session_fail(BatchSession *session, const char *problem) {
+    if (session->state == SESSION_IDLE || session->state == SESSION_DONE) return;  // already hung up
+    fprintf(stderr, "session %d: %s\n", session->id, problem);
+    totals.errors++;
+    session->gamesLeft--;
+    session_next(session, 0);
+}
+
+// Waits what the server asked, doubled for every busy answer before it
+// in a row, so a crowd that keeps coming back too soon thins out
+void session_busy(BatchSession *session, unsigned int retryMs) {
+    int shift = session->busyStreak < BATCH_BACKOFF_MAX ? session->busyStreak : BATCH_BACKOFF_MAX;
+
+    totals.busy++;
+    session->busyStreak++;
+    session_next(session, (uint64_t)(retryMs > 0 ? retryMs : BATCH_RETRY_MS) << shift);
+}
+
+uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
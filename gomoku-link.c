@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "gomoku-link.h"
+
+void link_init(ServerLink *link) {
+    memset(link, 0, sizeof(*link));
+    link->fd = -1;
+}
+
+int link_connect(ServerLink *link, const struct addrinfo *addr) {
+    int one = 1;
+
+    link_close(link);
+    link->fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+    if (link->fd == -1) return -1;
+    // Moves are a few bytes each and the next one waits for the reply
+    setsockopt(link->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(link->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        link_close(link);
+        return -1;
+    }
+    link->state = LINK_CONNECTING;
+    return 0;
+}
+
+int link_connected(ServerLink *link) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (getsockopt(link->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+        if (error != 0) errno = error;
+        return -1;
+    }
+    link->state = LINK_OPEN;
+    // Anything queued while connecting goes out now
+    return link_flush(link) == -1 ? -1 : 0;
+}
+
+int link_send(ServerLink *link, Frame *frame) {
+    size_t len = frameEnd(frame);
+
+    if (link->state == LINK_CLOSED || frame->overflow) return -1;
+    if (link->outLen + len > sizeof(link->out)) {
+        memmove(link->out, link->out + link->outOff, link->outLen - link->outOff);
+        link->outLen -= link->outOff;
+        link->outOff = 0;
+        if (link->outLen + len > sizeof(link->out)) return -1;
+    }
+    memcpy(link->out + link->outLen, frame->data, len);
+    link->outLen += len;
+    if (link->state == LINK_CONNECTING) return 0;
+    return link_flush(link) == -1 ? -1 : 0;
+}
+
+int link_flush(ServerLink *link) {
+    while (link->outOff < link->outLen) {
+        if (link->state != LINK_OPEN) return link->state == LINK_CONNECTING ? 1 : -1;
+        ssize_t sent = send(link->fd, link->out + link->outOff, link->outLen - link->outOff, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+        }
+        link->outOff += sent;
+    }
+    link->outLen = link->outOff = 0;
+    return 0;
+}
+
+int link_receive(ServerLink *link) {
+    if (link->state != LINK_OPEN) return -1;
+
+    // Keep the partial frame and read more behind it
+    memmove(link->in, link->in + link->inOff, link->inLen - link->inOff);
+    link->inLen -= link->inOff;
+    link->inOff = 0;
+    if (link->inLen == sizeof(link->in)) return 0;  // hand out what is buffered first
+
+    while (1) {
+        ssize_t received = recv(link->fd, link->in + link->inLen, sizeof(link->in) - link->inLen, 0);
+        if (received > 0) {
+            link->inLen += received;
+            return (int)received;
+        }
+        if (received == -1 && errno == EINTR) continue;
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return -1;
+    }
+}
+
+int link_next(ServerLink *link, Payload *payload) {
+    long len = frameLength(link->in + link->inOff, link->inLen - link->inOff);
+
+    if (len <= 0) return (int)len;
+    const uint8_t *frame = link->in + link->inOff;
+    link->inOff += len;
+    *payload = framePayload(frame, len);
+    return frameType(frame);
+}
+
+short link_events(const ServerLink *link) {
+    if (link->state == LINK_CONNECTING) return POLLOUT;
+    return POLLIN | (link->outOff < link->outLen ? POLLOUT : 0);
+}
+
+int link_wait(ServerLink *link, int ms) {
+    struct pollfd pfd;
+
+    pfd.fd = link->fd;
+    pfd.events = link_events(link);
+    while (1) {
+        int n = poll(&pfd, 1, ms);
+        if (n == -1 && errno == EINTR) continue;
+        return n;
+    }
+}
+
+void link_close(ServerLink *link) {
+    if (link->fd >= 0) close(link->fd);
+    link->fd = -1;
+    link->state = LINK_CLOSED;
+    link->inLen = link->inOff = 0;
+    link->outLen = link->outOff = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef GOMOKU_LINK_H
+#define GOMOKU_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netdb.h>
+#include "gomoku-protocol.h"
+
+// Client end of a connection to the server, shared by the interactive
+// client and its batch mode. The socket is non-blocking from the connect
+// on, and the link never waits by itself: input is read into a buffer and
+// cut into frames however the server's writes were split or merged, and
+// output the socket does not take at once stays queued until it is
+// writable. link_events says what to wait for, so one thread can poll any
+// number of links; link_wait does that for a single one.
+
+#define LINK_INPUT 4096            // several PROTO_MAX_FRAMEs, so a frame always fits
+#define LINK_OUTPUT 2048
+
+typedef enum {
+    LINK_CLOSED,
+    LINK_CONNECTING,
+    LINK_OPEN
+} LinkState;
+
+typedef struct SERVERLINK {
+    int fd;
+    LinkState state;
+    uint8_t in[LINK_INPUT];
+    size_t inLen;
+    size_t inOff;              // first byte not yet handed out as a frame
+    uint8_t out[LINK_OUTPUT];
+    size_t outLen;
+    size_t outOff;             // first byte not yet written
+} ServerLink;
+
+void link_init(ServerLink *link);
+// Starts a connect to addr; 0 while it is under way, -1 if it failed at once
+int link_connect(ServerLink *link, const struct addrinfo *addr);
+// Once a connecting link is writable: 0 if the connect went through, -1 if not
+int link_connected(ServerLink *link);
+// Queues a frame and writes what the socket takes; -1 if the connection
+// failed or too much output is waiting
+int link_send(ServerLink *link, Frame *frame);
+// 1 while output is left for the next writability, 0 once all is written,
+// -1 on errors
+int link_flush(ServerLink *link);
+// Reads what has arrived; bytes read, 0 if nothing had, -1 once the server
+// hung up or the connection failed. Frames handed out before are no longer valid.
+int link_receive(ServerLink *link);
+// Type of the next buffered frame and its payload, 0 if no whole frame is
+// buffered, -1 if the server sent garbage
+int link_next(ServerLink *link, Payload *payload);
+// poll events the link is waiting for
+short link_events(const ServerLink *link);
+// Waits up to ms (-1 for ever) for what link_events asks; poll's result
+int link_wait(ServerLink *link, int ms);
+void link_close(ServerLink *link);
+
+#endif
@@ -0,0 +1,633 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "gomoku-protocol.h"
+
+// Headless load generator: many bot connections per thread, each driving
+// the real login and game dialogue over the wire protocol, game after game,
+// and a report of connection, login and move rates plus move round-trip
+// latency at the end.
+
+#define DEFAULT_BOTS 100
+#define DEFAULT_THREADS 1
+#define DEFAULT_SECONDS 10
+#define MAX_THREADS 64
+#define MAX_EVENTS 256
+#define BOT_INPUT 4096
+#define DEFAULT_RETRY_MS 1000      // when a busy server does not say how long to wait
+#define HIST_SUB 16            // buckets per power of two, about 6% wide
+#define HIST_GROUPS 40
+#define TRUE 1
+#define FALSE 0
+
+typedef enum {
+    MOVES_RANDOM,              // uniformly among the empty cells
+    MOVES_SCAN                 // first empty cell in row order
+} MovePolicy;
+
+typedef enum {
+    BOT_CONNECTING,
+    BOT_LOGGING_IN,            // opening messages sent, waiting for the login result
+    BOT_QUEUED,
+    BOT_PLAYING,
+    BOT_RETRYING               // turned away busy or could not connect, dials again at retryAt
+} BotState;
+
+// Log-linear latency histogram in microseconds
+typedef struct HISTOGRAM {
+    uint64_t counts[HIST_GROUPS][HIST_SUB];
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+typedef struct COUNTERS {
+    long connects;             // TCP connections established
+    long logins;               // successful logins
+    long registrations;
+    long moves;                // own moves confirmed by the server
+    long games;                // games finished
+    long errors;               // failed connects, refused logins, dropped connections
+    long busy;                 // turned away by a server at capacity, and dialled again
+} Counters;
+
+typedef struct WORKER {
+    pthread_t thread;
+    int epollFd;
+    struct BOT *bots;
+    int nBots;
+    uint64_t seed;
+    int nRetrying;             // bots in BOT_RETRYING
+    Counters counters;
+    Histogram rtt;
+} Worker;
+
+typedef struct BOT {
+    int fd;
+    int id;
+    unsigned int connection;   // bumped on every connect; fd numbers get reused
+    BotState state;
+    int registered;            // account exists, log in from now on
+    int color;
+    const BoardGeometry *geo;
+    uint64_t board[BOARD_BYTES_MAX / sizeof(uint64_t) + 1];
+    uint64_t moveSentAt;       // 0 when no move is outstanding
+    uint64_t retryAt;
+    uint8_t in[BOT_INPUT];
+    size_t inLen;
+    Worker *worker;
+} Bot;
+
+// Settings shared by every worker
+struct addrinfo *server_addr;
+const char *email_prefix;
+int board_size;
+MovePolicy move_policy = MOVES_RANDOM;
+volatile int stop;
+
+// Bot functions
+void bot_connect(Bot *bot);
+void bot_connected(Bot *bot);
+void bot_read(Bot *bot);
+void bot_message(Bot *bot, int type, Payload *payload);
+void bot_move(Bot *bot);
+void bot_restart(Bot *bot, int failed);
+void bot_busy(Bot *bot, unsigned int retryMs);
+void bot_retry(Bot *bot, unsigned int retryMs);
+int bot_send(Bot *bot, Frame *frame);
+void *run_worker(void *ptr);
+
+// Helpers
+uint64_t now_us();
+uint64_t next_random(uint64_t *state);
+void raise_fd_limit();
+void histogram_add(Histogram *hist, uint64_t value);
+void histogram_merge(Histogram *into, const Histogram *from);
+uint64_t histogram_percentile(const Histogram *hist, double percentile);
+void histogram_print(const Histogram *hist);
+
+int main(int argc, char *argv[]) {
+    int nBots = DEFAULT_BOTS, nThreads = DEFAULT_THREADS;
+    double seconds = DEFAULT_SECONDS;
+    char prefix[64];
+    int loginOnly = FALSE;
+    int opt;
+
+    snprintf(prefix, sizeof(prefix), "bot%ld", (long)time(NULL));
+    email_prefix = prefix;
+
+    while ((opt = getopt(argc, argv, "c:t:d:s:p:lm:")) != -1) {
+        switch (opt) {
+            case 'c': nBots = atoi(optarg); break;
+            case 't': nThreads = atoi(optarg); break;
+            case 'd': seconds = atof(optarg); break;
+            case 's': board_size = atoi(optarg); break;
+            case 'p': email_prefix = optarg; break;
+            case 'l': loginOnly = TRUE; break;
+            case 'm':
+                move_policy = (strcmp(optarg, "scan") == 0) ? MOVES_SCAN : MOVES_RANDOM;
+                break;
+            default:
+                argc = 0;  // print usage
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 2 || nBots < 2 || nThreads < 1 || nThreads > MAX_THREADS || seconds <= 0) {
+        fprintf(stderr, "Usage: gomoku-loadgen [-c bots] [-t threads] [-d seconds] [-s board size]\n"
+                        "                      [-p email prefix] [-l] [-m random|scan] host port\n"
+                        "  -l logs in accounts a previous run with the same -p registered\n");
+        return 1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(argv[0], argv[1], &hints, &server_addr);
+    if (status != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+        return 1;
+    }
+    raise_fd_limit();
+
+    Worker *workers = (Worker *)calloc(nThreads, sizeof(Worker));
+    Bot *bots = (Bot *)calloc(nBots, sizeof(Bot));
+    if (workers == NULL || bots == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    // Bots are dealt out to the workers in contiguous runs
+    for (int i = 0; i < nBots; i++) {
+        bots[i].id = i;
+        bots[i].fd = -1;
+        bots[i].registered = loginOnly;
+    }
+    for (int t = 0; t < nThreads; t++) {
+        Worker *worker = &workers[t];
+        int first = (int)((long)nBots * t / nThreads);
+        int last = (int)((long)nBots * (t + 1) / nThreads);
+        worker->bots = bots + first;
+        worker->nBots = last - first;
+        worker->seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+        worker->epollFd = epoll_create1(0);
+        if (worker->epollFd == -1) {
+            perror("epoll_create1");
+            return 1;
+        }
+        for (int i = 0; i < worker->nBots; i++) {
+            worker->bots[i].worker = worker;
+        }
+    }
+
+    printf("%d bots on %d threads for %.1f s against %s:%s (%s)\n", nBots, nThreads, seconds,
+           argv[0], argv[1], loginOnly ? "logging in" : "registering");
+
+    uint64_t start = now_us();
+    for (int t = 0; t < nThreads; t++) {
+        if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Failed to create worker\n");
+            return 1;
+        }
+    }
+    usleep((useconds_t)(seconds * 1e6));
+    stop = TRUE;
+    for (int t = 0; t < nThreads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    Counters total;
+    Histogram *rtt = (Histogram *)calloc(1, sizeof(Histogram));
+    memset(&total, 0, sizeof(total));
+    for (int t = 0; t < nThreads; t++) {
+        Counters *c = &workers[t].counters;
+        total.connects += c->connects;
+        total.logins += c->logins;
+        total.registrations += c->registrations;
+        total.moves += c->moves;
+        total.games += c->games;
+        total.errors += c->errors;
+        total.busy += c->busy;
+        histogram_merge(rtt, &workers[t].rtt);
+    }
+
+    printf("%14s %10s %10s\n", "", "total", "per sec");
+    printf("%14s %10ld %10.1f\n", "connects", total.connects, total.connects / elapsed);
+    printf("%14s %10ld %10.1f\n", "registrations", total.registrations, total.registrations / elapsed);
+    printf("%14s %10ld %10.1f\n", "logins", total.logins, total.logins / elapsed);
+    printf("%14s %10ld %10.1f\n", "moves", total.moves, total.moves / elapsed);
+    printf("%14s %10ld %10.1f\n", "games", total.games, total.games / elapsed);
+    printf("%14s %10ld %10.1f\n", "errors", total.errors, total.errors / elapsed);
+    printf("%14s %10ld %10.1f\n", "busy", total.busy, total.busy / elapsed);
+    printf("\nmove round trip (us): p50 %llu  p99 %llu  p999 %llu  max %llu\n",
+           (unsigned long long)histogram_percentile(rtt, 50),
+           (unsigned long long)histogram_percentile(rtt, 99),
+           (unsigned long long)histogram_percentile(rtt, 99.9),
+           (unsigned long long)rtt->max);
+    histogram_print(rtt);
+
+    freeaddrinfo(server_addr);
+    return 0;
+}
+
+void *run_worker(void *ptr) {
+    Worker *worker = (Worker *)ptr;
+    struct epoll_event events[MAX_EVENTS];
+
+    for (int i = 0; i < worker->nBots; i++) {
+        bot_connect(&worker->bots[i]);
+    }
+
+    while (!stop) {
+        int n = epoll_wait(worker->epollFd, events, MAX_EVENTS, worker->nRetrying > 0 ? 10 : 100);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n && !stop; i++) {
+            Bot *bot = (Bot *)events[i].data.ptr;
+            if (bot->state == BOT_CONNECTING) {
+                bot_connected(bot);
+            } else if (bot->state != BOT_RETRYING) {
+                bot_read(bot);
+            }
+        }
+        if (worker->nRetrying > 0 && !stop) {
+            uint64_t now = now_us();
+            for (int i = 0; i < worker->nBots; i++) {
+                Bot *bot = &worker->bots[i];
+                if (bot->state == BOT_RETRYING && bot->retryAt <= now) {
+                    bot_connect(bot);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < worker->nBots; i++) {
+        if (worker->bots[i].fd >= 0) close(worker->bots[i].fd);
+    }
+    close(worker->epollFd);
+    return NULL;
+}
+
+// Starts a non-blocking connect; completion shows up as writability
+void bot_connect(Bot *bot) {
+    struct epoll_event ev;
+
+    bot->fd = socket(server_addr->ai_family, server_addr->ai_socktype | SOCK_NONBLOCK, server_addr->ai_protocol);
+    if (bot->fd == -1) {
+        bot->worker->counters.errors++;
+        bot_retry(bot, DEFAULT_RETRY_MS);
+        return;
+    }
+    if (connect(bot->fd, server_addr->ai_addr, server_addr->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        bot->worker->counters.errors++;
+        close(bot->fd);
+        bot->fd = -1;
+        bot_retry(bot, DEFAULT_RETRY_MS);
+        return;
+    }
+    if (bot->state == BOT_RETRYING) bot->worker->nRetrying--;
+    bot->connection++;
+    bot->state = BOT_CONNECTING;
+    bot->inLen = 0;
+    bot->geo = NULL;
+    bot->moveSentAt = 0;
+
+    ev.events = EPOLLOUT;
+    ev.data.ptr = bot;
+    epoll_ctl(bot->worker->epollFd, EPOLL_CTL_ADD, bot->fd, &ev);
+}
+
+// Sends the whole opening in one go; the server holds back what follows
+// the login or registration until the password has been checked
+void bot_connected(Bot *bot) {
+    struct epoll_event ev;
+    char email[64];
+    int error = 0;
+    socklen_t len = sizeof(error);
+    int one = 1;
+
+    if (getsockopt(bot->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+        bot_restart(bot, TRUE);
+        return;
+    }
+    bot->worker->counters.connects++;
+    setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = bot;
+    epoll_ctl(bot->worker->epollFd, EPOLL_CTL_MOD, bot->fd, &ev);
+
+    snprintf(email, sizeof(email), "%s-%d@load", email_prefix, bot->id);
+    Frame frame;
+    frameBegin(&frame, MSG_HELLO);
+    framePutU8(&frame, PROTO_VERSION);
+    size_t offset = frameEnd(&frame);
+
+    // Later frames are built behind the first in the same buffer
+    Frame next;
+    if (!bot->registered) {
+        frameBegin(&next, MSG_REGISTER);
+        framePutString(&next, email);
+        framePutString(&next, "loadgen");
+        framePutString(&next, "Bot");
+        size_t n = frameEnd(&next);
+        memcpy(frame.data + offset, next.data, n);
+        offset += n;
+    }
+    frameBegin(&next, MSG_LOGIN);
+    framePutString(&next, email);
+    framePutString(&next, "loadgen");
+    size_t n = frameEnd(&next);
+    memcpy(frame.data + offset, next.data, n);
+    offset += n;
+
+    frameBegin(&next, MSG_BOARD_SIZE);
+    framePutU8(&next, board_size);
+    n = frameEnd(&next);
+    memcpy(frame.data + offset, next.data, n);
+    offset += n;
+
+    bot->state = BOT_LOGGING_IN;
+    if (send(bot->fd, frame.data, offset, MSG_NOSIGNAL) != (ssize_t)offset) {
+        bot_restart(bot, TRUE);
+    }
+}
+
+void bot_read(Bot *bot) {
+    ssize_t received = recv(bot->fd, bot->in + bot->inLen, sizeof(bot->in) - bot->inLen, 0);
+
+    if (received < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (received <= 0) {
+        bot_restart(bot, TRUE);
+        return;
+    }
+    bot->inLen += received;
+
+    size_t offset = 0;
+    unsigned int connection = bot->connection;
+    while (bot->connection == connection) {
+        long len = frameLength(bot->in + offset, bot->inLen - offset);
+        if (len < 0) {
+            bot_restart(bot, TRUE);
+            return;
+        }
+        if (len == 0) break;
+        Payload payload = framePayload(bot->in + offset, len);
+        int type = frameType(bot->in + offset);
+        offset += len;
+        bot_message(bot, type, &payload);
+    }
+    if (bot->connection != connection) return;  // restarted; the buffer was reset
+    memmove(bot->in, bot->in + offset, bot->inLen - offset);
+    bot->inLen -= offset;
+}
+
+void bot_message(Bot *bot, int type, Payload *payload) {
+    Worker *worker = bot->worker;
+
+    switch (type) {
+        case MSG_AUTH_RESULT: {
+            int status = (int)payloadU8(payload);
+            if (status == AUTH_TAKEN) {
+                // Registered by an earlier run; log in next time
+                bot->registered = TRUE;
+                bot_restart(bot, FALSE);
+            } else if (status == AUTH_BUSY) {
+                bot_busy(bot, payloadU16(payload));
+            } else if (status != AUTH_OK) {
+                bot_restart(bot, TRUE);
+            } else if (!bot->registered) {
+                bot->registered = TRUE;
+                worker->counters.registrations++;
+            } else {
+                worker->counters.logins++;
+                bot->state = BOT_QUEUED;
+            }
+            break;
+        }
+        case MSG_GAME_START:
+            bot->geo = findBoardGeometry((int)payloadU8(payload));
+            bot->color = (int)payloadU8(payload);
+            bot->state = BOT_PLAYING;
+            break;
+        case MSG_BOARD:
+            payloadU16(payload);
+            bot->geo = payloadBoard(payload, bot->board);
+            break;
+        case MSG_MOVE_PLAYED: {
+            payloadU16(payload);
+            int color = (int)payloadU8(payload);
+            int x = (int)payloadU8(payload);
+            int y = (int)payloadU8(payload);
+            if (bot->geo == NULL || payload->error) break;
+            bot->geo->place(bot->board, color, x, y);
+            if (color == bot->color && bot->moveSentAt != 0) {
+                histogram_add(&worker->rtt, now_us() - bot->moveSentAt);
+                worker->counters.moves++;
+                bot->moveSentAt = 0;
+            }
+            break;
+        }
+        case MSG_YOUR_TURN:
+            bot_move(bot);
+            break;
+        case MSG_ERROR:
+            if (payloadU8(payload) == ERR_BUSY) {
+                // Sent instead of WELCOME, or when no game could start; the server hangs up
+                bot_busy(bot, payloadU16(payload));
+                break;
+            }
+            worker->counters.errors++;
+            break;
+        case MSG_GAME_OVER:
+            worker->counters.games++;
+            bot_restart(bot, FALSE);
+            break;
+        default:
+            break;  // WELCOME, WAITING
+    }
+}
+
+// Picks a legal cell and sends it, starting the round-trip clock
+void bot_move(Bot *bot) {
+    const BoardGeometry *geo = bot->geo;
+    if (geo == NULL) return;
+
+    int start = (move_policy == MOVES_RANDOM) ? (int)(next_random(&bot->worker->seed) % geo->cells) : 0;
+    for (int i = 0; i < geo->cells; i++) {
+        int cell = (start + i) % geo->cells;
+        int x = cell / geo->size, y = cell % geo->size;
+        if (geo->checkMove(bot->board, x, y) == 0) {
+            Frame frame;
+            frameBegin(&frame, MSG_MOVE);
+            framePutU8(&frame, x);
+            framePutU8(&frame, y);
+            bot->moveSentAt = now_us();
+            bot_send(bot, &frame);
+            return;
+        }
+    }
+}
+
+int bot_send(Bot *bot, Frame *frame) {
+    size_t len = frameEnd(frame);
+    if (send(bot->fd, frame->data, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        bot_restart(bot, TRUE);
+        return -1;
+    }
+    return 0;
+}
+
+// Hangs up and dials again; the account is reused
+void bot_restart(Bot *bot, int failed) {
+    if (failed) bot->worker->counters.errors++;
+    if (bot->fd >= 0) {
+        epoll_ctl(bot->worker->epollFd, EPOLL_CTL_DEL, bot->fd, NULL);
+        close(bot->fd);
+        bot->fd = -1;
+    }
+    if (!stop) bot_connect(bot);
+}
+
+// Hangs up and dials again once the wait the server asked for is over
+void bot_busy(Bot *bot, unsigned int retryMs) {
+    bot->worker->counters.busy++;
+    if (bot->fd >= 0) {
+        epoll_ctl(bot->worker->epollFd, EPOLL_CTL_DEL, bot->fd, NULL);
+        close(bot->fd);
+        bot->fd = -1;
+    }
+    bot_retry(bot, retryMs);
+}
+
+// Dials again after retryMs; also where a bot whose connect failed waits
+void bot_retry(Bot *bot, unsigned int retryMs) {
+    if (bot->state != BOT_RETRYING) bot->worker->nRetrying++;
+    bot->connection++;  // ends bot_read's loop over the old buffer
+    bot->state = BOT_RETRYING;
+    bot->retryAt = now_us() + (uint64_t)(retryMs > 0 ? retryMs : DEFAULT_RETRY_MS) * 1000;
+}
+
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*
+uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Values below HIST_SUB get a bucket each; above that every power of two
+// is split into HIST_SUB equal buckets
+static void histogram_bucket(uint64_t value, int *group, int *sub) {
+    if (value < HIST_SUB) {
+        *group = 0;
+        *sub = (int)value;
+        return;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    *group = msb - 3;
+    *sub = (int)((value >> (msb - 4)) - HIST_SUB);
+    if (*group >= HIST_GROUPS) {
+        *group = HIST_GROUPS - 1;
+        *sub = HIST_SUB - 1;
+    }
+}
+
+// Largest value that lands in the bucket
+static uint64_t histogram_upper(int group, int sub) {
+    if (group == 0) return (uint64_t)sub;
+    int shift = group - 1;
+    return (((uint64_t)(HIST_SUB + sub + 1)) << shift) - 1;
+}
+
+void histogram_add(Histogram *hist, uint64_t value) {
+    int group, sub;
+    histogram_bucket(value, &group, &sub);
+    hist->counts[group][sub]++;
+    hist->total++;
+    if (value > hist->max) hist->max = value;
+}
+
+void histogram_merge(Histogram *into, const Histogram *from) {
+    for (int g = 0; g < HIST_GROUPS; g++) {
+        for (int s = 0; s < HIST_SUB; s++) {
+            into->counts[g][s] += from->counts[g][s];
+        }
+    }
+    into->total += from->total;
+    if (from->max > into->max) into->max = from->max;
+}
+
+uint64_t histogram_percentile(const Histogram *hist, double percentile) {
+    if (hist->total == 0) return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->total);
+    if (rank >= hist->total) rank = hist->total - 1;
+    uint64_t seen = 0;
+    for (int g = 0; g < HIST_GROUPS; g++) {
+        for (int s = 0; s < HIST_SUB; s++) {
+            seen += hist->counts[g][s];
+            if (seen > rank) {
+                uint64_t upper = histogram_upper(g, s);
+                return upper < hist->max ? upper : hist->max;
+            }
+        }
+    }
+    return hist->max;
+}
+
+// One row per power of two that saw any samples
+void histogram_print(const Histogram *hist) {
+    uint64_t cumulative = 0;
+
+    if (hist->total == 0) return;
+    printf("%22s %10s %8s %8s\n", "range (us)", "count", "%", "cum %");
+    for (int g = 0; g < HIST_GROUPS; g++) {
+        uint64_t count = 0;
+        for (int s = 0; s < HIST_SUB; s++) count += hist->counts[g][s];
+        if (count == 0) continue;
+        cumulative += count;
+        uint64_t low = (g == 0) ? 0 : (uint64_t)HIST_SUB << (g - 1);
+        uint64_t high = histogram_upper(g, HIST_SUB - 1);
+        char range[32];
+        snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)low, (unsigned long long)high);
+        printf("%22s %10llu %7.2f%% %7.2f%%  ", range, (unsigned long long)count,
+               100.0 * count / hist->total, 100.0 * cumulative / hist->total);
+        for (int i = 0; i < (int)(40.0 * count / hist->total + 0.5); i++) putchar('#');
+        putchar('\n');
+    }
+}
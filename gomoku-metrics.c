@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "gomoku-metrics.h"
+
+typedef struct METRICSHISTOGRAM {
+    _Atomic uint64_t buckets[METRICS_BUCKETS + 1];   // last one is +Inf
+    _Atomic uint64_t sum;
+} MetricsHistogram;
+
+// One thread's metrics, linked into a list that only ever grows
+typedef struct METRICSSHARD {
+    _Atomic uint64_t counters[METRIC_COUNTER_COUNT];
+    MetricsHistogram histograms[METRIC_HISTOGRAM_COUNT];
+    unsigned int sampleTick;
+    struct METRICSSHARD *next;
+} MetricsShard;
+
+typedef struct METRICINFO {
+    const char *name;
+    const char *label;     // label pair for histograms sharing a name, or NULL
+    const char *help;
+} MetricInfo;
+
+// Counters with the same name must be next to each other
+static const MetricInfo counterInfo[METRIC_COUNTER_COUNT] = {
+    { "gomoku_accepts_total", NULL, "Connections accepted." },
+    { "gomoku_connections_closed_total", NULL, "Connections closed." },
+    { "gomoku_send_failures_total", NULL, "Failed sends, including clients dropped for not reading." },
+    { "gomoku_logins_total", NULL, "Successful logins." },
+    { "gomoku_login_failures_total", NULL, "Rejected logins." },
+    { "gomoku_registrations_total", NULL, "Accounts registered." },
+    { "gomoku_games_started_total", NULL, "Games started." },
+    { "gomoku_games_finished_total", NULL, "Games played to a result." },
+    { "gomoku_moves_total", NULL, "Moves played." },
+    { "gomoku_invalid_moves_total", NULL, "Moves rejected as illegal." },
+    { "gomoku_bot_moves_total", NULL, "Moves the bot searched." },
+    { "gomoku_bot_nodes_total", NULL, "Positions the bot searched; over gomoku_bot_search_seconds_sum, nodes/sec." },
+    { "gomoku_book_moves_total", NULL, "Bot moves taken from the opening book without a search." },
+    { "gomoku_adjudications_total", NULL, "Games claimed or abandoned and won on a proven forced win." },
+    { "gomoku_spectators_joined_total", NULL, "Spectators that started watching a game." },
+    { "gomoku_spectators_left_total", NULL, "Spectators that stopped watching, or whose game ended." },
+    { "gomoku_spectator_resyncs_total", NULL, "Times a slow spectator's queued updates were dropped for the latest board." },
+    { "gomoku_resumes_total", NULL, "Logins with a resumption token instead of a password." },
+    { "gomoku_resume_failures_total", NULL, "Resumption tokens refused as forged or expired." },
+    { "gomoku_seats_parked_total", NULL, "Players who dropped mid-game and had their seat kept." },
+    { "gomoku_seats_reclaimed_total", NULL, "Kept seats taken back by a reconnecting player." },
+    { "gomoku_seats_expired_total", NULL, "Kept seats whose player did not return in time." },
+    { "gomoku_seats_released_total", NULL, "Kept seats given up, reclaimed, expired or ended with the game." },
+    { "gomoku_login_timeouts_total", NULL, "Connections closed for idling before they were in a game, queued or watching." },
+    { "gomoku_clock_expiries_total", NULL, "Turns not played in time: games lost on time, or dropped before the first move." },
+    { "gomoku_handoffs_total", NULL, "Connections passed to another shard to join a game, resume a seat or watch." },
+    { "gomoku_socket_writes_total", NULL, "send and writev calls on client sockets; over gomoku_moves_total, writes per move." },
+    { "gomoku_poll_changes_total", NULL, "epoll_ctl calls to start or stop waiting for a client socket to drain." },
+    { "gomoku_shed_total", "reason=\"sessions\"", "Clients told the server is busy and when to retry, by the limit they hit." },
+    { "gomoku_shed_total", "reason=\"logins\"", NULL },
+    { "gomoku_shed_total", "reason=\"queue\"", NULL },
+    { "gomoku_shed_total", "reason=\"games\"", NULL },
+};
+
+// Histograms with the same name must be next to each other
+static const MetricInfo histogramInfo[METRIC_HISTOGRAM_COUNT] = {
+    { "gomoku_crypt_seconds", NULL, "Time hashing a password on a worker." },
+    { "gomoku_auth_seconds", NULL, "Login or registration from queueing to the answer." },
+    { "gomoku_move_phase_seconds", "phase=\"parse\"", "Time in each step of a move, one move in 16 sampled." },
+    { "gomoku_move_phase_seconds", "phase=\"validate\"", NULL },
+    { "gomoku_move_phase_seconds", "phase=\"apply\"", NULL },
+    { "gomoku_move_phase_seconds", "phase=\"notify\"", NULL },
+    { "gomoku_lock_wait_seconds", "lock=\"shard\"", "Time blocked on a contended mutex." },
+    { "gomoku_lock_wait_seconds", "lock=\"matchmaker\"", NULL },
+    { "gomoku_lock_wait_seconds", "lock=\"bucket\"", NULL },
+    { "gomoku_lock_wait_seconds", "lock=\"seats\"", NULL },
+    { "gomoku_bot_search_seconds", NULL, "Time the bot spent on one move." },
+    { "gomoku_vcf_solve_seconds", NULL, "Time proving or refuting a win by continuous fours." },
+};
+
+static _Atomic(MetricsShard *) shards;
+static __thread MetricsShard *local;
+static void (*add_gauges)(MetricsBuffer *out);
+static int metrics_socket = -1;
+
+static MetricsShard *local_shard() {
+    if (local != NULL) return local;
+
+    MetricsShard *shard = (MetricsShard *)calloc(1, sizeof(MetricsShard));
+    if (shard == NULL) {
+        // Nowhere to count; share a static shard rather than fail the caller
+        static MetricsShard spare;
+        local = &spare;
+        return local;
+    }
+    shard->next = atomic_load(&shards);
+    while (!atomic_compare_exchange_weak(&shards, &shard->next, shard)) {
+    }
+    local = shard;
+    return local;
+}
+
+// Single writer per shard, so a relaxed load and store is enough
+static inline void bump(_Atomic uint64_t *value, uint64_t n) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+uint64_t metrics_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_count(MetricCounter counter, uint64_t n) {
+    bump(&local_shard()->counters[counter], n);
+}
+
+void metrics_observe(MetricHistogram histogram, uint64_t ns) {
+    MetricsHistogram *hist = &local_shard()->histograms[histogram];
+
+    // Bucket i holds values up to 2^(i+7) ns
+    int bucket = 0;
+    if (ns > 128) {
+        bucket = 64 - __builtin_clzll(ns - 1) - 7;
+        if (bucket > METRICS_BUCKETS) bucket = METRICS_BUCKETS;
+    }
+    bump(&hist->buckets[bucket], 1);
+    bump(&hist->sum, ns);
+}
+
+int metrics_sample() {
+    MetricsShard *shard = local_shard();
+    return (shard->sampleTick++ % METRICS_SAMPLE_EVERY) == 0;
+}
+
+void metrics_lock(pthread_mutex_t *mutex, MetricHistogram histogram) {
+    if (pthread_mutex_trylock(mutex) == 0) return;
+
+    uint64_t start = metrics_now();
+    pthread_mutex_lock(mutex);
+    metrics_observe(histogram, metrics_now() - start);
+}
+
+uint64_t metrics_total(MetricCounter counter) {
+    uint64_t total = 0;
+    for (MetricsShard *shard = atomic_load(&shards); shard != NULL; shard = shard->next) {
+        total += atomic_load_explicit(&shard->counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+void metrics_printf(MetricsBuffer *out, const char *format, ...) {
+    va_list args;
+
+    while (1) {
+        size_t room = out->cap - out->len;
+        va_start(args, format);
+        int n = vsnprintf(out->data + out->len, room, format, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t)n < room) {
+            out->len += n;
+            return;
+        }
+        size_t cap = out->cap ? out->cap * 2 : 4096;
+        while (cap - out->len <= (size_t)n) cap *= 2;
+        char *data = (char *)realloc(out->data, cap);
+        if (data == NULL) return;
+        out->data = data;
+        out->cap = cap;
+    }
+}
+
+void metrics_gauge(MetricsBuffer *out, const char *name, const char *help, double value) {
+    metrics_printf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+}
+
+static void write_histogram(MetricsBuffer *out, int index) {
+    const MetricInfo *info = &histogramInfo[index];
+    uint64_t buckets[METRICS_BUCKETS + 1] = { 0 };
+    uint64_t sum = 0;
+
+    for (MetricsShard *shard = atomic_load(&shards); shard != NULL; shard = shard->next) {
+        MetricsHistogram *hist = &shard->histograms[index];
+        for (int i = 0; i <= METRICS_BUCKETS; i++) {
+            buckets[i] += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        }
+        sum += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+    }
+
+    if (index == 0 || strcmp(histogramInfo[index - 1].name, info->name) != 0) {
+        metrics_printf(out, "# HELP %s %s\n# TYPE %s histogram\n", info->name, info->help, info->name);
+    }
+    const char *label = info->label ? info->label : "";
+    const char *comma = info->label ? "," : "";
+
+    // Buckets are cumulative, and the count is the +Inf bucket so they always agree
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += buckets[i];
+        metrics_printf(out, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", info->name, label, comma,
+                       (double)(1ULL << (i + 7)) / 1e9, (unsigned long long)cumulative);
+    }
+    cumulative += buckets[METRICS_BUCKETS];
+    metrics_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", info->name, label, comma, (unsigned long long)cumulative);
+    if (info->label) {
+        metrics_printf(out, "%s_sum{%s} %.9f\n%s_count{%s} %llu\n", info->name, label, sum / 1e9,
+                       info->name, label, (unsigned long long)cumulative);
+    } else {
+        metrics_printf(out, "%s_sum %.9f\n%s_count %llu\n", info->name, sum / 1e9,
+                       info->name, (unsigned long long)cumulative);
+    }
+}
+
+static void write_metrics(MetricsBuffer *out) {
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        const MetricInfo *info = &counterInfo[i];
+        if (info->help) metrics_printf(out, "# HELP %s %s\n# TYPE %s counter\n", info->name, info->help, info->name);
+        if (info->label) {
+            metrics_printf(out, "%s{%s} %llu\n", info->name, info->label,
+                           (unsigned long long)metrics_total((MetricCounter)i));
+        } else {
+            metrics_printf(out, "%s %llu\n", info->name, (unsigned long long)metrics_total((MetricCounter)i));
+        }
+    }
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        write_histogram(out, i);
+    }
+    if (add_gauges != NULL) add_gauges(out);
+}
+
+// One request per connection; whatever was asked for, the answer is the metrics
+static void *metrics_server(void *ptr) {
+    (void)ptr;
+    MetricsBuffer out = { NULL, 0, 0 };
+    char request[1024];
+
+    while (1) {
+        int client = accept(metrics_socket, NULL, NULL);
+        if (client == -1) {
+            if (errno != EINTR) perror("metrics accept");
+            continue;
+        }
+        struct timeval timeout = { 1, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (recv(client, request, sizeof(request), 0) <= 0) {
+            close(client);
+            continue;
+        }
+
+        out.len = 0;
+        metrics_printf(&out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+        write_metrics(&out);
+
+        size_t offset = 0;
+        while (offset < out.len) {
+            ssize_t sent = send(client, out.data + offset, out.len - offset, MSG_NOSIGNAL);
+            if (sent <= 0) break;
+            offset += sent;
+        }
+        close(client);
+    }
+    return NULL;
+}
+
+int start_metrics_server(const char *port, void (*gauges)(MetricsBuffer *out)) {
+    struct addrinfo hints, *info;
+    int yes = 1;
+    pthread_t thread;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", port, &hints, &info) != 0) return -1;
+
+    metrics_socket = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    if (metrics_socket == -1 ||
+        setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1 ||
+        bind(metrics_socket, info->ai_addr, info->ai_addrlen) == -1 ||
+        listen(metrics_socket, 16) == -1) {
+        perror("metrics socket");
+        freeaddrinfo(info);
+        return -1;
+    }
+    freeaddrinfo(info);
+
+    add_gauges = gauges;
+    if (pthread_create(&thread, NULL, metrics_server, NULL) != 0) return -1;
+    pthread_detach(thread);
+    return 0;
+}
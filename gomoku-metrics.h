@@ -0,0 +1,95 @@
+#ifndef GOMOKU_METRICS_H
+#define GOMOKU_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Server metrics: counters and latency histograms kept per thread and only
+// summed when someone asks, served in Prometheus text format.
+//
+// Each thread that records anything gets its own shard on first use. A shard
+// is only ever written by its thread, with plain relaxed loads and stores
+// (no locked instructions), and the scraper reads every shard's values
+// relaxed while they change; a scrape may be a hair behind, never torn.
+// Histograms have power-of-two nanosecond buckets.
+
+#define METRICS_BUCKETS 28        // upper bounds 2^7 ns .. 2^34 ns (about 17 s), then +Inf
+#define METRICS_SAMPLE_EVERY 16   // sampled histograms time one event in this many
+
+typedef enum {
+    METRIC_ACCEPTS,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_SEND_FAILURES,        // send errors and clients dropped for not reading
+    METRIC_LOGINS,
+    METRIC_LOGIN_FAILURES,
+    METRIC_REGISTRATIONS,
+    METRIC_GAMES_STARTED,
+    METRIC_GAMES_FINISHED,
+    METRIC_MOVES,
+    METRIC_INVALID_MOVES,
+    METRIC_BOT_MOVES,
+    METRIC_BOT_NODES,            // positions the bot searched
+    METRIC_BOOK_MOVES,           // bot moves taken from the opening book
+    METRIC_ADJUDICATIONS,        // games ended by a proven forced win
+    METRIC_SPECTATORS_JOINED,
+    METRIC_SPECTATORS_LEFT,
+    METRIC_SPECTATOR_RESYNCS,    // slow spectators that skipped to the latest board
+    METRIC_RESUMES,              // logins by resumption token
+    METRIC_RESUME_FAILURES,
+    METRIC_SEATS_PARKED,         // players who dropped mid-game, seat kept
+    METRIC_SEATS_RECLAIMED,      // ... and came back to it
+    METRIC_SEATS_EXPIRED,        // ... and did not, in time
+    METRIC_SEATS_RELEASED,       // parked seats given up for any reason
+    METRIC_LOGIN_TIMEOUTS,       // clients hung up on for idling before a game
+    METRIC_CLOCK_EXPIRIES,       // players out of time to move
+    METRIC_HANDOFFS,             // connections passed to another shard's reactor
+    METRIC_SOCKET_WRITES,        // send and writev calls on client sockets
+    METRIC_POLL_CHANGES,         // epoll_ctl calls to start or stop waiting for a socket to drain
+    METRIC_SHED_SESSIONS,        // clients turned away busy: at the session cap
+    METRIC_SHED_LOGINS,          // ... with too many passwords being hashed
+    METRIC_SHED_QUEUE,           // ... with their shard's hashing queue full
+    METRIC_SHED_GAMES,           // ... with every game slot taken
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    METRIC_CRYPT,                // encrypt_password on a worker
+    METRIC_AUTH,                 // login or registration queued until answered
+    METRIC_MOVE_PARSE,           // handle_game phases, sampled
+    METRIC_MOVE_VALIDATE,
+    METRIC_MOVE_APPLY,
+    METRIC_MOVE_NOTIFY,
+    METRIC_WAIT_SHARD,           // time blocked on a contended mutex
+    METRIC_WAIT_MATCHMAKER,
+    METRIC_WAIT_BUCKET,
+    METRIC_WAIT_SEATS,
+    METRIC_BOT_SEARCH,           // one bot move
+    METRIC_VCF_SOLVE,            // one hint, adjudication or bot check
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+// Text being built for a scrape
+typedef struct METRICSBUFFER {
+    char *data;
+    size_t len;
+    size_t cap;
+} MetricsBuffer;
+
+uint64_t metrics_now();
+void metrics_count(MetricCounter counter, uint64_t n);
+void metrics_observe(MetricHistogram histogram, uint64_t ns);
+// TRUE for one call in METRICS_SAMPLE_EVERY on this thread
+int metrics_sample();
+// Locks mutex; if it was held, the wait goes into histogram
+void metrics_lock(pthread_mutex_t *mutex, MetricHistogram histogram);
+// Sum over all threads
+uint64_t metrics_total(MetricCounter counter);
+
+void metrics_printf(MetricsBuffer *out, const char *format, ...);
+void metrics_gauge(MetricsBuffer *out, const char *name, const char *help, double value);
+// Serves /metrics on 127.0.0.1:port from its own thread; gauges, if given,
+// adds point-in-time values to every scrape. 0 on success.
+int start_metrics_server(const char *port, void (*gauges)(MetricsBuffer *out));
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gomoku-pool.h"
+
+typedef struct POOLWORKER {
+    WorkPool *pool;
+    int home;
+} PoolWorker;
+
+static Task *take_task(TaskQueue *queue) {
+    uint64_t top = atomic_load_explicit(&queue->top, memory_order_acquire);
+
+    while (1) {
+        uint64_t bottom = atomic_load_explicit(&queue->bottom, memory_order_acquire);
+        if (top >= bottom) return NULL;
+        // The owner never reuses this slot before top moves past it
+        Task *task = atomic_load_explicit(&queue->slots[top & queue->mask], memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&queue->top, &top, top + 1, memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            return task;
+        }
+    }
+}
+
+// Home queue first, then the others in turn
+static Task *find_task(WorkPool *pool, int home) {
+    for (int i = 0; i < pool->nQueues; i++) {
+        Task *task = take_task(&pool->queues[(home + i) % pool->nQueues]);
+        if (task != NULL) {
+            if (i > 0) atomic_fetch_add_explicit(&pool->stolen, 1, memory_order_relaxed);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void *pool_worker(void *ptr) {
+    PoolWorker *worker = (PoolWorker *)ptr;
+    WorkPool *pool = worker->pool;
+
+    while (1) {
+        Task *task = find_task(pool, worker->home);
+        if (task == NULL) {
+            // Counted as asleep before the last look, so a submitter either
+            // sees us waiting or we see its task
+            pthread_mutex_lock(&pool->lock);
+            atomic_fetch_add(&pool->sleepers, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            task = find_task(pool, worker->home);
+            if (task == NULL) pthread_cond_wait(&pool->ready, &pool->lock);
+            atomic_fetch_sub(&pool->sleepers, 1);
+            pthread_mutex_unlock(&pool->lock);
+            if (task == NULL) continue;
+        }
+        task->run(task);
+    }
+    return NULL;
+}
+
+int pool_start(WorkPool *pool, int nQueues, uint32_t depth, int nWorkers) {
+    if (nQueues <= 0 || nWorkers <= 0 || depth == 0 || (depth & (depth - 1)) != 0) return -1;
+
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    pool->queues = (TaskQueue *)aligned_alloc(POOL_ALIGN, nQueues * sizeof(TaskQueue));
+    if (pool->queues == NULL) return -1;
+    for (int i = 0; i < nQueues; i++) {
+        TaskQueue *queue = &pool->queues[i];
+        atomic_init(&queue->top, 0);
+        atomic_init(&queue->bottom, 0);
+        queue->slots = (_Atomic(Task *) *)calloc(depth, sizeof(*queue->slots));
+        queue->mask = depth - 1;
+        if (queue->slots == NULL) return -1;
+    }
+    pool->nQueues = nQueues;
+
+    for (int i = 0; i < nWorkers; i++) {
+        PoolWorker *worker = (PoolWorker *)malloc(sizeof(PoolWorker));
+        pthread_t thread;
+        if (worker == NULL) break;
+        worker->pool = pool;
+        worker->home = i % nQueues;
+        if (pthread_create(&thread, NULL, pool_worker, worker) != 0) {
+            free(worker);
+            break;
+        }
+        pthread_detach(thread);
+        pool->nWorkers++;
+    }
+    return pool->nWorkers > 0 ? 0 : -1;
+}
+
+int pool_submit(WorkPool *pool, int queue, Task *task) {
+    TaskQueue *q = &pool->queues[queue];
+    uint64_t bottom = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+
+    if (bottom - atomic_load_explicit(&q->top, memory_order_acquire) > q->mask) return -1;
+    atomic_store_explicit(&q->slots[bottom & q->mask], task, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, bottom + 1, memory_order_release);
+
+    // Pairs with the sleeper count a worker raises before its last look
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->ready);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return 0;
+}
+
+long pool_depth(WorkPool *pool) {
+    long depth = 0;
+
+    for (int i = 0; i < pool->nQueues; i++) {
+        uint64_t top = atomic_load_explicit(&pool->queues[i].top, memory_order_relaxed);
+        uint64_t bottom = atomic_load_explicit(&pool->queues[i].bottom, memory_order_relaxed);
+        if (bottom > top) depth += (long)(bottom - top);
+    }
+    return depth;
+}
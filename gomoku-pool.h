@@ -0,0 +1,54 @@
+#ifndef GOMOKU_POOL_H
+#define GOMOKU_POOL_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Worker pool for CPU-heavy tasks (password hashes, bot searches) handed
+// over by any number of reactor threads.
+//
+// Each submitting thread owns one bounded queue: it alone adds at the
+// bottom, with a plain store, and workers take from the top with a
+// compare-and-swap, oldest first. A worker drains its home queue and, when
+// that is empty, steals from the others, so a busy shard's work spreads
+// over every core without a shared lock on the hot path. Idle workers
+// sleep on a condition variable that submitters only touch when someone
+// is asleep.
+
+#define POOL_ALIGN 64
+
+// Embedded first in the submitter's job; the pool only calls run, on
+// whichever worker takes the task. done and next are for the submitter.
+typedef struct TASK {
+    void (*run)(struct TASK *task);
+    void (*done)(struct TASK *task);
+    struct TASK *next;
+} Task;
+
+typedef struct TASKQUEUE {
+    _Alignas(POOL_ALIGN) _Atomic uint64_t top;       // next task to take
+    _Alignas(POOL_ALIGN) _Atomic uint64_t bottom;    // next free slot; owner only
+    _Alignas(POOL_ALIGN) _Atomic(Task *) *slots;
+    uint64_t mask;
+} TaskQueue;
+
+typedef struct WORKPOOL {
+    TaskQueue *queues;
+    int nQueues;
+    int nWorkers;
+    atomic_int sleepers;
+    atomic_long stolen;        // tasks a worker took from a queue not its own
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} WorkPool;
+
+// nQueues queues of depth tasks each (a power of two), nWorkers workers;
+// 0 on success
+int pool_start(WorkPool *pool, int nQueues, uint32_t depth, int nWorkers);
+// Only the queue's owner may submit to it; -1 when the queue is full
+int pool_submit(WorkPool *pool, int queue, Task *task);
+// Tasks waiting over all queues; approximate while they change
+long pool_depth(WorkPool *pool);
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef GOMOKU_PROTOCOL_H
+#define GOMOKU_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "gomoku-board.h"
+
+// Binary wire protocol shared by the server and the client.
+//
+// Every message is a frame: a 2-byte big-endian payload length, a 1-byte
+// message type, then the payload. Integers are big-endian, strings are a
+// length byte followed by that many bytes (no terminator). A reader may
+// find any number of frames, or part of one, in a single recv.
+//
+// The client opens with HELLO carrying PROTO_VERSION; the server answers
+// WELCOME, or ERROR(ERR_VERSION) and hangs up.
+//
+// A game starts with a full BOARD; after that every move is announced as
+// a MOVE_PLAYED delta numbered by the move count. A client that sees a
+// gap in the numbers sends RESYNC and gets a full BOARD back.
+//
+// On its turn a player may send HINT, answered by HINT_RESULT and the turn
+// again, or ADJUDICATE to claim a forced win: if the server proves one the
+// game ends with GAME_OVER, otherwise ERROR(ERR_NOT_PROVEN) and the turn.
+//
+// A spectator sends SPECTATE and gets SPECTATING, a BOARD, then the same
+// MOVE_PLAYED deltas as the players and a GAME_OVER from the winner's side.
+// One that reads too slowly skips ahead: it gets a newer BOARD instead.
+//
+// A successful LOGIN is followed by SESSION with a resumption token. A
+// client that loses its connection reconnects and sends RESUME with the
+// token instead of LOGIN: AUTH_RESULT(AUTH_OK) and a fresh SESSION that
+// says whether a game was waiting for it. If one was, GAME_START, the BOARD
+// and the turn if it is its move follow; otherwise it chooses a size as
+// after a login. The opponent is told OPPONENT_AWAY when a player drops mid-game
+// and OPPONENT_BACK when it returns. AUTH_EXPIRED leaves the client in the
+// menu to log in with its password.
+//
+// YOUR_TURN says how long the player has for the move: the move limit or
+// what is left of its game clock, whichever is less. When that runs out the
+// player gets ERROR(ERR_TIMEOUT) and the game is lost on time, or dropped
+// before the first move. A client that idles in the login dialogue or over
+// the size for too long gets ERR_TIMEOUT and is hung up on.
+//
+// A server over capacity turns clients away rather than queueing them:
+// ERROR(ERR_BUSY) in place of WELCOME when it has all the connections it
+// takes, AUTH_RESULT(AUTH_BUSY) when it has all the passwords to check it
+// can, ERROR(ERR_BUSY) when no game can start, each followed by a u16 of
+// the milliseconds to wait before trying again, and then it hangs up.
+
+#define PROTO_VERSION 2
+#define PROTO_HEADER_SIZE 3
+#define PROTO_MAX_PAYLOAD 512
+#define PROTO_MAX_FRAME (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD)
+#define PROTO_TOKEN_BYTES 20      // resumption token, opaque to the client
+#define PROTO_BOARD_BYTES(size) (((size) * (size) + 3) / 4)   // 2 bits per cell
+
+typedef enum {
+    // Client to server
+    MSG_HELLO = 1,        // u8 version
+    MSG_LOGIN,            // str email, str password
+    MSG_REGISTER,         // str email, str password, str name
+    MSG_BOARD_SIZE,       // u8 size, 0 for the server default; optional u8 Opponent
+    MSG_MOVE,             // u8 x, u8 y
+    MSG_RESYNC,           // empty; asks for a full BOARD
+    MSG_HINT,             // empty
+    MSG_ADJUDICATE,       // empty
+    MSG_SPECTATE,         // str player name, empty for the featured game; instead of logging in or choosing a size
+    MSG_RESUME,           // PROTO_TOKEN_BYTES token; instead of LOGIN
+
+    // Server to client
+    MSG_WELCOME = 64,     // u8 version, u8 default board size
+    MSG_AUTH_RESULT,      // u8 AuthStatus; with AUTH_BUSY, u16 ms to wait before retrying
+    MSG_WAITING,          // u8 1 if the opponent left and we were requeued
+    MSG_GAME_START,       // u8 size, u8 your color, str your name, str opponent name
+    MSG_BOARD,            // u16 moves so far, u8 size, packed cells
+    MSG_YOUR_TURN,        // u8 color, u32 ms left to move, 0 if untimed
+    MSG_ERROR,            // u8 ErrorCode; with ERR_BUSY, u16 ms to wait before retrying
+    MSG_GAME_OVER,        // u8 Outcome, then twice: str name, u32 wins, u32 losses, u32 ties
+    MSG_MOVE_PLAYED,      // u16 move number from 1, u8 color, u8 x, u8 y
+    MSG_HINT_RESULT,      // u8 HintKind, u8 x, u8 y, u8 moves to five
+    MSG_SPECTATING,       // u8 size, str B name, str W name
+    MSG_SESSION,          // PROTO_TOKEN_BYTES token for RESUME, u16 seconds a dropped game waits, u8 1 if resuming one
+    MSG_OPPONENT_AWAY,    // u16 seconds the opponent has to come back
+    MSG_OPPONENT_BACK     // empty
+} MessageType;
+
+typedef enum {
+    AUTH_OK,
+    AUTH_INVALID,         // unknown email or wrong password
+    AUTH_TAKEN,           // email already registered
+    AUTH_FULL,            // the store cannot take more players
+    AUTH_BUSY,            // too many passwords to check, try again later
+    AUTH_FAILED,
+    AUTH_EXPIRED          // RESUME token not valid (any more): log in again
+} AuthStatus;
+
+typedef enum {
+    ERR_BAD_MESSAGE = 1,
+    ERR_VERSION,
+    ERR_NOT_YOUR_TURN,
+    ERR_INVALID_MOVE,
+    ERR_BUSY,
+    ERR_NOT_PROVEN,       // ADJUDICATE found no forced win
+    ERR_NO_GAME,          // nothing to SPECTATE by that name
+    ERR_TIMEOUT           // out of time to move, or to log in
+} ErrorCode;
+
+typedef enum {
+    OPPONENT_ANY,         // a human if one comes along, the bot after a while
+    OPPONENT_BOT          // the server's bot, right away
+} Opponent;
+
+// What a hint found by looking for wins by continuous fours
+typedef enum {
+    HINT_NONE,            // no forced win either way
+    HINT_WIN,             // playing x, y wins
+    HINT_DEFEND           // the opponent would win starting at x, y
+} HintKind;
+
+// Game results are from the receiver's side; scores list the winner first
+typedef enum {
+    OUTCOME_WIN,
+    OUTCOME_LOSS,
+    OUTCOME_DRAW
+} Outcome;
+
+// An outgoing frame, built in place
+typedef struct FRAME {
+    uint8_t data[PROTO_MAX_FRAME];
+    size_t len;
+    int overflow;
+} Frame;
+
+// Reads fields from a received payload; error is set on any short read
+typedef struct PAYLOAD {
+    const uint8_t *data;
+    size_t len;
+    int error;
+} Payload;
+
+static inline void frameBegin(Frame *frame, int type) {
+    frame->data[2] = (uint8_t)type;
+    frame->len = PROTO_HEADER_SIZE;
+    frame->overflow = 0;
+}
+
+static inline void framePutBytes(Frame *frame, const void *bytes, size_t len) {
+    if (frame->len + len > PROTO_MAX_FRAME) {
+        frame->overflow = 1;
+        return;
+    }
+    memcpy(frame->data + frame->len, bytes, len);
+    frame->len += len;
+}
+
+static inline void framePutU8(Frame *frame, unsigned int value) {
+    uint8_t byte = (uint8_t)value;
+    framePutBytes(frame, &byte, 1);
+}
+
+static inline void framePutU16(Frame *frame, unsigned int value) {
+    uint8_t bytes[2] = { value >> 8, value };
+    framePutBytes(frame, bytes, 2);
+}
+
+static inline void framePutU32(Frame *frame, uint32_t value) {
+    uint8_t bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    framePutBytes(frame, bytes, 4);
+}
+
+// Strings longer than 255 bytes are cut off
+static inline void framePutString(Frame *frame, const char *str) {
+    size_t len = strlen(str);
+    if (len > 255) len = 255;
+    framePutU8(frame, (unsigned int)len);
+    framePutBytes(frame, str, len);
+}
+
+// Fills in the length; returns the bytes to send, or 0 if the payload overflowed
+static inline size_t frameEnd(Frame *frame) {
+    size_t payload = frame->len - PROTO_HEADER_SIZE;
+    if (frame->overflow) return 0;
+    frame->data[0] = (uint8_t)(payload >> 8);
+    frame->data[1] = (uint8_t)payload;
+    return frame->len;
+}
+
+// Length of the complete frame at the start of buf, 0 if more bytes are
+// needed, or -1 if the header announces an oversized payload
+static inline long frameLength(const uint8_t *buf, size_t avail) {
+    if (avail < PROTO_HEADER_SIZE) return 0;
+    size_t payload = ((size_t)buf[0] << 8) | buf[1];
+    if (payload > PROTO_MAX_PAYLOAD) return -1;
+    if (avail < PROTO_HEADER_SIZE + payload) return 0;
+    return (long)(PROTO_HEADER_SIZE + payload);
+}
+
+static inline int frameType(const uint8_t *frame) {
+    return frame[2];
+}
+
+static inline Payload framePayload(const uint8_t *frame, long frameLen) {
+    Payload payload = { frame + PROTO_HEADER_SIZE, (size_t)frameLen - PROTO_HEADER_SIZE, 0 };
+    return payload;
+}
+
+static inline const uint8_t *payloadBytes(Payload *payload, size_t len) {
+    if (payload->error || payload->len < len) {
+        payload->error = 1;
+        return NULL;
+    }
+    const uint8_t *bytes = payload->data;
+    payload->data += len;
+    payload->len -= len;
+    return bytes;
+}
+
+static inline unsigned int payloadU8(Payload *payload) {
+    const uint8_t *bytes = payloadBytes(payload, 1);
+    return bytes ? bytes[0] : 0;
+}
+
+static inline unsigned int payloadU16(Payload *payload) {
+    const uint8_t *bytes = payloadBytes(payload, 2);
+    return bytes ? ((unsigned int)bytes[0] << 8) | bytes[1] : 0;
+}
+
+static inline uint32_t payloadU32(Payload *payload) {
+    const uint8_t *bytes = payloadBytes(payload, 4);
+    if (bytes == NULL) return 0;
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+// Copies a string into out (size bytes, always terminated); strings that
+// do not fit or contain a NUL are an error
+static inline void payloadString(Payload *payload, char *out, size_t size) {
+    size_t len = payloadU8(payload);
+    const uint8_t *bytes = payloadBytes(payload, len);
+    out[0] = '\0';
+    if (bytes == NULL) return;
+    if (len >= size || memchr(bytes, '\0', len) != NULL) {
+        payload->error = 1;
+        return;
+    }
+    memcpy(out, bytes, len);
+    out[len] = '\0';
+}
+
+// Board frames carry each cell in 2 bits (0 empty, 1 B, 2 W), row by row,
+// four cells to a byte starting at the low bits
+static inline void framePutBoard(Frame *frame, const BoardGeometry *geo, const void *board) {
+    uint8_t packed[PROTO_BOARD_BYTES(19)];
+    size_t len = geo->pack(board, packed);
+    framePutU8(frame, (unsigned int)geo->size);
+    framePutBytes(frame, packed, len);
+}
+
+// Rebuilds a board from a board frame; returns the geometry, or NULL if
+// the size is unknown or the payload is short
+static inline const BoardGeometry *payloadBoard(Payload *payload, void *board) {
+    const BoardGeometry *geo = findBoardGeometry((int)payloadU8(payload));
+    if (geo == NULL) return NULL;
+    const uint8_t *packed = payloadBytes(payload, PROTO_BOARD_BYTES(geo->size));
+    if (packed == NULL) return NULL;
+    geo->clear(board);
+    for (int i = 0; i < geo->cells; i++) {
+        int cell = (packed[i / 4] >> (i % 4 * 2)) & 3;
+        if (cell == 1 || cell == 2) geo->place(board, cell - 1, i / geo->size, i % geo->size);
+    }
+    return geo;
+}
+
+#endif
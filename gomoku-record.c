@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "gomoku-record.h"
+
+#define RECORD_READ_BUFFER 65536
+
+// One encoded game on its way to the writer
+typedef struct RECORDNODE {
+    _Atomic(struct RECORDNODE *) next;
+    size_t len;
+    uint8_t data[];
+} RecordNode;
+
+// Multi-producer, single-consumer queue: producers swap themselves in as
+// the head and then link the previous head to them; the writer follows the
+// links from a consumed node that stays behind as the tail.
+typedef struct GAMELOG {
+    _Atomic(RecordNode *) head;
+    RecordNode *tail;          // writer only
+    atomic_int idle;           // the writer is, or is about to be, asleep on wake
+    int wake;                  // eventfd
+    int fd;                    // -1 until open_game_log
+} GameLog;
+
+struct RECORDREADER {
+    FILE *fp;
+    size_t start, end;         // unread bytes of buf
+    uint8_t buf[RECORD_READ_BUFFER];
+};
+
+static GameLog game_log = { NULL, NULL, 0, -1, -1 };
+
+static uint32_t record_checksum(const uint8_t *data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t move_bytes(int size) {
+    return size <= 16 ? 1 : 2;
+}
+
+static size_t encode_record(const GameRecord *record, uint8_t *out) {
+    RecordHeader header;
+    uint8_t *p = out + sizeof(header);
+
+    memset(&header, 0, sizeof(header));
+    header.nMoves = (uint16_t)record->nMoves;
+    header.size = (uint8_t)record->size;
+    header.result = (uint8_t)record->result;
+    header.end = (uint8_t)record->end;
+    header.durationMs = record->durationMs;
+    header.black = record->black;
+    header.white = record->white;
+    header.finished = record->finished;
+    for (int i = 0; i < record->nMoves; i++) {
+        if (record->size <= 16) {
+            *p++ = (uint8_t)(record->moves[i][0] << 4 | record->moves[i][1]);
+        } else {
+            *p++ = record->moves[i][0];
+            *p++ = record->moves[i][1];
+        }
+    }
+    memcpy(out, &header, sizeof(header));
+
+    size_t len = p - out;
+    header.checksum = record_checksum(out + sizeof(uint32_t), len - sizeof(uint32_t));
+    memcpy(out, &header.checksum, sizeof(uint32_t));
+    return len;
+}
+
+void record_game(GameRecord *record) {
+    struct timespec now;
+
+    if (game_log.fd < 0) return;
+    if (record->nMoves > RECORD_MAX_MOVES) record->nMoves = RECORD_MAX_MOVES;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->finished = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    size_t len = sizeof(RecordHeader) + record->nMoves * move_bytes(record->size);
+    RecordNode *node = (RecordNode *)malloc(sizeof(RecordNode) + len);
+    if (node == NULL) {
+        fprintf(stderr, "game log: out of memory, game dropped\n");
+        return;
+    }
+    node->len = encode_record(record, node->data);
+    atomic_store(&node->next, NULL);
+
+    RecordNode *prev = atomic_exchange(&game_log.head, node);
+    atomic_store(&prev->next, node);
+
+    // The writer sets idle before its last look at the queue, so either it
+    // sees this record or this sees it asleep
+    if (atomic_exchange(&game_log.idle, 0)) {
+        uint64_t one = 1;
+        if (write(game_log.wake, &one, sizeof(one)) < 0) {
+            perror("game log wake");
+        }
+    }
+}
+
+// Group commit: drains every queued record into one buffer, then one write
+// and one fdatasync. Records queued during the sync go out with the next.
+static void *game_log_writer(void *ptr) {
+    uint8_t *batch = NULL;
+    size_t cap = 0;
+    (void)ptr;
+
+    while (1) {
+        size_t len = 0;
+        RecordNode *next;
+        while ((next = atomic_load(&game_log.tail->next)) != NULL) {
+            if (len + next->len > cap) {
+                size_t grown = cap ? cap * 2 : 65536;
+                while (grown < len + next->len) grown *= 2;
+                uint8_t *data = (uint8_t *)realloc(batch, grown);
+                if (data == NULL) break;  // write what fits, the rest stays queued
+                batch = data;
+                cap = grown;
+            }
+            memcpy(batch + len, next->data, next->len);
+            len += next->len;
+            free(game_log.tail);
+            game_log.tail = next;
+        }
+
+        if (len == 0) {
+            atomic_store(&game_log.idle, 1);
+            if (atomic_load(&game_log.tail->next) == NULL) {
+                uint64_t count;
+                if (read(game_log.wake, &count, sizeof(count)) < 0 && errno != EINTR) {
+                    perror("game log wake");
+                }
+            }
+            atomic_store(&game_log.idle, 0);
+            continue;
+        }
+
+        size_t offset = 0;
+        while (offset < len) {
+            ssize_t written = write(game_log.fd, batch + offset, len - offset);
+            if (written <= 0) {
+                if (written < 0 && errno == EINTR) continue;
+                perror("game log");
+                break;
+            }
+            offset += written;
+        }
+        if (fdatasync(game_log.fd) == -1) {
+            perror("game log sync");
+        }
+    }
+    return NULL;
+}
+
+int open_game_log(const char *dir) {
+    char path[PATH_MAX];
+    struct stat st;
+    pthread_t writer;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, RECORD_FILE);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size == 0 && write(fd, RECORD_MAGIC, strlen(RECORD_MAGIC)) != (ssize_t)strlen(RECORD_MAGIC))) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    // The queue starts with a consumed node for the writer to follow
+    RecordNode *stub = (RecordNode *)calloc(1, sizeof(RecordNode));
+    game_log.wake = eventfd(0, EFD_CLOEXEC);
+    if (stub == NULL || game_log.wake < 0) {
+        free(stub);
+        close(fd);
+        return -1;
+    }
+    atomic_store(&game_log.head, stub);
+    game_log.tail = stub;
+    if (pthread_create(&writer, NULL, game_log_writer, NULL) != 0) {
+        close(fd);
+        return -1;
+    }
+    pthread_detach(writer);
+    game_log.fd = fd;
+    return 0;
+}
+
+RecordReader *open_record_reader(const char *path) {
+    char magic[sizeof(RECORD_MAGIC) - 1];
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a game log\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    RecordReader *reader = (RecordReader *)malloc(sizeof(RecordReader));
+    if (reader == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    reader->fp = fp;
+    reader->start = reader->end = 0;
+    return reader;
+}
+
+// Makes at least need unread bytes available; 0 if the file ends first
+static int fill_reader(RecordReader *reader, size_t need) {
+    if (reader->end - reader->start >= need) return 1;
+    memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    while (reader->end < need) {
+        size_t got = fread(reader->buf + reader->end, 1, sizeof(reader->buf) - reader->end, reader->fp);
+        if (got == 0) return 0;
+        reader->end += got;
+    }
+    return 1;
+}
+
+// A damaged record is stepped over a byte at a time until a header and its
+// moves check out again
+int read_game_record(RecordReader *reader, GameRecord *record) {
+    RecordHeader header;
+    int damaged = 0;
+
+    while (fill_reader(reader, sizeof(header))) {
+        const uint8_t *data = reader->buf + reader->start;
+        memcpy(&header, data, sizeof(header));
+        size_t len = sizeof(header) + (size_t)header.nMoves * move_bytes(header.size);
+        if (header.size < 5 || header.size > 19 || header.nMoves > header.size * header.size ||
+            header.result > RESULT_DRAW || header.end > END_ABANDONED) {
+            reader->start++;
+            damaged = 1;
+            continue;
+        }
+        if (!fill_reader(reader, len)) return 0;
+        data = reader->buf + reader->start;
+        if (record_checksum(data + sizeof(uint32_t), len - sizeof(uint32_t)) != header.checksum) {
+            reader->start++;
+            damaged = 1;
+            continue;
+        }
+        if (damaged) return -1;  // this record is read next time
+
+        record->size = header.size;
+        record->result = (GameResult)header.result;
+        record->end = (GameEnd)header.end;
+        record->black = header.black;
+        record->white = header.white;
+        record->finished = header.finished;
+        record->durationMs = header.durationMs;
+        record->nMoves = header.nMoves;
+        const uint8_t *p = data + sizeof(header);
+        for (int i = 0; i < record->nMoves; i++) {
+            if (record->size <= 16) {
+                record->moves[i][0] = p[0] >> 4;
+                record->moves[i][1] = p[0] & 15;
+                p++;
+            } else {
+                record->moves[i][0] = p[0];
+                record->moves[i][1] = p[1];
+                p += 2;
+            }
+        }
+        reader->start += len;
+        return 1;
+    }
+    return damaged ? -1 : 0;
+}
+
+void close_record_reader(RecordReader *reader) {
+    if (reader == NULL) return;
+    fclose(reader->fp);
+    free(reader);
+}
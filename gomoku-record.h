@@ -0,0 +1,77 @@
+#ifndef GOMOKU_RECORD_H
+#define GOMOKU_RECORD_H
+
+#include <stdint.h>
+
+// Finished games, appended to a binary log in the data directory. The file
+// starts with RECORD_MAGIC; each game is a RecordHeader and then its moves
+// in the order they were played, B first: one byte (x << 4 | y) per move on
+// boards up to 16x16, two (x, y) on larger ones. A 15x15 game of 40 moves
+// takes 80 bytes. Fields are in host byte order, like the opening book.
+//
+// Game threads only encode a record and push it onto a lock-free queue. A
+// writer thread drains the queue, writes everything it found at once and
+// makes it durable with one fdatasync, so games that finish while a sync is
+// running share the next one. The checksum lets the reader stop cleanly at
+// a record torn by a crash and step over damaged ones.
+
+#define RECORD_FILE "games.rec"
+#define RECORD_MAGIC "GMKGAME1"
+#define RECORD_MAX_MOVES (19 * 19)
+
+typedef enum {
+    RESULT_B_WON,
+    RESULT_W_WON,
+    RESULT_DRAW
+} GameResult;
+
+typedef enum {
+    END_FIVE,              // the last move made five
+    END_FULL,              // board full
+    END_CLAIM,             // the player to move proved a forced win
+    END_ADJUDICATED,       // the opponent left and the winner had a forced win
+    END_TIME,              // the player to move ran out of time
+    END_ABANDONED          // the opponent left for good, with no forced win for either
+} GameEnd;
+
+typedef struct RECORDHEADER {
+    uint32_t checksum;     // FNV-1a of everything after this field, moves included
+    uint16_t nMoves;
+    uint8_t size;
+    uint8_t result;        // GameResult
+    uint8_t end;           // GameEnd
+    uint8_t reserved[3];
+    uint32_t durationMs;   // first board to the result
+    uint64_t black;        // player ids, see player_id()
+    uint64_t white;
+    uint64_t finished;     // Unix time in milliseconds
+} RecordHeader;
+
+typedef struct GAMERECORD {
+    int size;
+    GameResult result;
+    GameEnd end;
+    uint64_t black;
+    uint64_t white;
+    uint64_t finished;     // filled in by record_game
+    uint32_t durationMs;
+    int nMoves;
+    uint8_t moves[RECORD_MAX_MOVES][2];   // x, y
+} GameRecord;
+
+typedef struct RECORDREADER RecordReader;
+
+// Starts the writer for dir/RECORD_FILE; 0 on success
+int open_game_log(const char *dir);
+// Encodes a finished game and queues it for the writer without taking a
+// lock or touching the disk; a no-op until the log is open
+void record_game(GameRecord *record);
+
+// NULL if the file is missing or not a game log
+RecordReader *open_record_reader(const char *path);
+// Reads the next game: 1 if one was read, 0 at the end (a torn last record
+// included), -1 after stepping over damaged bytes
+int read_game_record(RecordReader *reader, GameRecord *record);
+void close_record_reader(RecordReader *reader);
+
+#endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "gomoku-board.h"
+#include "gomoku-record.h"
+#include "gomoku-store.h"
+#include "gomoku-vcf.h"
+
+// Game log reader for analytics and disputes: lists the games in a log,
+// optionally only one player's or one board size's, and replays a single
+// game move by move, or checks every listed game quietly. A replay checks every move against the rules and the
+// recorded ending against the final position; claimed and adjudicated wins
+// are proven again with the VCF solver, given far more nodes than the
+// server allows itself.
+
+#define REPLAY_VCF_CACHE_MB 64
+#define REPLAY_VCF_MAX_NODES 5000000
+
+#define FALSE 0
+#define TRUE 1
+
+static const char *resultNames[] = { "B won", "W won", "draw" };
+static const char *endNames[] = { "five", "board full", "claimed", "adjudicated", "time", "abandoned" };
+
+int list_games(const char *path, const char *email, int size, int check);
+int show_game(const char *path, long number);
+int replay_game(const GameRecord *record, int verbose);
+void print_summary(long number, const GameRecord *record);
+
+int main(int argc, char *argv[]) {
+    const char *email = NULL;
+    int size = 0, check = FALSE, opt;
+
+    if (argc >= 2 && strcmp(argv[1], "list") == 0) {
+        argc--;
+        argv++;
+        while ((opt = getopt(argc, argv, "cp:s:")) != -1) {
+            switch (opt) {
+                case 'c': check = TRUE; break;
+                case 'p': email = optarg; break;
+                case 's': size = atoi(optarg); break;
+                default: size = -1; break;  // print usage
+            }
+        }
+        if (optind == argc - 1 && size >= 0) {
+            return list_games(argv[optind], email, size, check);
+        }
+    }
+    if (argc == 4 && strcmp(argv[1], "show") == 0 && atol(argv[2]) > 0) {
+        return show_game(argv[3], atol(argv[2]));
+    }
+
+    fprintf(stderr, "Usage: gomoku-replay list [-c] [-p player email] [-s board size] games.rec\n"
+                    "       gomoku-replay show <game number> games.rec\n"
+                    "  -c replays every listed game and reports the ones that do not check out\n");
+    return 1;
+}
+
+int list_games(const char *path, const char *email, int size, int check) {
+    static GameRecord record;
+    uint64_t player = email ? player_id(email) : 0;
+    long number = 0, shown = 0, damaged = 0, failed = 0;
+    int status;
+
+    RecordReader *reader = open_record_reader(path);
+    if (reader == NULL) {
+        fprintf(stderr, "%s: cannot read games\n", path);
+        return 1;
+    }
+    while ((status = read_game_record(reader, &record)) != 0) {
+        if (status == -1) {
+            damaged++;
+            continue;
+        }
+        number++;
+        if ((email && record.black != player && record.white != player) || (size && record.size != size)) {
+            continue;
+        }
+        print_summary(number, &record);
+        shown++;
+        if (check && !replay_game(&record, FALSE)) failed++;
+    }
+    close_record_reader(reader);
+    printf("%ld of %ld games", shown, number);
+    if (check) printf(", %ld failed the check", failed);
+    if (damaged) printf(", %ld damaged stretches skipped", damaged);
+    printf("\n");
+    return 0;
+}
+
+int show_game(const char *path, long number) {
+    static GameRecord record;
+    long n = 0;
+    int status;
+
+    RecordReader *reader = open_record_reader(path);
+    if (reader == NULL) {
+        fprintf(stderr, "%s: cannot read games\n", path);
+        return 1;
+    }
+    while ((status = read_game_record(reader, &record)) != 0) {
+        if (status == 1 && ++n == number) break;
+    }
+    close_record_reader(reader);
+    if (n != number) {
+        fprintf(stderr, "%s holds %ld games\n", path, n);
+        return 1;
+    }
+    print_summary(number, &record);
+    return replay_game(&record, TRUE) ? 0 : 2;
+}
+
+// Plays the moves out on a fresh board; TRUE if every move was legal and
+// the recorded ending matches the position
+int replay_game(const GameRecord *record, int verbose) {
+    const BoardGeometry *geo = findBoardGeometry(record->size);
+    uint8_t board[BOARD_BYTES_MAX];
+    char text[BOARD_RENDER_MAX];
+    int five = -1;
+
+    if (geo == NULL) {
+        printf("unsupported board size %d\n", record->size);
+        return FALSE;
+    }
+    geo->clear(board);
+    for (int i = 0; i < record->nMoves; i++) {
+        int color = i % 2, x = record->moves[i][0], y = record->moves[i][1];
+        if (geo->checkMove(board, x, y)) {
+            printf("move %d: %c %d,%d is not legal\n", i + 1, "BW"[color], x, y);
+            return FALSE;
+        }
+        geo->place(board, color, x, y);
+        if (verbose) printf("%3d %c %d,%d\n", i + 1, "BW"[color], x, y);
+        if (five == -1 && geo->checkWin(board, color, x, y)) five = i;
+    }
+    if (verbose) {
+        geo->render(board, text);
+        printf("%s", text);
+    }
+
+    int mover = (record->nMoves - 1) % 2;
+    const char *problem = NULL;
+    switch (record->end) {
+        case END_FIVE:
+            if (five != record->nMoves - 1 || (int)record->result != mover) problem = "the last move does not make five";
+            break;
+        case END_FULL:
+            if (five != -1 || record->nMoves != geo->cells || record->result != RESULT_DRAW) problem = "not a full board";
+            break;
+        case END_TIME:
+            // the winner made the last move, or none at all if B never moved
+            if (five != -1 || record->result != (record->nMoves % 2 ? RESULT_B_WON : RESULT_W_WON)) {
+                problem = "the loser on time was not the player to move";
+            }
+            break;
+        case END_ABANDONED:
+            if (five != -1 || record->result == RESULT_DRAW) problem = "a decided game cannot be abandoned";
+            break;
+        case END_CLAIM:
+        case END_ADJUDICATED: {
+            static VcfCache *cache = NULL;
+            VcfResult proof;
+            if (cache == NULL) cache = vcfCreateCache(REPLAY_VCF_CACHE_MB);
+            if (five != -1 || record->result == RESULT_DRAW) {
+                problem = "a decided game cannot be claimed";
+            } else if (record->end == END_CLAIM && (int)record->result == mover) {
+                problem = "the claim was made out of turn";
+            } else if (cache == NULL) {
+                problem = "no memory to check the claim";
+            } else if (!vcfSolve(cache, geo, board, record->result, REPLAY_VCF_MAX_NODES, &proof)) {
+                problem = proof.complete ? "the winner had no forced win" : "the forced win could not be proven again";
+            } else if (verbose) {
+                printf("forced win from %d,%d in %d moves\n", proof.x, proof.y, proof.moves);
+            }
+            break;
+        }
+    }
+    if (problem) {
+        printf("        recorded %s (%s), but %s\n", resultNames[record->result], endNames[record->end], problem);
+        return FALSE;
+    }
+    if (verbose) printf("recorded result checks out\n");
+    return TRUE;
+}
+
+void print_summary(long number, const GameRecord *record) {
+    char when[32], outcome[32];
+    time_t seconds = (time_t)(record->finished / 1000);
+    struct tm tm;
+
+    localtime_r(&seconds, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(outcome, sizeof(outcome), "%s (%s)", resultNames[record->result], endNames[record->end]);
+    printf("#%-6ld %s  %2dx%-2d  B %016llx  W %016llx  %-19s  %3d moves  %u.%us\n",
+           number, when, record->size, record->size, (unsigned long long)record->black,
+           (unsigned long long)record->white, outcome, record->nMoves, record->durationMs / 1000, record->durationMs % 1000 / 100);
+}
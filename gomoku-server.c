@@ -1,587 +1,2809 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <crypt.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include "gomoku-ai.h"
+#include "gomoku-board.h"
+#include "gomoku-book.h"
+#include "gomoku-metrics.h"
+#include "gomoku-pool.h"
+#include "gomoku-protocol.h"
+#include "gomoku-record.h"
+#include "gomoku-session.h"
+#include "gomoku-slab.h"
+#include "gomoku-store.h"
+#include "gomoku-timer.h"
+#include "gomoku-vcf.h"
 
-#define MAX_PLAYERS 10
+#define DEFAULT_BOARD_SIZE 8
+#define DEFAULT_MAX_GAMES 4096    // games in play at once, preallocated
+#define MAX_EVENTS 256
+#define MAX_PENDING_OUTPUT 65536  // drop clients that stop reading
+#define SPECTATOR_BACKLOG 8       // frames queued per spectator before it only gets the latest board
+#define TASK_QUEUE_DEPTH 1024     // hashing and bot jobs waiting per shard, by default; power of two
+#define DEFAULT_MAX_SESSIONS 20000   // open client connections over all shards
+#define AUTHS_PER_WORKER 32       // passwords queued or being hashed, per worker, by default
+#define RETRY_MIN_MS 250          // shortest wait a busy answer asks for
+#define RETRY_MAX_MS 30000        // ... and longest, before jitter doubles it at most
+#define RETRY_BUSY_MS 1000        // wait asked when there is no queue to estimate it from
+#define LISTEN_BACKLOG SOMAXCONN  // per shard; the kernel caps it at net.core.somaxconn
+#define FD_RESERVE 64             // descriptors kept from sessions for files, the store and logs, plus 4 per shard
+#define ACCEPT_PAUSE_MS 100       // the listener rests this long when no descriptor is left to shed with
+#define NUM_SKILL_BANDS 8         // matchmaking buckets per board size
+#define SKILL_BAND_WIDTH 5        // wins minus losses per band
+#define MATCH_WIDEN_MS 5000       // after this long, match with the next band up
+#define MATCH_POLL_MS 100
+#define MATCH_BOT_MS 15000       // after this long alone in the queue, play the bot
+#define DEFAULT_AI_THREADS 2     // search threads per bot move
+#define DEFAULT_AI_MOVE_MS 300
+#define AI_TABLE_MB 64           // transposition table shared by every bot game
+#define VCF_CACHE_MB 16          // proven wins and failures, shared by the reactor and the bot
+#define VCF_MAX_NODES 20000      // about a millisecond of solving on the reactor
+#define DEFAULT_RESUME_SECONDS 60   // a player who drops mid-game has this long to come back
+#define SESSION_TOKEN_SECONDS (24 * 3600)   // how long a resumption token is good for
+#define SEAT_BUCKETS 4096        // players in games, by id; power of two
+#define SEAT_LOCKS 64            // stripes over the seat buckets; power of two
+#define LOGIN_IDLE_MS 60000      // silence allowed before a client is in a game, the queue or watching
+#define DEFAULT_MOVE_SECONDS 120 // to make one move
+#define DEFAULT_GAME_SECONDS 1200   // each player's clock for all of its moves
+#define BOT_EMAIL "bot"
+#define BOT_NAME "Bot"
 #define TRUE 1
 #define FALSE 0
 
-typedef struct PLAYERRECORD {
-    char email[51];
-    char password[128];  // encrypted password
+// One encoded frame sent to any number of connections, which hold
+// references instead of copies; freed with the last reference. Only the
+// shard that owns the game touches it.
+typedef struct SHAREDFRAME {
+    int refs;
+    size_t len;
+    uint8_t data[];
+} SharedFrame;
+
+// Where a connection is in the login dialogue or the game
+typedef enum {
+    CONN_HELLO,            // waiting for the protocol version
+    CONN_MENU,             // waiting for a login or registration
+    CONN_AUTHENTICATING,   // password is being hashed by the worker pool
+    CONN_CHOOSING_SIZE,
+    CONN_WAITING,          // in the matchmaking queue
+    CONN_PLAYING,
+    CONN_SPECTATING,       // read-only: gets every update of one game
+    CONN_PARKED,           // dropped mid-game: no socket, the seat waits for a RESUME
+    CONN_MOVING,           // on its way to another shard; nobody's until it arrives
+    CONN_CLOSED
+} ConnState;
+
+typedef struct CONNECTION {
+    int fd;
+    ConnState state;
+    struct SHARD *shard;   // the reactor that owns it, or is about to
+    ConnState arrivingAs;  // moving: the state it resumes on the new shard
+    int arrived;           // moving: handle the message it moved for here, whatever other shards hold
+    struct CONNECTION *nextMoving;
+    int dirty;             // has output for the end of the batch
+    int wantWrite;         // registered for EPOLLOUT: the socket took only part of it
+    struct CONNECTION *nextDirty;
+    int closing;           // close once the pending output is written
+    int authPending;       // an AuthJob still points at this connection
+    int bot;               // the server's own player: no socket, moves come from the bot pool
+    int searching;         // a BotJob still points at this connection
+    char email[51];        // fields from the login or registration message
+    char password[51];
+    char name[51];
+    PlayerRecord *player;
+    struct GAME *game;
+    const BoardGeometry *geo;   // board size asked for
+    struct TICKET *ticket;      // matchmaking ticket, queued or being matched
+    uint64_t queuedAt;          // first time in the queue, kept on requeue
+    uint8_t in[PROTO_MAX_FRAME];  // received bytes not yet forming a whole frame
+    size_t inLen;
+    char *out;             // output the socket did not accept yet
+    size_t outLen;
+    size_t outCap;
+    struct CONNECTION *nextClosed;
+    struct GAME *watching;           // spectators: the game, NULL once it is over
+    struct CONNECTION *nextSpectator;
+    struct CONNECTION *prevSpectator;
+    SharedFrame *shared[SPECTATOR_BACKLOG];   // spectators: frames not yet written, oldest first
+    int nShared;
+    size_t sharedSent;     // bytes of shared[0] already written
+    int behind;            // updates were dropped; a fresh BOARD follows once the queue drains
+    int seated;            // in Seats.byPlayer: a human player in a game
+    struct CONNECTION *nextSeat;
+    struct CONNECTION *prevSeat;
+    Timer timer;           // login idle timeout, or a parked seat's grace period
+} Connection;
+
+typedef struct GAME {
+    int nMoves;
+    int gameOver;
+    char stone;
+    int x, y;
+    const BoardGeometry *geo;
+    pthread_mutex_t lock;
+    Connection *player1_conn;
+    Connection *player2_conn;
+    PlayerRecord *player1;
+    PlayerRecord *player2;
+    GameRecord record;          // moves so far, for the game log
+    uint64_t startedAt;         // now_ms() at the first board
+    Timer clock;                // the player to move runs out of time
+    uint64_t clockLeft[2];      // ms left on each color's game clock
+    uint64_t turnStarted;       // now_ms() when the turn began
+    uint64_t turnDeadline;      // now_ms() when it is lost, 0 if untimed
+    struct GAME *liveNext;      // the shard's games in play, newest first
+    struct GAME *livePrev;
+    Connection *spectators;
+    int nSpectators;            // read by other shards under the live lock
+    SharedFrame *snapshot;      // BOARD frame, encoded once per move when someone asks
+    int snapshotMoves;
+    uint64_t board[];  // line bitboards, geo->boardBytes long
+} Game;
+
+typedef enum {
+    AUTH_LOGIN,
+    AUTH_REGISTER
+} AuthKind;
+
+// Password hashing handed from a shard to the worker pool and back
+typedef struct AUTHJOB {
+    Task task;
+    struct SHARD *shard;   // where the answer goes
+    AuthKind kind;
+    Connection *conn;
+    PlayerRecord *player;  // login: the account being checked
+    char password[51];     // plain text, wiped once hashed
+    char expected[128];    // login: stored hash
+    char hash[128];        // register: new hash
+    int ok;                // login: hash matched; register: hashing worked
+    uint64_t queuedAt;     // metrics clock, for the auth latency histogram
+} AuthJob;
+
+// A position handed from a shard to the worker pool and the move that comes back
+typedef struct BOTJOB {
+    Task task;
+    struct SHARD *shard;
+    Connection *conn;      // the bot's side of the game
+    const BoardGeometry *geo;
+    int color;
+    uint64_t board[BOARD_BYTES_MAX / sizeof(uint64_t) + 1];
+    AiResult result;
+    int resign;            // the worker had no engine to search with
+} BotJob;
+
+// The bot's settings; its moves are searched on the worker pool
+typedef struct BOTPOOL {
+    int nThreads;          // search threads per worker's engine; 0 when bots are off
+    int moveMs;
+    AiTable *table;
+    Book *book;            // opening replies tried before searching, NULL if none
+    PlayerRecord *player;  // the bot's account, for its W/L/T
+} BotPool;
+
+// Players in games on every shard, found by id when they RESUME. A bucket
+// is guarded by its stripe's lock; a seat is only added and removed by its
+// own shard, but looked up from any.
+typedef struct SEATS {
+    pthread_mutex_t locks[SEAT_LOCKS];
+    Connection *byPlayer[SEAT_BUCKETS];
+} Seats;
+
+// Admission control: past these limits a client is answered busy with a
+// time to come back, at once and without taking a slot, instead of waiting
+// behind everyone else until it times out. Counts are over all shards.
+typedef struct ADMISSION {
+    long maxSessions;      // 0 for no limit
+    long maxAuths;
+    _Atomic long sessions; // accepted sockets not yet closed
+    _Atomic long auths;    // AuthJobs submitted and not yet answered
+    _Atomic uint64_t cryptNs;   // recent time per hash, a moving average
+} Admission;
+
+// A player waiting for an opponent; owned by the matchmaker while queued
+typedef struct TICKET {
+    Connection *conn;
+    const BoardGeometry *geo;
+    int band;
+    uint64_t queuedAt;
+    int queued;              // in a bucket list, guarded by that bucket's lock
+    struct BUCKET *bucket;
+    struct TICKET *prev;
+    struct TICKET *next;
+    struct TICKET *partner;  // set when matched
+} Ticket;
+
+typedef struct BUCKET {
+    pthread_mutex_t lock;
+    Ticket *head;            // oldest first
+    Ticket *tail;
+    int count;
+} Bucket;
+
+typedef struct MATCHMAKER {
+    Bucket buckets[BOARD_GEOMETRY_COUNT][NUM_SKILL_BANDS];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int signalled;           // tickets were queued since the last pass
+} Matchmaker;
+
+// One reactor thread with its own listener, epoll set and timers. The
+// kernel spreads new connections over the shards' SO_REUSEPORT listeners,
+// and a connection is only ever touched by the shard that owns it. Both
+// players of a game and its spectators are on one shard, so a connection
+// that pairs up, resumes or watches elsewhere moves there first.
+typedef struct SHARD {
+    int index;             // its task queue in the worker pool
+    int listenFd;
+    int epollFd;
+    int wakeFd;            // eventfd: other threads left something in the mailbox
+    int spareFd;           // given up to accept and shed a connection when descriptors run out
+    Timer listenTimer;     // turns the listener back on after a pause
+    TimerWheel wheel;      // every timeout and game clock on the shard
+    Connection *closed;    // freed after the current batch of events
+    Connection *dirty;     // written after the current batch of events
+    Connection *moving;    // handed to other shards after the current batch
+    Ticket *forwarding;    // pairs sent on once their second player is let go
+    pthread_mutex_t lock;  // the mailbox and the live games list
+    Task *done;            // mailbox: finished hashing and bot jobs
+    Ticket *matched;       // mailbox: pairs from the matcher, or forwarded
+    Connection *arriving;  // mailbox: connections handed over
+    Game *liveGames;       // newest first, for spectators to pick from
+} Shard;
+
+
+static __thread Shard *reactor;   // the shard this thread runs, NULL off the reactors
+Shard *shards;
+int n_shards;
+const BoardGeometry *board_geo;  // default board size
+WorkPool work_pool;             // password hashes and bot moves, stolen between shards
+Matchmaker matchmaker;
+BotPool bot_pool;
+Slab game_slab;                 // every Game, sized for the largest board
+VcfCache *vcf_cache;            // lock-free, shared by the shards and the workers
+_Atomic long reported_peak;     // last peak games in play that was logged
+Seats seats;
+Admission admission;
+uint8_t session_key[SESSION_KEY_BYTES];   // signs resumption tokens, new on every start
+int resume_seconds = DEFAULT_RESUME_SECONDS;
+int move_seconds = DEFAULT_MOVE_SECONDS;
+int game_seconds = DEFAULT_GAME_SECONDS;
+
+// server functions
+int start_server(char *hostname, char *port, int backlog);
+int accept_client(int serv_sock);
+int get_server_socket(char *hostname, char *port);
+void print_ip( struct addrinfo *ai);
+
+// Reactor functions
+int start_shard(Shard *shard, int index, char *port);
+void *run_reactor(void *ptr);
+long raise_fd_limit();
+int set_nonblocking(int fd);
+void accept_clients(int serv_socket);
+int accept_overflow(int serv_socket);
+void resume_listener(void *data);
+void read_connection(Connection *conn);
+void flush_connection(Connection *conn);
+void schedule_flush(Connection *conn);
+void flush_dirty();
+void watch_output(Connection *conn, int on);
+int write_pending(Connection *conn);
+void conn_send(Connection *conn, const char *data, size_t len);
+void conn_send_frame(Connection *conn, Frame *frame);
+void conn_send_code(Connection *conn, int type, int code);
+void turn_away(Connection *conn, int type, int code, uint64_t waitMs, MetricCounter reason);
+void shed_connection(int fd);
+int retry_after_ms(uint64_t waitMs);
+uint64_t auth_wait_ms();
+void finish_connection(Connection *conn);
+void close_connection(Connection *conn);
+void connection_lost(Connection *conn);
+void abandon_game(Connection *conn);
+void reap_connections();
+void arm_login_timer(Connection *conn);
+void login_timed_out(void *data);
+void process_input(Connection *conn);
+void handle_message(Connection *conn, int type, Payload *payload);
+
+// Shard functions
+void post_mail(Shard *to, Task *task, Ticket *pair, Connection *conn);
+void read_mailbox();
+void move_connection(Connection *conn, Shard *to);
+void detach_connection(Connection *conn, Shard *to);
+void adopt_connection(Connection *conn);
+void hand_over();
+
+// Matchmaking functions
+int start_matchmaker();
+void *matcher(void *ptr);
+int match_bucket(Bucket *bucket, Ticket **matched);
+int match_across(Bucket *lower, Bucket *upper, uint64_t now, Ticket **matched);
+int match_bot(Bucket *bucket, uint64_t now, Ticket **matched);
+void join_matchmaking(Connection *conn);
+void leave_matchmaking(Connection *conn);
+void match_completions(Ticket *pairs);
+void release_partner(Ticket *pair);
+int skill_band(const PlayerRecord *player);
+uint64_t now_ms();
+
+// Game functions
+void player_authenticated(Connection *conn);
+void choose_board_size(Connection *conn, Payload *payload);
+void construct_game(void *object);
+Game *create_game(Connection *conn1, Connection *conn2, const BoardGeometry *geo);
+void start_game(Game *game);
+void send_game_start(Game *game, Connection *conn);
+void start_bot_game(Connection *conn);
+void start_turn(Game *game);
+void prompt_turn(Game *game);
+void clock_expired(void *data);
+void handle_game(Game *game, Connection *conn, Payload *payload);
+void end_game(Game *game);
+void report_result(Game *game);
+int solve_vcf(const BoardGeometry *geo, const void *board, int color, VcfResult *result);
+void send_hint(Game *game, Connection *conn);
+void claim_win(Game *game, Connection *conn);
+int adjudicate_abandoned(Game *game, Connection *stayer);
+void forfeit_abandoned(Game *game, Connection *stayer);
+void send_result(Connection *conn, Outcome outcome, const PlayerRecord *first, const PlayerScore *firstScore,
+                 const PlayerRecord *second, const PlayerScore *secondScore);
+void result_frame(Frame *frame, Outcome outcome, const PlayerRecord *first, const PlayerScore *firstScore,
+                  const PlayerRecord *second, const PlayerScore *secondScore);
+void initializeBoard(Game *game);
+void sendBoard(Game *game, Connection *conn);
+void sendMove(Game *game, Connection *conn);
+int checkMove(Game *game);
+void placeStone(Game *game);
+int checkWin(Game *game);
+
+// Spectator functions
+void spectate(Connection *conn, Payload *payload);
+Game *find_game(const char *name);
+Shard *find_game_shard(const char *name);
+void leave_spectating(Connection *conn);
+void end_spectating(Game *game);
+SharedFrame *share_frame(Frame *frame);
+void release_frame(SharedFrame *shared);
+SharedFrame *game_snapshot(Game *game);
+void broadcast(Game *game, Frame *frame, int final);
+void spectator_push(Connection *conn, SharedFrame *shared, int final);
+
+// Session functions
+void send_session(Connection *conn, int resuming);
+void resume_session(Connection *conn, Payload *payload);
+void take_seat(Connection *conn, Connection *seat);
+void add_seat(Connection *conn);
+void remove_seat(Connection *conn);
+pthread_mutex_t *seat_lock(uint64_t player);
+Connection *find_seat(uint64_t player);
+Shard *find_seat_shard(uint64_t player);
+void park_seat(Connection *conn);
+void unpark_seat(Connection *conn);
+void seat_expired(void *data);
+
+// Authentication functions
+void greet_client(Connection *conn, Payload *payload);
+void register_player(Connection *conn, Payload *payload);
+void finish_registration(Connection *conn, AuthJob *job);
+void login_player(Connection *conn, Payload *payload);
+char* encrypt_password(const char *password, struct crypt_data *data);
+
+// Password hashing on the worker pool
+void start_auth(Connection *conn, AuthKind kind, PlayerRecord *player);
+void run_auth(Task *task);
+void auth_complete(Task *task);
+
+// Bot moves on the worker pool
+int start_bot_pool(int nThreads, int moveMs, const char *dir);
+void start_bot_move(Game *game, Connection *bot);
+void run_bot_move(Task *task);
+void bot_move(Task *task);
+
+// Metrics
+void server_gauges(MetricsBuffer *out);
+
+int main(int argc, char *argv[]) {
+    const char *data_dir = ".";
+    const char *metrics_port = NULL;
+    long max_games = DEFAULT_MAX_GAMES;
+    int ai_threads = DEFAULT_AI_THREADS;
+    int ai_move_ms = DEFAULT_AI_MOVE_MS;
+    long auths_per_worker = AUTHS_PER_WORKER;
+    long queue_depth = TASK_QUEUE_DEPTH;
+    int sessions_given = FALSE;
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    
+    if (nCores <= 0) nCores = 1;
+    n_shards = (int)nCores;
+    admission.maxSessions = DEFAULT_MAX_SESSIONS;
+    admission.maxAuths = -1;  // per worker unless given
+    while ((opt = getopt(argc, argv, "a:c:d:g:l:m:n:q:r:s:t:")) != -1) {
+        switch (opt) {
+            case 'd':
+                data_dir = optarg;
+                break;
+            case 'g':
+                max_games = atol(optarg);
+                break;
+            case 'm':
+                metrics_port = optarg;
+                break;
+            case 'n':
+                n_shards = atoi(optarg);
+                if (n_shards <= 0 || n_shards > 1024) argc = 0;
+                break;
+            case 'a':
+                ai_threads = atoi(optarg);
+                break;
+            case 't':
+                ai_move_ms = atoi(optarg);
+                break;
+            case 'r':
+                resume_seconds = atoi(optarg);
+                if (resume_seconds < 0 || resume_seconds > 65535) resume_seconds = 0;
+                break;
+            case 's':
+                admission.maxSessions = atol(optarg);
+                if (admission.maxSessions < 0) argc = 0;
+                sessions_given = TRUE;
+                break;
+            case 'l':
+                admission.maxAuths = atol(optarg);
+                if (admission.maxAuths < 0) argc = 0;
+                break;
+            case 'q':
+                queue_depth = atol(optarg);
+                if (queue_depth <= 0 || queue_depth > (1 << 20)) argc = 0;
+                break;
+            case 'c':
+                // seconds per move[/seconds per player per game]
+                if (sscanf(optarg, "%d/%d", &move_seconds, &game_seconds) < 1) argc = 0;
+                if (move_seconds < 0) move_seconds = 0;
+                if (game_seconds < 0) game_seconds = 0;
+                break;
+            default:
+                argc = 0;  // print usage
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    
+    if (argc != 1 && argc != 2) {
+        fprintf(stderr, "Usage: gomoku-server [-d data dir] [-g max games] [-m metrics port] [-a bot threads, 0 for none]\n"
+                        "                     [-t bot ms per move] [-r seconds to resume a dropped game, 0 for none]\n"
+                        "                     [-n reactor shards, one per core by default]\n"
+                        "                     [-c seconds per move[/seconds per player per game], 0 for no limit]\n"
+                        "                     [-s max connections] [-l max logins being checked] [-q hashing queue per shard]\n"
+                        "                     port [board size: 8|15|19]\n");
+        return 1;
+    }
+    
+    board_geo = findBoardGeometry(argc == 2 ? atoi(argv[1]) : DEFAULT_BOARD_SIZE);
+    if (board_geo == NULL) {
+        fprintf(stderr, "Unsupported board size %s\n", argv[1]);
+        return 1;
+    }
+    
+    // Every game slot fits the largest board, so any slot serves any size
+    if (max_games <= 0 || max_games > 1000000 ||
+        slab_init(&game_slab, sizeof(Game) + BOARD_BYTES_MAX, (uint32_t)max_games, construct_game) == -1) {
+        fprintf(stderr, "Failed to reserve room for %ld games\n", max_games);
+        return 1;
+    }
+    
+    initialize_scoreboard();
+    if (open_player_store(data_dir) == -1) {
+        fprintf(stderr, "Failed to open player store in %s\n", data_dir);
+        return 1;
+    }
+    if (open_game_log(data_dir) == -1) {
+        fprintf(stderr, "Failed to open the game log in %s\n", data_dir);
+        return 1;
+    }
+    if (new_session_key(session_key) == -1) {
+        fprintf(stderr, "Failed to draw a session key\n");
+        return 1;
+    }
+    // Every session holds a descriptor, so the cap has to leave room for
+    // the rest; past the limit accept fails and nobody is told to retry
+    long fd_limit = raise_fd_limit() - FD_RESERVE - 4 * n_shards;
+    if (fd_limit > 0 && (admission.maxSessions == 0 || admission.maxSessions > fd_limit)) {
+        if (sessions_given && admission.maxSessions > fd_limit) {
+            fprintf(stderr, "Warning: -s %ld is over the descriptor limit, using %ld\n", admission.maxSessions, fd_limit);
+        }
+        admission.maxSessions = fd_limit;
+    }
+    for (int i = 0; i < SEAT_LOCKS; i++) {
+        pthread_mutex_init(&seats.locks[i], NULL);
+    }
+    
+    // One task queue per shard, one worker per core
+    uint32_t depth = 1;
+    while (depth < queue_depth) depth <<= 1;
+    if (admission.maxAuths < 0) admission.maxAuths = auths_per_worker * nCores;
+    if (pool_start(&work_pool, n_shards, depth, (int)nCores) == -1) {
+        fprintf(stderr, "Failed to start the worker pool\n");
+        return 1;
+    }
+    vcf_cache = vcfCreateCache(VCF_CACHE_MB);
+    if (vcf_cache == NULL) {
+        fprintf(stderr, "Failed to allocate the solver cache\n");
+        return 1;
+    }
+    if (ai_threads > 0 && start_bot_pool(ai_threads, ai_move_ms > 0 ? ai_move_ms : DEFAULT_AI_MOVE_MS, data_dir) == -1) {
+        fprintf(stderr, "Failed to start the bot\n");
+        return 1;
+    }
+    if (start_matchmaker() == -1) {
+        fprintf(stderr, "Failed to start matchmaker\n");
+        return 1;
+    }
+    
+    if (metrics_port != NULL && start_metrics_server(metrics_port, server_gauges) == -1) {
+        fprintf(stderr, "Failed to serve metrics on port %s\n", metrics_port);
+        return 1;
+    }
+    
+    shards = (Shard *)calloc(n_shards, sizeof(Shard));
+    if (shards == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    for (int i = 0; i < n_shards; i++) {
+        if (start_shard(&shards[i], i, argv[0]) == -1) {
+            fprintf(stderr, "Failed to start server\n");
+            return 1;
+        }
+    }
+    
+    printf("Server started on port %s (%dx%d board, up to %ld games in %zu KiB, %d shards)\n", argv[0],
+           board_geo->size, board_geo->size, max_games, game_slab.slotSize * game_slab.capacity / 1024, n_shards);
+    printf("Waiting for clients...\n");
+    
+    // Shard 0 runs on this thread
+    for (int i = 1; i < n_shards; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, run_reactor, &shards[i]) != 0) {
+            fprintf(stderr, "Failed to start shard %d\n", i);
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    run_reactor(&shards[0]);
+    return 0;
+}
+
+// Opens the shard's own listener on the shared port and the epoll set that
+// watches it and the mailbox; 0 on success
+int start_shard(Shard *shard, int index, char *port) {
+    struct epoll_event ev;
+    
+    shard->index = index;
+    pthread_mutex_init(&shard->lock, NULL);
+    timer_wheel_init(&shard->wheel, now_ms());
+    shard->listenFd = start_server(NULL, port, LISTEN_BACKLOG);
+    shard->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    shard->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shard->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (shard->listenFd == -1 || shard->epollFd == -1 || shard->wakeFd == -1 || shard->spareFd == -1) {
+        perror("shard");
+        return -1;
+    }
+    
+    // The listening socket is registered with a NULL connection
+    set_nonblocking(shard->listenFd);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, shard->listenFd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    
+    // Finished jobs, pairs from the matcher and connections from other
+    // shards are announced on the shard's eventfd
+    ev.events = EPOLLIN;
+    ev.data.ptr = shard;
+    if (epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, shard->wakeFd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+void *run_reactor(void *ptr) {
+    struct epoll_event events[MAX_EVENTS];
+    
+    reactor = (Shard *)ptr;
+    while (1) {
+        int n = epoll_wait(reactor->epollFd, events, MAX_EVENTS, timer_timeout(&reactor->wheel, now_ms()));
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            Connection *conn = (Connection *)events[i].data.ptr;
+            if (conn == NULL) {
+                accept_clients(reactor->listenFd);
+                continue;
+            }
+            if (events[i].data.ptr == reactor) {
+                read_mailbox();
+                continue;
+            }
+            // An earlier event in this batch may have closed, parked or moved it
+            if (conn->state == CONN_CLOSED || conn->state == CONN_PARKED || conn->state == CONN_MOVING) continue;
+            
+            if (events[i].events & EPOLLOUT) {
+                flush_connection(conn);
+            }
+            if (conn->state != CONN_CLOSED && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                read_connection(conn);
+            }
+        }
+        timer_advance(&reactor->wheel, now_ms());
+        flush_dirty();
+        hand_over();
+        reap_connections();
+    }
+    
+    close(reactor->epollFd);
+    return NULL;
+}
+
+// Soft limit raised to the hard one; the resulting limit, or LONG_MAX if there is none
+long raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1) return LONG_MAX;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1) getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > LONG_MAX) ? LONG_MAX : (long)rl.rlim_cur;
+}
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void accept_clients(int serv_socket) {
+    struct epoll_event ev;
+    int client_fd, one = 1;
+    
+    while (1) {
+        if ((client_fd = accept_client(serv_socket)) == -1) {
+            if (errno == EMFILE || errno == ENFILE) {
+                if (accept_overflow(serv_socket) == 0) continue;
+            }
+            break;
+        }
+        // The slot is taken before the check, so shards accepting at the
+        // same time cannot all slip in under the cap
+        long open_sessions = atomic_fetch_add(&admission.sessions, 1);
+        if (admission.maxSessions > 0 && open_sessions >= admission.maxSessions) {
+            atomic_fetch_sub(&admission.sessions, 1);
+            shed_connection(client_fd);
+            continue;
+        }
+        Connection *conn = (Connection *)calloc(1, sizeof(Connection));
+        if (conn == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            close(client_fd);
+            atomic_fetch_sub(&admission.sessions, 1);
+            continue;
+        }
+        conn->fd = client_fd;
+        conn->state = CONN_HELLO;
+        conn->shard = reactor;
+        metrics_count(METRIC_ACCEPTS, 1);
+        // Each update already leaves in one write; Nagle would only hold
+        // the next one back until this one is acknowledged
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            perror("epoll_ctl");
+            close(client_fd);
+            free(conn);
+            metrics_count(METRIC_CONNECTIONS_CLOSED, 1);
+            atomic_fetch_sub(&admission.sessions, 1);
+            continue;
+        }
+        // The client speaks first, with its protocol version
+        arm_login_timer(conn);
+    }
+}
+
+// Out of descriptors with connections waiting: the listener stays readable,
+// so each one is taken with the spare descriptor and told to come back
+// later. 0 if one was shed; otherwise the listener rests for a moment
+// rather than waking the reactor for nothing.
+int accept_overflow(int serv_socket) {
+    struct epoll_event ev;
+    int client_fd = -1;
+
+    if (reactor->spareFd >= 0) {
+        close(reactor->spareFd);
+        client_fd = accept_client(serv_socket);
+        if (client_fd >= 0) shed_connection(client_fd);
+        reactor->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (client_fd >= 0) return 0;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+    }
+    ev.events = 0;
+    ev.data.ptr = NULL;
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_MOD, serv_socket, &ev);
+    timer_arm(&reactor->wheel, &reactor->listenTimer, now_ms(), ACCEPT_PAUSE_MS, resume_listener, reactor);
+    return -1;
+}
+
+void resume_listener(void *data) {
+    Shard *shard = (Shard *)data;
+    struct epoll_event ev;
+
+    if (shard->spareFd == -1) shard->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(shard->epollFd, EPOLL_CTL_MOD, shard->listenFd, &ev);
+}
+
+// Appends what the socket has to the input buffer and handles every whole
+// frame in it; a trailing partial frame waits for the next read
+void read_connection(Connection *conn) {
+    ssize_t received = recv(conn->fd, conn->in + conn->inLen, sizeof(conn->in) - conn->inLen, 0);
+    
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (received <= 0) {
+        connection_lost(conn);
+        return;
+    }
+    conn->inLen += received;
+    arm_login_timer(conn);
+    
+    // Input after we decided to hang up is ignored
+    if (conn->closing) {
+        conn->inLen = 0;
+        return;
+    }
+    process_input(conn);
+    
+    // A full buffer that could not be consumed is a client ignoring the protocol
+    if (conn->state != CONN_CLOSED && conn->state != CONN_MOVING && conn->inLen == sizeof(conn->in)) {
+        conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+        finish_connection(conn);
+        conn->inLen = 0;
+    }
+}
+
+// Handles buffered frames until the buffer runs dry or the connection has
+// to wait; frames sent while a password is hashed are kept for afterwards,
+// and a frame that sends the connection to another shard is handled there
+void process_input(Connection *conn) {
+    size_t offset = 0;
+    
+    while (conn->state != CONN_CLOSED && !conn->closing && conn->state != CONN_AUTHENTICATING &&
+           conn->state != CONN_MOVING) {
+        long len = frameLength(conn->in + offset, conn->inLen - offset);
+        if (len == 0) break;
+        if (len < 0) {
+            conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+            finish_connection(conn);
+            offset = conn->inLen;
+            break;
+        }
+        Payload payload = framePayload(conn->in + offset, len);
+        int type = frameType(conn->in + offset);
+        handle_message(conn, type, &payload);
+        if (conn->state == CONN_MOVING) break;
+        offset += len;
+    }
+    if (conn->state == CONN_CLOSED || conn->closing) {
+        conn->inLen = 0;
+        return;
+    }
+    memmove(conn->in, conn->in + offset, conn->inLen - offset);
+    conn->inLen -= offset;
+}
+
+void handle_message(Connection *conn, int type, Payload *payload) {
+    switch (conn->state) {
+        case CONN_HELLO:
+            if (type == MSG_HELLO) {
+                greet_client(conn, payload);
+                return;
+            }
+            break;
+        case CONN_MENU:
+            if (type == MSG_SPECTATE) {
+                spectate(conn, payload);
+                return;
+            }
+            if (type == MSG_LOGIN) {
+                login_player(conn, payload);
+                return;
+            }
+            if (type == MSG_RESUME) {
+                resume_session(conn, payload);
+                return;
+            }
+            if (type == MSG_REGISTER) {
+                register_player(conn, payload);
+                return;
+            }
+            break;
+        case CONN_CHOOSING_SIZE:
+            if (type == MSG_BOARD_SIZE) {
+                choose_board_size(conn, payload);
+                return;
+            }
+            if (type == MSG_SPECTATE) {
+                spectate(conn, payload);
+                return;
+            }
+            break;
+        case CONN_SPECTATING:
+            if (type == MSG_RESYNC) {
+                if (conn->watching != NULL) spectator_push(conn, game_snapshot(conn->watching), FALSE);
+                return;
+            }
+            break;
+        case CONN_PLAYING:
+            if (type == MSG_MOVE) {
+                handle_game(conn->game, conn, payload);
+                return;
+            }
+            if (type == MSG_RESYNC) {
+                sendBoard(conn->game, conn);
+                return;
+            }
+            if (type == MSG_HINT) {
+                send_hint(conn->game, conn);
+                return;
+            }
+            if (type == MSG_ADJUDICATE) {
+                claim_win(conn->game, conn);
+                return;
+            }
+            break;
+        default:
+            return;  // waiting for an opponent
+    }
+    conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+    finish_connection(conn);
+}
+
+// Queues the bytes behind whatever the connection already has pending.
+// Nothing is written until the end of the batch of events, so the move,
+// the prompt and the result of one update leave in a single write.
+void conn_send(Connection *conn, const char *data, size_t len) {
+    if (conn->bot) return;  // reads the game directly
+    
+    if (conn->state == CONN_CLOSED || conn->state == CONN_PARKED) return;
+    
+    // Behind shared frames, so it goes out after them
+    if (conn->nShared > 0) {
+        SharedFrame *shared = (SharedFrame *)malloc(sizeof(SharedFrame) + len);
+        if (shared == NULL) return;
+        shared->refs = 1;
+        shared->len = len;
+        memcpy(shared->data, data, len);
+        spectator_push(conn, shared, TRUE);
+        release_frame(shared);
+        return;
+    }
+    
+    // Callers may be in the middle of a game step, so a hopeless client is
+    // shut down here and cleaned up when the reactor reads the hangup
+    if (conn->outLen + len > MAX_PENDING_OUTPUT) {
+        metrics_count(METRIC_SEND_FAILURES, 1);
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+    if (conn->outLen + len > conn->outCap) {
+        size_t cap = conn->outCap ? conn->outCap : 1024;
+        while (cap < conn->outLen + len) cap *= 2;
+        char *out = (char *)realloc(conn->out, cap);
+        if (out == NULL) {
+            shutdown(conn->fd, SHUT_RDWR);
+            return;
+        }
+        conn->out = out;
+        conn->outCap = cap;
+    }
+    memcpy(conn->out + conn->outLen, data, len);
+    conn->outLen += len;
+    schedule_flush(conn);
+}
+
+void conn_send_frame(Connection *conn, Frame *frame) {
+    size_t len = frameEnd(frame);
+    if (len > 0) conn_send(conn, (const char *)frame->data, len);
+}
+
+// Sends one of the messages whose payload is a single code byte
+void conn_send_code(Connection *conn, int type, int code) {
+    Frame frame;
+    frameBegin(&frame, type);
+    framePutU8(&frame, code);
+    conn_send_frame(conn, &frame);
+}
+
+// Tells the client the server is busy and when to try again, and hangs up
+void turn_away(Connection *conn, int type, int code, uint64_t waitMs, MetricCounter reason) {
+    Frame frame;
+    frameBegin(&frame, type);
+    framePutU8(&frame, code);
+    framePutU16(&frame, retry_after_ms(waitMs));
+    conn_send_frame(conn, &frame);
+    metrics_count(reason, 1);
+    finish_connection(conn);
+}
+
+// Answers a client over the session cap without taking it on: the busy
+// error is written straight to the new socket, which is closed at once.
+// What the client sent already is read and dropped first, as closing with
+// unread input resets the connection and the answer with it.
+void shed_connection(int fd) {
+    char scratch[PROTO_MAX_FRAME];
+    Frame frame;
+    
+    frameBegin(&frame, MSG_ERROR);
+    framePutU8(&frame, ERR_BUSY);
+    framePutU16(&frame, retry_after_ms(RETRY_BUSY_MS));
+    size_t len = frameEnd(&frame);
+    send(fd, frame.data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    metrics_count(METRIC_SOCKET_WRITES, 1);
+    metrics_count(METRIC_SHED_SESSIONS, 1);
+    shutdown(fd, SHUT_WR);
+    while (recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT) > 0) {
+    }
+    close(fd);
+}
+
+// Somewhere between waitMs and twice that, so the clients turned away in
+// one burst do not all come back in the next
+int retry_after_ms(uint64_t waitMs) {
+    static __thread uint64_t seed;   // xorshift64*, per reactor
+    
+    if (seed == 0) seed = metrics_now() | 1;
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    if (waitMs < RETRY_MIN_MS) waitMs = RETRY_MIN_MS;
+    if (waitMs > RETRY_MAX_MS) waitMs = RETRY_MAX_MS;
+    return (int)(waitMs + seed * 2685821657736338717ULL % (waitMs + 1));
+}
+
+// Writes what is pending, and waits for EPOLLOUT while the socket takes
+// only part of it
+void flush_connection(Connection *conn) {
+    if (write_pending(conn) == -1) {
+        metrics_count(METRIC_SEND_FAILURES, 1);
+        connection_lost(conn);
+        return;
+    }
+    if (conn->outLen == 0 && conn->nShared == 0) {
+        if (conn->closing) {
+            close_connection(conn);
+            return;
+        }
+        if (conn->wantWrite) watch_output(conn, FALSE);
+    } else if (!conn->wantWrite) {
+        watch_output(conn, TRUE);
+    }
+}
+
+void schedule_flush(Connection *conn) {
+    if (conn->dirty) return;
+    conn->dirty = TRUE;
+    conn->nextDirty = reactor->dirty;
+    reactor->dirty = conn;
+}
+
+// End of the batch: one write for each connection that got output. One
+// already waiting for EPOLLOUT is written when that comes.
+void flush_dirty() {
+    while (reactor->dirty != NULL) {
+        Connection *conn = reactor->dirty;
+        reactor->dirty = conn->nextDirty;
+        conn->dirty = FALSE;
+        if (conn->state == CONN_CLOSED || conn->state == CONN_PARKED || conn->state == CONN_MOVING) continue;
+        if (!conn->wantWrite) flush_connection(conn);
+    }
+}
+
+void watch_output(Connection *conn, int on) {
+    struct epoll_event ev;
+    
+    ev.events = on ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.ptr = conn;
+    metrics_count(METRIC_POLL_CHANGES, 1);
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->wantWrite = on;
+}
+
+// Closes the connection after its queued output has been written
+void finish_connection(Connection *conn) {
+    if (conn->state == CONN_CLOSED) return;
+    if (conn->outLen == 0 && conn->nShared == 0) {
+        close_connection(conn);
+    } else {
+        conn->closing = TRUE;
+    }
+}
+
+void close_connection(Connection *conn) {
+    if (conn->state == CONN_CLOSED) return;
+    if (conn->state == CONN_PARKED) {
+        unpark_seat(conn);  // the socket went when it was parked
+    } else if (!conn->bot) {
+        // Last words, such as the error that closed it, go if the socket takes them
+        if (conn->outLen > 0 || conn->nShared > 0) write_pending(conn);
+        leave_matchmaking(conn);
+        leave_spectating(conn);
+        epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        metrics_count(METRIC_CONNECTIONS_CLOSED, 1);
+        atomic_fetch_sub(&admission.sessions, 1);
+    }
+    remove_seat(conn);
+    timer_cancel(&reactor->wheel, &conn->timer);
+    conn->state = CONN_CLOSED;
+    explicit_bzero(conn->password, sizeof(conn->password));
+    
+    // A pending AuthJob or BotJob or a matched ticket still refers to it;
+    // it is freed when that comes back to its shard
+    if (conn->authPending || conn->searching || conn->ticket != NULL) return;
+    conn->nextClosed = reactor->closed;
+    reactor->closed = conn;
+}
+
+// The peer hung up or the socket failed. Mid-game the seat is kept for the
+// player to RESUME.
+void connection_lost(Connection *conn) {
+    Game *game = conn->game;
+    
+    if (game != NULL && game->nMoves > 0 && !game->gameOver && conn->state == CONN_PLAYING && !conn->closing &&
+        resume_seconds > 0) {
+        park_seat(conn);
+    } else if (game != NULL) {
+        abandon_game(conn);
+    } else {
+        close_connection(conn);
+    }
+}
+
+// The player is gone for good. Before the first move the opponent goes back
+// to the queue and keeps its place; after that the game ends for both
+// players as a win for the one who stayed, adjudicated if it can force one
+// and forfeited otherwise.
+void abandon_game(Connection *conn) {
+    Game *game = conn->game;
+    Connection *other = (game->player1_conn == conn) ? game->player2_conn : game->player1_conn;
+    
+    close_connection(conn);
+    if (game->nMoves == 0 && other->state != CONN_CLOSED && !other->closing && !other->bot) {
+        end_game(game);
+        conn_send_code(other, MSG_WAITING, TRUE);
+        join_matchmaking(other);
+    } else if (other->state != CONN_CLOSED && !other->closing && adjudicate_abandoned(game, other)) {
+        finish_connection(other);
+        end_game(game);
+    } else if (game->nMoves > 0 && !game->gameOver) {
+        forfeit_abandoned(game, other);
+        finish_connection(other);
+        end_game(game);
+    } else {
+        close_connection(other);
+        end_game(game);
+    }
+}
+
+void reap_connections() {
+    while (reactor->closed != NULL) {
+        Connection *conn = reactor->closed;
+        reactor->closed = conn->nextClosed;
+        free(conn->out);
+        free(conn);
+    }
+}
+
+// Until a client is queued, playing or watching, every message it sends
+// buys it LOGIN_IDLE_MS more
+void arm_login_timer(Connection *conn) {
+    if (conn->state != CONN_HELLO && conn->state != CONN_MENU && conn->state != CONN_AUTHENTICATING &&
+        conn->state != CONN_CHOOSING_SIZE) {
+        return;
+    }
+    timer_arm(&reactor->wheel, &conn->timer, now_ms(), LOGIN_IDLE_MS, login_timed_out, conn);
+}
+
+void login_timed_out(void *data) {
+    Connection *conn = (Connection *)data;
+    
+    metrics_count(METRIC_LOGIN_TIMEOUTS, 1);
+    conn_send_code(conn, MSG_ERROR, ERR_TIMEOUT);
+    finish_connection(conn);
+}
+
+// Leaves a finished task, a pair or a connection for the shard and wakes
+// it; any thread
+void post_mail(Shard *to, Task *task, Ticket *pair, Connection *conn) {
+    metrics_lock(&to->lock, METRIC_WAIT_SHARD);
+    if (task != NULL) {
+        task->next = to->done;
+        to->done = task;
+    }
+    if (pair != NULL) {
+        pair->next = to->matched;
+        to->matched = pair;
+    }
+    if (conn != NULL) {
+        conn->nextMoving = to->arriving;
+        to->arriving = conn;
+    }
+    pthread_mutex_unlock(&to->lock);
+    
+    uint64_t one = 1;
+    if (write(to->wakeFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror("eventfd write");
+    }
+}
+
+// Runs when the shard's eventfd fires
+void read_mailbox() {
+    uint64_t count;
+    if (read(reactor->wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+    
+    metrics_lock(&reactor->lock, METRIC_WAIT_SHARD);
+    Connection *arriving = reactor->arriving;
+    Task *done = reactor->done;
+    Ticket *matched = reactor->matched;
+    reactor->arriving = NULL;
+    reactor->done = NULL;
+    reactor->matched = NULL;
+    pthread_mutex_unlock(&reactor->lock);
+    
+    while (arriving != NULL) {
+        Connection *conn = arriving;
+        arriving = conn->nextMoving;
+        adopt_connection(conn);
+        // The message it moved for is still first in its buffer
+        conn->arrived = TRUE;
+        process_input(conn);
+    }
+    while (done != NULL) {
+        Task *task = done;
+        done = task->next;
+        task->done(task);
+    }
+    match_completions(matched);
+}
+
+// Sends the connection to the shard with the game or seat it asked for,
+// where the message is handled again. It leaves after the current batch,
+// once no event for it can still be pending here.
+void move_connection(Connection *conn, Shard *to) {
+    detach_connection(conn, to);
+    conn->nextMoving = reactor->moving;
+    reactor->moving = conn;
+}
+
+// Takes the connection off this shard; it is nobody's until to adopts it
+void detach_connection(Connection *conn, Shard *to) {
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    timer_cancel(&reactor->wheel, &conn->timer);
+    conn->arrivingAs = conn->state;
+    conn->state = CONN_MOVING;
+    conn->shard = to;
+    metrics_count(METRIC_HANDOFFS, 1);
+}
+
+void adopt_connection(Connection *conn) {
+    struct epoll_event ev;
+    
+    conn->shard = reactor;
+    conn->state = conn->arrivingAs;
+    conn->dirty = FALSE;
+    conn->wantWrite = FALSE;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, conn->fd, &ev) == -1) {
+        perror("epoll_ctl");
+        close_connection(conn);
+        return;
+    }
+    arm_login_timer(conn);
+    if (conn->outLen > 0 || conn->nShared > 0) schedule_flush(conn);
+}
+
+// Posts the connections and pairs leaving this shard, now that the batch
+// that might still have referred to them is done
+void hand_over() {
+    while (reactor->moving != NULL) {
+        Connection *conn = reactor->moving;
+        reactor->moving = conn->nextMoving;
+        post_mail(conn->shard, NULL, NULL, conn);
+    }
+    while (reactor->forwarding != NULL) {
+        Ticket *pair = reactor->forwarding;
+        reactor->forwarding = pair->next;
+        post_mail(pair->conn->shard, NULL, pair, NULL);
+    }
+}
+
+// Reentrant: each worker thread passes its own crypt_data
+char* encrypt_password(const char *password, struct crypt_data *data) {
+    // Use a fixed salt for simplicity (in production, use unique salts per user)
+    static const char *salt = "$6$rounds=5000$randomsaltstring";
+    return crypt_r(password, salt, data);
+}
+
+// Checks the protocol version the client opened with
+void greet_client(Connection *conn, Payload *payload) {
+    unsigned int version = payloadU8(payload);
+    
+    if (payload->error || version != PROTO_VERSION) {
+        conn_send_code(conn, MSG_ERROR, ERR_VERSION);
+        finish_connection(conn);
+        return;
+    }
+    
+    Frame frame;
+    frameBegin(&frame, MSG_WELCOME);
+    framePutU8(&frame, PROTO_VERSION);
+    framePutU8(&frame, board_geo->size);
+    conn_send_frame(conn, &frame);
+    conn->state = CONN_MENU;
+}
+
+// Registration carries email, password and first name; the client logs in
+// with a separate message once it is accepted
+void register_player(Connection *conn, Payload *payload) {
+    payloadString(payload, conn->email, sizeof(conn->email));
+    payloadString(payload, conn->password, sizeof(conn->password));
+    payloadString(payload, conn->name, sizeof(conn->name));
+    if (payload->error || conn->email[0] == '\0' || conn->password[0] == '\0' || conn->name[0] == '\0') {
+        explicit_bzero(conn->password, sizeof(conn->password));
+        conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+        finish_connection(conn);
+        return;
+    }
+    
+    // Encrypt password off the reactor; auth_complete finishes the registration
+    start_auth(conn, AUTH_REGISTER, NULL);
+}
+
+// Adds the account once its password hash is ready
+void finish_registration(Connection *conn, AuthJob *job) {
+    if (!job->ok) {
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_FAILED);
+        finish_connection(conn);
+        return;
+    }
+    
+    // Add to scoreboard
+    int result = add_player_to_scoreboard(conn->email, job->hash, conn->name);
+    
+    if (result == 0) {
+        metrics_count(METRIC_REGISTRATIONS, 1);
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_OK);
+        conn->state = CONN_MENU;
+    } else if (result == -1) {
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_TAKEN);
+        finish_connection(conn);
+    } else {
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_FULL);
+        finish_connection(conn);
+    }
+}
+
+void login_player(Connection *conn, Payload *payload) {
+    payloadString(payload, conn->email, sizeof(conn->email));
+    payloadString(payload, conn->password, sizeof(conn->password));
+    if (payload->error) {
+        explicit_bzero(conn->password, sizeof(conn->password));
+        conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+        finish_connection(conn);
+        return;
+    }
+    
+    // Verify credentials; the hash comparison runs on the worker pool
+    PlayerRecord *player = find_player_by_email(conn->email);
+    
+    if (player != NULL) {
+        start_auth(conn, AUTH_LOGIN, player);
+        return;
+    }
+    
+    explicit_bzero(conn->password, sizeof(conn->password));
+    metrics_count(METRIC_LOGIN_FAILURES, 1);
+    conn_send_code(conn, MSG_AUTH_RESULT, AUTH_INVALID);
+    finish_connection(conn);
+}
+
+// Queues the connection's password for hashing on its shard's queue, or
+// turns the client away when too many are waiting or the queue is full
+void start_auth(Connection *conn, AuthKind kind, PlayerRecord *player) {
+    if (admission.maxAuths > 0 && atomic_load(&admission.auths) >= admission.maxAuths) {
+        explicit_bzero(conn->password, sizeof(conn->password));
+        turn_away(conn, MSG_AUTH_RESULT, AUTH_BUSY, auth_wait_ms(), METRIC_SHED_LOGINS);
+        return;
+    }
+    
+    AuthJob *job = (AuthJob *)calloc(1, sizeof(AuthJob));
+    if (job == NULL) {
+        explicit_bzero(conn->password, sizeof(conn->password));
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_BUSY);
+        finish_connection(conn);
+        return;
+    }
+    job->task.run = run_auth;
+    job->task.done = auth_complete;
+    job->shard = reactor;
+    job->kind = kind;
+    job->conn = conn;
+    job->player = player;
+    memcpy(job->password, conn->password, sizeof(job->password));
+    explicit_bzero(conn->password, sizeof(conn->password));
+    if (player != NULL) {
+        // Never changes once the account is in the store
+        memcpy(job->expected, player->password, sizeof(job->expected));
+    }
+    job->queuedAt = metrics_now();
+    
+    if (pool_submit(&work_pool, reactor->index, &job->task) == -1) {
+        explicit_bzero(job->password, sizeof(job->password));
+        free(job);
+        turn_away(conn, MSG_AUTH_RESULT, AUTH_BUSY, auth_wait_ms(), METRIC_SHED_QUEUE);
+        return;
+    }
+    atomic_fetch_add(&admission.auths, 1);
+    conn->authPending = TRUE;
+    conn->state = CONN_AUTHENTICATING;
+}
+
+// Runs on whichever worker takes the job; the answer goes back to the
+// job's shard
+void run_auth(Task *task) {
+    static __thread struct crypt_data *data;   // each worker's own, made on first use
+    AuthJob *job = (AuthJob *)task;
+    char *encrypted = NULL;
+    
+    if (data == NULL) data = (struct crypt_data *)calloc(1, sizeof(struct crypt_data));
+    if (data != NULL) {
+        uint64_t start = metrics_now();
+        encrypted = encrypt_password(job->password, data);
+        uint64_t ns = metrics_now() - start;
+        metrics_observe(METRIC_CRYPT, ns);
+        // Workers race on the average; a lost update only makes it lag
+        uint64_t average = atomic_load_explicit(&admission.cryptNs, memory_order_relaxed);
+        atomic_store_explicit(&admission.cryptNs, average == 0 ? ns : average - average / 8 + ns / 8,
+                              memory_order_relaxed);
+    }
+    explicit_bzero(job->password, sizeof(job->password));
+    if (job->kind == AUTH_LOGIN) {
+        job->ok = encrypted != NULL && strcmp(encrypted, job->expected) == 0;
+    } else {
+        job->ok = encrypted != NULL && encrypted[0] != '*';
+        if (job->ok) snprintf(job->hash, sizeof(job->hash), "%s", encrypted);
+    }
+    post_mail(job->shard, task, NULL, NULL);
+}
+
+void auth_complete(Task *task) {
+    AuthJob *job = (AuthJob *)task;
+    Connection *conn = job->conn;
+    conn->authPending = FALSE;
+    atomic_fetch_sub(&admission.auths, 1);
+    metrics_observe(METRIC_AUTH, metrics_now() - job->queuedAt);
+    
+    // The client left while its password was being hashed
+    if (conn->state == CONN_CLOSED) {
+        conn->nextClosed = reactor->closed;
+        reactor->closed = conn;
+        free(job);
+        return;
+    }
+    
+    if (job->kind == AUTH_REGISTER) {
+        finish_registration(conn, job);
+    } else if (job->ok) {
+        metrics_count(METRIC_LOGINS, 1);
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_OK);
+        conn->player = job->player;
+        send_session(conn, FALSE);
+        player_authenticated(conn);
+    } else {
+        metrics_count(METRIC_LOGIN_FAILURES, 1);
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_INVALID);
+        finish_connection(conn);
+    }
+    free(job);
+    
+    // Messages the client sent while waiting for the result
+    process_input(conn);
+}
+
+// Time for the passwords already waiting to be hashed, on every worker
+uint64_t auth_wait_ms() {
+    uint64_t perHash = atomic_load_explicit(&admission.cryptNs, memory_order_relaxed);
+    
+    return (uint64_t)atomic_load(&admission.auths) * perHash / work_pool.nWorkers / 1000000;
+}
+
+// The client already knows the default size from the welcome message
+void player_authenticated(Connection *conn) {
+    conn->state = CONN_CHOOSING_SIZE;
+}
+
+// Older clients send only the size; they get whoever comes along
+void choose_board_size(Connection *conn, Payload *payload) {
+    int size = (int)payloadU8(payload);
+    int opponent = payload->len > 0 ? (int)payloadU8(payload) : OPPONENT_ANY;
+    
+    conn->geo = findBoardGeometry(size);
+    if (conn->geo == NULL) {
+        conn->geo = board_geo;
+    }
+    timer_cancel(&reactor->wheel, &conn->timer);
+    if (opponent == OPPONENT_BOT && bot_pool.nThreads > 0) {
+        start_bot_game(conn);
+        return;
+    }
+    conn_send_code(conn, MSG_WAITING, FALSE);
+    join_matchmaking(conn);
+}
+
+// Runs once per slab slot at startup; a slot's lock outlives its games
+void construct_game(void *object) {
+    Game *game = (Game *)object;
+    pthread_mutex_init(&game->lock, NULL);
+    memset(&game->clock, 0, sizeof(game->clock));
+}
+
+// Takes a slot from the game slab and resets it in place; NULL when the
+// server already has as many games as it reserved room for
+Game *create_game(Connection *conn1, Connection *conn2, const BoardGeometry *geo) {
+    SlabStats stats;
+    Game *game = (Game *)slab_alloc(&game_slab);
+    if (game == NULL) return NULL;
+    
+    // Log each new power-of-two high-water mark, once over all shards
+    slab_stats(&game_slab, &stats);
+    long reported = atomic_load(&reported_peak);
+    if (stats.peak > reported && (stats.peak & (stats.peak - 1)) == 0 &&
+        atomic_compare_exchange_strong(&reported_peak, &reported, stats.peak)) {
+        printf("Peak games in play: %ld of %ld (%zu KiB)\n", stats.peak, stats.capacity,
+               stats.peak * stats.slotSize / 1024);
+    }
+    
+    game->geo = geo;
+    game->player1_conn = conn1;
+    game->player2_conn = conn2;
+    game->player1 = conn1->player;
+    game->player2 = conn2->player;
+    conn1->game = game;
+    conn2->game = game;
+    conn1->state = CONN_PLAYING;
+    conn2->state = CONN_PLAYING;
+    if (!conn1->bot) add_seat(conn1);
+    if (!conn2->bot) add_seat(conn2);
+    
+    game->spectators = NULL;
+    game->nSpectators = 0;
+    game->snapshot = NULL;
+    game->livePrev = NULL;
+    metrics_lock(&reactor->lock, METRIC_WAIT_SHARD);
+    game->liveNext = reactor->liveGames;
+    if (reactor->liveGames != NULL) reactor->liveGames->livePrev = game;
+    reactor->liveGames = game;
+    pthread_mutex_unlock(&reactor->lock);
+    return game;
+}
+
+void start_game(Game *game) {
+    metrics_count(METRIC_GAMES_STARTED, 1);
+    send_game_start(game, game->player1_conn);
+    send_game_start(game, game->player2_conn);
+    
+    // Initialize game
+    game->nMoves = 0;
+    game->gameOver = 0;
+    game->stone = 'B';
+    game->startedAt = now_ms();
+    game->clockLeft[0] = game->clockLeft[1] = (uint64_t)game_seconds * 1000;
+    initializeBoard(game);
+    
+    // Send initial board to both players
+    sendBoard(game, game->player1_conn);
+    sendBoard(game, game->player2_conn);
+    
+    start_turn(game);
+}
+
+// Board size, the player's color and both names; player 1 plays B
+void send_game_start(Game *game, Connection *conn) {
+    Frame frame;
+    int white = (conn == game->player2_conn);
+    
+    frameBegin(&frame, MSG_GAME_START);
+    framePutU8(&frame, game->geo->size);
+    framePutU8(&frame, white);
+    framePutString(&frame, white ? game->player2->name : game->player1->name);
+    framePutString(&frame, white ? game->player1->name : game->player2->name);
+    conn_send_frame(conn, &frame);
+}
+
+// The bot is played by a player with no socket: its turn is a search
+// request, and the move comes back through handle_game like anyone's
+void start_bot_game(Connection *conn) {
+    Connection *bot = (Connection *)calloc(1, sizeof(Connection));
+    Game *game = NULL;
+    
+    if (bot != NULL) {
+        bot->fd = -1;
+        bot->bot = TRUE;
+        bot->shard = reactor;
+        bot->player = bot_pool.player;
+        bot->geo = conn->geo;
+        game = create_game(conn, bot, conn->geo);
+    }
+    if (game == NULL) {
+        free(bot);
+        turn_away(conn, MSG_ERROR, ERR_BUSY, RETRY_BUSY_MS, METRIC_SHED_GAMES);
+        return;
+    }
+    start_game(game);
+}
+
+// Starts the clock of the player to move: the move limit or what is left
+// of its game clock, whichever runs out first. The bot is not timed.
+void start_turn(Game *game) {
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    uint64_t limit = move_seconds > 0 ? (uint64_t)move_seconds * 1000 : UINT64_MAX;
+    
+    if (game_seconds > 0 && game->clockLeft[game->stone == 'W'] < limit) {
+        limit = game->clockLeft[game->stone == 'W'];
+    }
+    game->turnStarted = now_ms();
+    game->turnDeadline = 0;
+    timer_cancel(&reactor->wheel, &game->clock);
+    if (!current->bot && limit != UINT64_MAX) {
+        game->turnDeadline = game->turnStarted + limit;
+        timer_arm(&reactor->wheel, &game->clock, game->turnStarted, limit, clock_expired, game);
+    }
+    prompt_turn(game);
+}
+
+// Asks for a move, again after a rejected one or a hint; the clock keeps
+// running from start_turn
+void prompt_turn(Game *game) {
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    Frame frame;
+    
+    if (current->bot) {
+        start_bot_move(game, current);
+        return;
+    }
+    uint64_t now = now_ms();
+    uint64_t left = game->turnDeadline > now ? game->turnDeadline - now : 1;
+    frameBegin(&frame, MSG_YOUR_TURN);
+    framePutU8(&frame, game->stone == 'W');
+    framePutU32(&frame, game->turnDeadline == 0 ? 0 : (uint32_t)(left < UINT32_MAX ? left : UINT32_MAX));
+    conn_send_frame(current, &frame);
+}
+
+// The player to move ran out of time, parked or not. Before the first move
+// that is the same as leaving; after it the game is lost on time.
+void clock_expired(void *data) {
+    Game *game = (Game *)data;
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    
+    metrics_count(METRIC_CLOCK_EXPIRIES, 1);
+    conn_send_code(current, MSG_ERROR, ERR_TIMEOUT);
+    if (game->nMoves == 0) {
+        abandon_game(current);
+        return;
+    }
+    game->stone = (game->stone == 'W') ? 'B' : 'W';
+    game->gameOver = 1;
+    game->record.end = END_TIME;
+    report_result(game);
+    finish_connection(game->player1_conn);
+    finish_connection(game->player2_conn);
+    end_game(game);
+}
+
+// One move from a player; the game loop now runs one step per message.
+// For one move in METRICS_SAMPLE_EVERY each phase is timed.
+void handle_game(Game *game, Connection *conn, Payload *payload) {
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    uint64_t t0 = metrics_sample() ? metrics_now() : 0, t1 = 0, t2 = 0;
+    
+    if (conn != current) {
+        conn_send_code(conn, MSG_ERROR, ERR_NOT_YOUR_TURN);
+        return;
+    }
+    
+    // Parse move
+    game->x = (int)payloadU8(payload);
+    game->y = (int)payloadU8(payload);
+    if (payload->error) {
+        conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+        prompt_turn(game);
+        return;
+    }
+    
+    // Check if move is valid
+    if (t0) t1 = metrics_now();
+    if (checkMove(game) == 1) {
+        metrics_count(METRIC_INVALID_MOVES, 1);
+        conn_send_code(conn, MSG_ERROR, ERR_INVALID_MOVE);
+        prompt_turn(game);
+        return;
+    }
+    
+    // Make move, and stop the mover's clock
+    if (t0) t2 = metrics_now();
+    if (game->turnDeadline != 0 && game_seconds > 0) {
+        uint64_t spent = now_ms() - game->turnStarted;
+        uint64_t *left = &game->clockLeft[game->stone == 'W'];
+        *left = spent < *left ? *left - spent : 0;
+    }
+    placeStone(game);
+    game->record.moves[game->nMoves][0] = (uint8_t)game->x;
+    game->record.moves[game->nMoves][1] = (uint8_t)game->y;
+    game->nMoves++;
+    metrics_count(METRIC_MOVES, 1);
+    
+    // Check for win
+    if (checkWin(game)) {
+        game->gameOver = 1;
+        game->record.end = END_FIVE;
+    }
+    
+    uint64_t t3 = t0 ? metrics_now() : 0;
+    // Both players and every spectator apply the move to their own copy of the board
+    sendMove(game, game->player1_conn);
+    sendMove(game, game->player2_conn);
+    sendMove(game, NULL);
+    
+    // Check game status and update scoreboard
+    if (game->nMoves == game->geo->cells && game->gameOver == 0) {
+        game->gameOver = 2;
+        game->record.end = END_FULL;
+    }
+    if (game->gameOver) {
+        report_result(game);
+    } else {
+        game->stone = (game->stone == 'W') ? 'B' : 'W';
+    }
+    
+    if (game->gameOver) {
+        finish_connection(game->player1_conn);
+        finish_connection(game->player2_conn);
+        end_game(game);
+    } else {
+        start_turn(game);
+    }
+    
+    if (t0) {
+        metrics_observe(METRIC_MOVE_PARSE, t1 - t0);
+        metrics_observe(METRIC_MOVE_VALIDATE, t2 - t1);
+        metrics_observe(METRIC_MOVE_APPLY, t3 - t2);
+        metrics_observe(METRIC_MOVE_NOTIFY, metrics_now() - t3);
+    }
+}
+
+// Records the result and tells both players. Only the counter updates touch
+// shared state, and they are lock-free; the messages are built from the
+// totals those updates returned.
+void report_result(Game *game) {
+    PlayerScore score1, score2;
+    Frame frame;
+    
+    metrics_count(METRIC_GAMES_FINISHED, 1);
+    game->record.size = game->geo->size;
+    game->record.result = game->gameOver == 2 ? RESULT_DRAW : (game->stone == 'B' ? RESULT_B_WON : RESULT_W_WON);
+    game->record.black = game->player1->hash;
+    game->record.white = game->player2->hash;
+    game->record.durationMs = (uint32_t)(now_ms() - game->startedAt);
+    game->record.nMoves = game->nMoves;
+    record_game(&game->record);
+    if (game->gameOver == 2) {
+        add_player_result(game->player1, 0, 0, 1, &score1);
+        add_player_result(game->player2, 0, 0, 1, &score2);
+        
+        send_result(game->player1_conn, OUTCOME_DRAW, game->player1, &score1, game->player2, &score2);
+        send_result(game->player2_conn, OUTCOME_DRAW, game->player1, &score1, game->player2, &score2);
+        result_frame(&frame, OUTCOME_DRAW, game->player1, &score1, game->player2, &score2);
+        broadcast(game, &frame, TRUE);
+        return;
+    }
+    
+    // The player who just moved won
+    Connection *winnerConn = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    Connection *loserConn = (game->stone == 'B') ? game->player2_conn : game->player1_conn;
+    PlayerRecord *winner = winnerConn->player;
+    PlayerRecord *loser = loserConn->player;
+    
+    add_player_result(winner, 1, 0, 0, &score1);
+    add_player_result(loser, 0, 1, 0, &score2);
+    
+    send_result(winnerConn, OUTCOME_WIN, winner, &score1, loser, &score2);
+    send_result(loserConn, OUTCOME_LOSS, winner, &score1, loser, &score2);
+    // Spectators are told from the winner's side
+    result_frame(&frame, OUTCOME_WIN, winner, &score1, loser, &score2);
+    broadcast(game, &frame, TRUE);
+}
+
+// Looks for a win by continuous fours for color; safe on any thread
+int solve_vcf(const BoardGeometry *geo, const void *board, int color, VcfResult *result) {
+    int found = vcfSolve(vcf_cache, geo, board, color, VCF_MAX_NODES, result);
+    metrics_observe(METRIC_VCF_SOLVE, result->micros * 1000);
+    return found;
+}
+
+// The player to move asks for a hint: its own forced win if it has one,
+// else where the opponent's would start. The turn stays with the player.
+void send_hint(Game *game, Connection *conn) {
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    int color = (game->stone == 'W');
+    VcfResult result;
+    Frame frame;
+    
+    if (conn != current) {
+        conn_send_code(conn, MSG_ERROR, ERR_NOT_YOUR_TURN);
+        return;
+    }
+    
+    frameBegin(&frame, MSG_HINT_RESULT);
+    if (solve_vcf(game->geo, game->board, color, &result)) {
+        framePutU8(&frame, HINT_WIN);
+    } else if (solve_vcf(game->geo, game->board, !color, &result)) {
+        framePutU8(&frame, HINT_DEFEND);
+    } else {
+        framePutU8(&frame, HINT_NONE);
+    }
+    framePutU8(&frame, result.x);
+    framePutU8(&frame, result.y);
+    framePutU8(&frame, result.moves);
+    conn_send_frame(conn, &frame);
+    prompt_turn(game);
+}
+
+// The player to move claims a forced win; proven, it ends the game as if
+// the line had been played out
+void claim_win(Game *game, Connection *conn) {
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    VcfResult result;
+    
+    if (conn != current) {
+        conn_send_code(conn, MSG_ERROR, ERR_NOT_YOUR_TURN);
+        return;
+    }
+    if (!solve_vcf(game->geo, game->board, game->stone == 'W', &result)) {
+        conn_send_code(conn, MSG_ERROR, ERR_NOT_PROVEN);
+        prompt_turn(game);
+        return;
+    }
+    
+    metrics_count(METRIC_ADJUDICATIONS, 1);
+    game->gameOver = 1;
+    game->record.end = END_CLAIM;
+    report_result(game);
+    finish_connection(game->player1_conn);
+    finish_connection(game->player2_conn);
+    end_game(game);
+}
+
+// The opponent of stayer left mid-game. Stayer is credited with the win if
+// it has a forced one with the move, whoever's turn it was: leaving forfeits
+// the tempo. Returns TRUE if the result was reported.
+int adjudicate_abandoned(Game *game, Connection *stayer) {
+    char color = (stayer == game->player1_conn) ? 'B' : 'W';
+    VcfResult result;
+    
+    if (game->gameOver || !solve_vcf(game->geo, game->board, color == 'W', &result)) {
+        return FALSE;
+    }
+    metrics_count(METRIC_ADJUDICATIONS, 1);
+    game->stone = color;
+    game->gameOver = 1;
+    game->record.end = END_ADJUDICATED;
+    report_result(game);
+    return TRUE;
+}
+
+// Without a forced win the one who left still loses, or dropping the
+// connection would be a way out of a lost game
+void forfeit_abandoned(Game *game, Connection *stayer) {
+    game->stone = (stayer == game->player1_conn) ? 'B' : 'W';
+    game->gameOver = 1;
+    game->record.end = END_ABANDONED;
+    report_result(game);
+}
+
+void send_result(Connection *conn, Outcome outcome, const PlayerRecord *first, const PlayerScore *firstScore,
+                 const PlayerRecord *second, const PlayerScore *secondScore) {
+    Frame frame;
+    
+    result_frame(&frame, outcome, first, firstScore, second, secondScore);
+    conn_send_frame(conn, &frame);
+}
+
+void result_frame(Frame *frame, Outcome outcome, const PlayerRecord *first, const PlayerScore *firstScore,
+                  const PlayerRecord *second, const PlayerScore *secondScore) {
+    frameBegin(frame, MSG_GAME_OVER);
+    framePutU8(frame, outcome);
+    framePutString(frame, first->name);
+    framePutU32(frame, firstScore->wins);
+    framePutU32(frame, firstScore->losses);
+    framePutU32(frame, firstScore->ties);
+    framePutString(frame, second->name);
+    framePutU32(frame, secondScore->wins);
+    framePutU32(frame, secondScore->losses);
+    framePutU32(frame, secondScore->ties);
+}
+
+// Detaches both connections and returns the game to the slab
+void end_game(Game *game) {
+    timer_cancel(&reactor->wheel, &game->clock);
+    game->player1_conn->game = NULL;
+    game->player2_conn->game = NULL;
+    remove_seat(game->player1_conn);
+    remove_seat(game->player2_conn);
+    end_spectating(game);
+    metrics_lock(&reactor->lock, METRIC_WAIT_SHARD);
+    if (game->livePrev != NULL) game->livePrev->liveNext = game->liveNext;
+    else reactor->liveGames = game->liveNext;
+    if (game->liveNext != NULL) game->liveNext->livePrev = game->livePrev;
+    pthread_mutex_unlock(&reactor->lock);
+    slab_free(&game_slab, game);
+}
+
+// Watching a game: by a player's name, or the featured game (the most
+// watched, else the newest) for an empty name. No login needed. Updates are
+// encoded once per game and shared by every spectator's queue. A game on
+// another shard is watched from there.
+void spectate(Connection *conn, Payload *payload) {
     char name[51];
-    int wins;
-    int losses;
-    int ties;
-    int active;  // 1 if slot is used, 0 if empty
-} PlayerRecord;
+    int arrived = conn->arrived;
+    Frame frame;
+    
+    conn->arrived = FALSE;
+    payloadString(payload, name, sizeof(name));
+    if (!payload->error && !arrived && n_shards > 1) {
+        Shard *home = find_game_shard(name);
+        if (home != NULL && home != reactor) {
+            move_connection(conn, home);
+            return;
+        }
+    }
+    Game *game = payload->error ? NULL : find_game(name);
+    if (game == NULL) {
+        conn_send_code(conn, MSG_ERROR, ERR_NO_GAME);
+        return;
+    }
+    
+    frameBegin(&frame, MSG_SPECTATING);
+    framePutU8(&frame, game->geo->size);
+    framePutString(&frame, game->player1->name);
+    framePutString(&frame, game->player2->name);
+    conn_send_frame(conn, &frame);
+    
+    conn->state = CONN_SPECTATING;
+    conn->watching = game;
+    timer_cancel(&reactor->wheel, &conn->timer);
+    conn->prevSpectator = NULL;
+    conn->nextSpectator = game->spectators;
+    if (game->spectators != NULL) game->spectators->prevSpectator = conn;
+    game->spectators = conn;
+    metrics_lock(&reactor->lock, METRIC_WAIT_SHARD);
+    game->nSpectators++;
+    pthread_mutex_unlock(&reactor->lock);
+    metrics_count(METRIC_SPECTATORS_JOINED, 1);
+    spectator_push(conn, game_snapshot(game), FALSE);
+}
 
-typedef struct GAME {
-    int nMoves;
-    int gameOver;
-    char stone;
-    int x, y;
-    char board[8][8];
-    pthread_mutex_t lock;
-    int player1_fd;
-    int player2_fd;
-    PlayerRecord *player1;
-    PlayerRecord *player2;
-    PlayerRecord *scoreboard;
-    pthread_mutex_t *scoreboard_lock;
-} Game;
+Game *find_game(const char *name) {
+    Game *featured = reactor->liveGames;
+    
+    for (Game *game = reactor->liveGames; game != NULL; game = game->liveNext) {
+        if (name[0] == '\0') {
+            if (game->nSpectators > featured->nSpectators) featured = game;
+        } else if (strcmp(game->player1->name, name) == 0 || strcmp(game->player2->name, name) == 0) {
+            return game;
+        }
+    }
+    return name[0] == '\0' ? featured : NULL;
+}
 
-// Global scoreboard
-PlayerRecord scoreboard[MAX_PLAYERS];
-pthread_mutex_t scoreboard_lock = PTHREAD_MUTEX_INITIALIZER;
+// The shard with the game a spectator asked for, looking through every
+// shard's games under its lock: the one with the player's game, or with the
+// most watched game for an empty name, this one on a tie
+Shard *find_game_shard(const char *name) {
+    Shard *found = NULL;
+    int most = -1;
+    
+    for (int i = 0; i < n_shards && (found == NULL || name[0] == '\0'); i++) {
+        Shard *shard = &shards[(reactor->index + i) % n_shards];
+        metrics_lock(&shard->lock, METRIC_WAIT_SHARD);
+        for (Game *game = shard->liveGames; game != NULL; game = game->liveNext) {
+            if (name[0] == '\0') {
+                if (game->nSpectators > most) {
+                    most = game->nSpectators;
+                    found = shard;
+                }
+            } else if (strcmp(game->player1->name, name) == 0 || strcmp(game->player2->name, name) == 0) {
+                found = shard;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return found;
+}
 
-// server functions
-int start_server(char *hostname, char *port, int backlog);
-int accept_client(int serv_sock);
-void *get_in_addr(struct sockaddr * sa);
-int get_server_socket(char *hostname, char *port);
-void print_ip( struct addrinfo *ai);
+// Unlinks a spectator from its game and drops its queued frames
+void leave_spectating(Connection *conn) {
+    Game *game = conn->watching;
+    
+    if (game != NULL) {
+        if (conn->prevSpectator != NULL) conn->prevSpectator->nextSpectator = conn->nextSpectator;
+        else game->spectators = conn->nextSpectator;
+        if (conn->nextSpectator != NULL) conn->nextSpectator->prevSpectator = conn->prevSpectator;
+        metrics_lock(&reactor->lock, METRIC_WAIT_SHARD);
+        game->nSpectators--;
+        pthread_mutex_unlock(&reactor->lock);
+        conn->watching = NULL;
+        metrics_count(METRIC_SPECTATORS_LEFT, 1);
+    }
+    for (int i = 0; i < conn->nShared; i++) {
+        release_frame(conn->shared[i]);
+    }
+    conn->nShared = 0;
+    conn->sharedSent = 0;
+}
 
-// Thread functions
-void *horizontalCheck(void *ptr);
-void *verticalCheck(void *ptr);
-void *diagonalCheck(void *ptr);
-void *handle_game(void *ptr);
+// The game is over: spectators hang up once their queues are written
+void end_spectating(Game *game) {
+    while (game->spectators != NULL) {
+        Connection *conn = game->spectators;
+        game->spectators = conn->nextSpectator;
+        conn->watching = NULL;
+        metrics_count(METRIC_SPECTATORS_LEFT, 1);
+        finish_connection(conn);
+    }
+    metrics_lock(&reactor->lock, METRIC_WAIT_SHARD);
+    game->nSpectators = 0;
+    pthread_mutex_unlock(&reactor->lock);
+    if (game->snapshot != NULL) {
+        release_frame(game->snapshot);
+        game->snapshot = NULL;
+    }
+}
 
-// Game functions
-void initializeBoard(Game *game);
-void sendBoard(Game *game, int fd);
-int checkMove(Game *game);
+SharedFrame *share_frame(Frame *frame) {
+    size_t len = frameEnd(frame);
+    if (len == 0) return NULL;
+    SharedFrame *shared = (SharedFrame *)malloc(sizeof(SharedFrame) + len);
+    if (shared == NULL) return NULL;
+    shared->refs = 1;
+    shared->len = len;
+    memcpy(shared->data, frame->data, len);
+    return shared;
+}
 
-// Authentication functions
-void initialize_scoreboard();
-int register_player(int client_fd);
-PlayerRecord* login_player(int client_fd);
-char* encrypt_password(const char *password);
-PlayerRecord* find_player_by_email(const char *email);
-int add_player_to_scoreboard(const char *email, const char *password, const char *name);
+void release_frame(SharedFrame *shared) {
+    if (shared != NULL && --shared->refs == 0) free(shared);
+}
 
-int main(int argc, char *argv[]) {
-    int serv_socket;
+// The full board as of the last move, encoded at most once per move; the
+// game holds a reference until the next move replaces it
+SharedFrame *game_snapshot(Game *game) {
+    Frame frame;
     
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s port\n", argv[0]);
-        return 1;
+    if (game->snapshot != NULL && game->snapshotMoves == game->nMoves) return game->snapshot;
+    frameBegin(&frame, MSG_BOARD);
+    framePutU16(&frame, game->nMoves);
+    framePutBoard(&frame, game->geo, game->board);
+    SharedFrame *snapshot = share_frame(&frame);
+    if (snapshot == NULL) return game->snapshot;
+    release_frame(game->snapshot);
+    game->snapshot = snapshot;
+    game->snapshotMoves = game->nMoves;
+    return snapshot;
+}
+
+// One encoding for every spectator of the game. A final frame reaches even
+// the ones that fell behind, after a fresh board.
+void broadcast(Game *game, Frame *frame, int final) {
+    if (game->spectators == NULL) return;
+    SharedFrame *shared = share_frame(frame);
+    if (shared == NULL) return;
+    for (Connection *conn = game->spectators; conn != NULL; conn = conn->nextSpectator) {
+        spectator_push(conn, shared, final);
     }
+    release_frame(shared);
+}
+
+// Queues a reference, written with the rest at the end of the batch. A
+// spectator whose queue is full loses everything not yet started and is
+// caught up later with the latest board, so a slow reader costs the
+// players nothing.
+void spectator_push(Connection *conn, SharedFrame *shared, int final) {
+    if (shared == NULL || conn->state == CONN_CLOSED) return;
     
-    initialize_scoreboard();
-    
-    serv_socket = start_server(NULL, argv[1], 10);
-    if (serv_socket == -1) {
-        fprintf(stderr, "Failed to start server\n");
-        return 1;
+    if (final && conn->behind) {
+        conn->behind = FALSE;
+        if (conn->watching != NULL) spectator_push(conn, game_snapshot(conn->watching), TRUE);
+    } else if (conn->behind) {
+        return;
+    }
+    if (conn->nShared == SPECTATOR_BACKLOG) {
+        int keep = conn->sharedSent > 0;
+        for (int i = keep; i < conn->nShared; i++) {
+            release_frame(conn->shared[i]);
+        }
+        conn->nShared = keep;
+        metrics_count(METRIC_SPECTATOR_RESYNCS, 1);
+        if (!final) {
+            conn->behind = TRUE;
+            return;
+        }
+        if (conn->watching != NULL) spectator_push(conn, game_snapshot(conn->watching), TRUE);
     }
     
-    printf("Server started on port %s\n", argv[1]);
-    printf("Waiting for clients...\n");
+    shared->refs++;
+    conn->shared[conn->nShared++] = shared;
+    schedule_flush(conn);
+}
+
+// Writes the connection's own output and then its queued shared frames
+// with one sendmsg per pass, straight from the buffers. A spectator that
+// fell behind gets the latest board once the queue is empty. Returns -1 on
+// a socket error.
+int write_pending(Connection *conn) {
+    struct iovec iov[SPECTATOR_BACKLOG + 1];
+    struct msghdr msg;
     
-    while (1) {
-        Game *game = (Game *)malloc(sizeof(Game));
-        if (game == NULL) {
-            fprintf(stderr, "Memory allocation failed\n");
-            continue;
+    while (conn->outLen > 0 || conn->nShared > 0) {
+        size_t total = 0;
+        int n = 0;
+        if (conn->outLen > 0) {
+            iov[n].iov_base = conn->out;
+            iov[n].iov_len = conn->outLen;
+            total += iov[n++].iov_len;
         }
-        
-        pthread_mutex_init(&game->lock, NULL);
-        game->scoreboard = scoreboard;
-        game->scoreboard_lock = &scoreboard_lock;
-        
-        // Accept and authenticate Player 1
-        printf("Waiting for Player 1...\n");
-        game->player1_fd = accept_client(serv_socket);
-        if (game->player1_fd < 0) {
-            pthread_mutex_destroy(&game->lock);
-            free(game);
-            continue;
+        for (int i = 0; i < conn->nShared; i++) {
+            iov[n].iov_base = conn->shared[i]->data + (i == 0 ? conn->sharedSent : 0);
+            iov[n].iov_len = conn->shared[i]->len - (i == 0 ? conn->sharedSent : 0);
+            total += iov[n++].iov_len;
         }
-        
-        game->player1 = login_player(game->player1_fd);
-        if (game->player1 == NULL) {
-            printf("Player 1 authentication failed\n");
-            close(game->player1_fd);
-            pthread_mutex_destroy(&game->lock);
-            free(game);
-            continue;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        metrics_count(METRIC_SOCKET_WRITES, 1);
+        ssize_t sent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
         }
-        printf("Player 1 authenticated: %s\n", game->player1->name);
         
-        // Accept and authenticate Player 2
-        printf("Waiting for Player 2...\n");
-        game->player2_fd = accept_client(serv_socket);
-        if (game->player2_fd < 0) {
-            close(game->player1_fd);
-            pthread_mutex_destroy(&game->lock);
-            free(game);
-            continue;
+        size_t left = (size_t)sent;
+        if (conn->outLen > 0) {
+            size_t own = left < conn->outLen ? left : conn->outLen;
+            memmove(conn->out, conn->out + own, conn->outLen - own);
+            conn->outLen -= own;
+            left -= own;
         }
-        
-        game->player2 = login_player(game->player2_fd);
-        if (game->player2 == NULL) {
-            printf("Player 2 authentication failed\n");
-            close(game->player1_fd);
-            close(game->player2_fd);
-            pthread_mutex_destroy(&game->lock);
-            free(game);
-            continue;
+        int done = 0;
+        left += conn->sharedSent;
+        while (done < conn->nShared && left >= conn->shared[done]->len) {
+            left -= conn->shared[done]->len;
+            release_frame(conn->shared[done]);
+            done++;
         }
-        printf("Player 2 authenticated: %s\n", game->player2->name);
+        memmove(conn->shared, conn->shared + done, (conn->nShared - done) * sizeof(SharedFrame *));
+        conn->nShared -= done;
+        conn->sharedSent = left;
         
-        // Create thread to handle the game
-        pthread_t game_thread;
-        if (pthread_create(&game_thread, NULL, handle_game, (void *)game) != 0) {
-            fprintf(stderr, "Failed to create game thread\n");
-            close(game->player1_fd);
-            close(game->player2_fd);
-            pthread_mutex_destroy(&game->lock);
-            free(game);
-            continue;
+        if (conn->nShared == 0 && conn->behind) {
+            conn->behind = FALSE;
+            if (conn->watching != NULL) {
+                SharedFrame *snapshot = game_snapshot(conn->watching);
+                if (snapshot == NULL) return 0;
+                snapshot->refs++;
+                conn->shared[conn->nShared++] = snapshot;
+            }
         }
-        pthread_detach(game_thread);
+        if ((size_t)sent < total) return 0;  // the socket is full
     }
-    
-    close(serv_socket);
     return 0;
 }
 
-void initialize_scoreboard() {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        scoreboard[i].active = 0;
-        scoreboard[i].wins = 0;
-        scoreboard[i].losses = 0;
-        scoreboard[i].ties = 0;
-    }
-}
-
-char* encrypt_password(const char *password) {
-    // Use a fixed salt for simplicity (in production, use unique salts per user)
-    static char *salt = "$6$rounds=5000$randomsaltstring";
-    return crypt(password, salt);
-}
-
-PlayerRecord* find_player_by_email(const char *email) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (scoreboard[i].active && strcmp(scoreboard[i].email, email) == 0) {
-            return &scoreboard[i];
-        }
-    }
-    return NULL;
+// A token the client can RESUME with after losing the connection
+void send_session(Connection *conn, int resuming) {
+    uint8_t token[PROTO_TOKEN_BYTES];
+    Frame frame;
+    
+    make_session_token(session_key, conn->player->hash, (uint32_t)time(NULL) + SESSION_TOKEN_SECONDS, token);
+    frameBegin(&frame, MSG_SESSION);
+    framePutBytes(&frame, token, sizeof(token));
+    framePutU16(&frame, resume_seconds);
+    framePutU8(&frame, resuming);
+    conn_send_frame(conn, &frame);
 }
 
-int add_player_to_scoreboard(const char *email, const char *password, const char *name) {
-    pthread_mutex_lock(&scoreboard_lock);
+// Login by token: checking it is one SipHash, so nothing goes to the
+// hashing pool. A player with a seat in a game takes it back, on the
+// game's shard; anyone else goes on to choose a size. A bad token leaves
+// the client in the menu.
+void resume_session(Connection *conn, Payload *payload) {
+    const uint8_t *token = payloadBytes(payload, PROTO_TOKEN_BYTES);
+    PlayerRecord *player = NULL;
+    int arrived = conn->arrived;
+    uint64_t id;
     
-    // Check if email already exists
-    if (find_player_by_email(email) != NULL) {
-        pthread_mutex_unlock(&scoreboard_lock);
-        return -1;  // Email already registered
+    conn->arrived = FALSE;
+    if (token == NULL) {
+        conn_send_code(conn, MSG_ERROR, ERR_BAD_MESSAGE);
+        finish_connection(conn);
+        return;
     }
-    
-    // Find empty slot
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (!scoreboard[i].active) {
-            strcpy(scoreboard[i].email, email);
-            strcpy(scoreboard[i].password, password);
-            strcpy(scoreboard[i].name, name);
-            scoreboard[i].wins = 0;
-            scoreboard[i].losses = 0;
-            scoreboard[i].ties = 0;
-            scoreboard[i].active = 1;
-            pthread_mutex_unlock(&scoreboard_lock);
-            return 0;
+    if (check_session_token(session_key, token, (uint32_t)time(NULL), &id)) {
+        player = find_player_by_id(id);
+    }
+    if (player == NULL) {
+        metrics_count(METRIC_RESUME_FAILURES, 1);
+        conn_send_code(conn, MSG_AUTH_RESULT, AUTH_EXPIRED);
+        return;
+    }
+    if (!arrived && n_shards > 1) {
+        Shard *home = find_seat_shard(id);
+        if (home != NULL && home != reactor) {
+            move_connection(conn, home);
+            return;
         }
     }
     
-    pthread_mutex_unlock(&scoreboard_lock);
-    return -2;  // Scoreboard full
+    metrics_count(METRIC_RESUMES, 1);
+    conn->player = player;
+    strcpy(conn->email, player->email);
+    Connection *seat = find_seat(id);
+    conn_send_code(conn, MSG_AUTH_RESULT, AUTH_OK);
+    send_session(conn, seat != NULL);
+    if (seat == NULL) {
+        player_authenticated(conn);
+        return;
+    }
+    take_seat(conn, seat);
 }
 
-int register_player(int client_fd) {
-    char buffer[256];
-    char email[51], password[51], name[51];
-    ssize_t received;
+// The new connection replaces the old one in the game, whether that was
+// parked or still looked alive, and is brought up to date
+void take_seat(Connection *conn, Connection *seat) {
+    Game *game = seat->game;
+    Connection *other = (game->player1_conn == seat) ? game->player2_conn : game->player1_conn;
+    Frame frame;
     
-    // Get email
-    send(client_fd, "Enter email: ", 13, 0);
-    received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) return -1;
-    buffer[received] = '\0';
-    sscanf(buffer, "%50s", email);
+    if (seat->state == CONN_PARKED) metrics_count(METRIC_SEATS_RECLAIMED, 1);
+    if (game->player1_conn == seat) game->player1_conn = conn;
+    else game->player2_conn = conn;
+    seat->game = NULL;
+    close_connection(seat);
     
-    // Get password
-    send(client_fd, "Enter password: ", 16, 0);
-    received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) return -1;
-    buffer[received] = '\0';
-    sscanf(buffer, "%50s", password);
+    conn->game = game;
+    conn->geo = game->geo;
+    conn->state = CONN_PLAYING;
+    timer_cancel(&reactor->wheel, &conn->timer);
+    add_seat(conn);
     
-    // Get name
-    send(client_fd, "Enter first name: ", 18, 0);
-    received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) return -1;
-    buffer[received] = '\0';
-    sscanf(buffer, "%50s", name);
-    
-    // Encrypt password
-    char *encrypted = encrypt_password(password);
+    send_game_start(game, conn);
+    sendBoard(game, conn);
+    frameBegin(&frame, MSG_OPPONENT_BACK);
+    conn_send_frame(other, &frame);
+    Connection *current = (game->stone == 'B') ? game->player1_conn : game->player2_conn;
+    if (current == conn) prompt_turn(game);
+}
+
+void add_seat(Connection *conn) {
+    Connection **bucket = &seats.byPlayer[conn->player->hash & (SEAT_BUCKETS - 1)];
     
-    // Add to scoreboard
-    int result = add_player_to_scoreboard(email, encrypted, name);
+    metrics_lock(seat_lock(conn->player->hash), METRIC_WAIT_SEATS);
+    conn->prevSeat = NULL;
+    conn->nextSeat = *bucket;
+    if (*bucket != NULL) (*bucket)->prevSeat = conn;
+    *bucket = conn;
+    conn->seated = TRUE;
+    pthread_mutex_unlock(seat_lock(conn->player->hash));
+}
+
+void remove_seat(Connection *conn) {
+    if (!conn->seated) return;
+    metrics_lock(seat_lock(conn->player->hash), METRIC_WAIT_SEATS);
+    if (conn->prevSeat != NULL) conn->prevSeat->nextSeat = conn->nextSeat;
+    else seats.byPlayer[conn->player->hash & (SEAT_BUCKETS - 1)] = conn->nextSeat;
+    if (conn->nextSeat != NULL) conn->nextSeat->prevSeat = conn->prevSeat;
+    conn->seated = FALSE;
+    pthread_mutex_unlock(seat_lock(conn->player->hash));
+}
+
+// Guards every bucket the player's id can hash to
+pthread_mutex_t *seat_lock(uint64_t player) {
+    return &seats.locks[player & (SEAT_LOCKS - 1)];
+}
+
+// The player's parked seat, else any seat it holds in a game, on home or
+// on any shard if home is NULL. The caller holds the player's seat lock.
+static Connection *lookup_seat(uint64_t player, Shard *home) {
+    Connection *found = NULL;
     
-    if (result == 0) {
-        send(client_fd, "Registration successful!\n", 25, 0);
-        return 0;
-    } else if (result == -1) {
-        send(client_fd, "Email already registered!\n", 26, 0);
-        return -1;
-    } else {
-        send(client_fd, "Scoreboard full!\n", 17, 0);
-        return -1;
+    for (Connection *conn = seats.byPlayer[player & (SEAT_BUCKETS - 1)]; conn != NULL; conn = conn->nextSeat) {
+        if (conn->player->hash != player || (home != NULL && conn->shard != home)) continue;
+        if (conn->state == CONN_PARKED) return conn;
+        if (found == NULL) found = conn;
     }
+    return found;
+}
+
+// The player's seat on this shard; NULL if none
+Connection *find_seat(uint64_t player) {
+    metrics_lock(seat_lock(player), METRIC_WAIT_SEATS);
+    Connection *seat = lookup_seat(player, reactor);
+    pthread_mutex_unlock(seat_lock(player));
+    return seat;
+}
+
+// The shard with the player's seat, if any; the seat may be gone by the
+// time the player gets there
+Shard *find_seat_shard(uint64_t player) {
+    metrics_lock(seat_lock(player), METRIC_WAIT_SEATS);
+    Connection *seat = lookup_seat(player, NULL);
+    Shard *home = seat != NULL ? seat->shard : NULL;
+    pthread_mutex_unlock(seat_lock(player));
+    return home;
 }
 
-PlayerRecord* login_player(int client_fd) {
-    char buffer[256];
-    char email[51], password[51];
-    ssize_t received;
-    int choice;
+// The socket goes and the seat stays. The game goes on around it, since
+// anything sent to a parked connection is dropped, until the player
+// resumes or the grace period runs out.
+void park_seat(Connection *conn) {
+    Game *game = conn->game;
+    Connection *other = (game->player1_conn == conn) ? game->player2_conn : game->player1_conn;
+    Frame frame;
+    
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    metrics_count(METRIC_CONNECTIONS_CLOSED, 1);
+    atomic_fetch_sub(&admission.sessions, 1);
+    metrics_count(METRIC_SEATS_PARKED, 1);
+    leave_spectating(conn);  // drops any shared frames still queued
+    // Other shards look for parked seats
+    metrics_lock(seat_lock(conn->player->hash), METRIC_WAIT_SEATS);
+    conn->state = CONN_PARKED;
+    pthread_mutex_unlock(seat_lock(conn->player->hash));
+    conn->inLen = 0;
+    conn->outLen = 0;
+    timer_arm(&reactor->wheel, &conn->timer, now_ms(), (uint64_t)resume_seconds * 1000, seat_expired, conn);
     
-    // Ask for login or register
-    send(client_fd, "1. Login\n2. Register\nChoice: ", 30, 0);
-    received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) return NULL;
-    buffer[received] = '\0';
-    sscanf(buffer, "%d", &choice);
+    frameBegin(&frame, MSG_OPPONENT_AWAY);
+    framePutU16(&frame, resume_seconds);
+    conn_send_frame(other, &frame);
+}
+
+void unpark_seat(Connection *conn) {
+    timer_cancel(&reactor->wheel, &conn->timer);
+    metrics_count(METRIC_SEATS_RELEASED, 1);
+}
+
+// A player who did not come back in time loses the seat as if it had just
+// disconnected without the grace period
+void seat_expired(void *data) {
+    metrics_count(METRIC_SEATS_EXPIRED, 1);
+    abandon_game((Connection *)data);
+}
+
+uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int skill_band(const PlayerRecord *player) {
+    int band = (player->wins - player->losses) / SKILL_BAND_WIDTH + NUM_SKILL_BANDS / 2;
+    if (band < 0) return 0;
+    if (band >= NUM_SKILL_BANDS) return NUM_SKILL_BANDS - 1;
+    return band;
+}
+
+int start_matchmaker() {
+    pthread_t thread;
     
-    if (choice == 2) {
-        // Registration process
-        if (register_player(client_fd) != 0) {
-            return NULL;
+    pthread_mutex_init(&matchmaker.lock, NULL);
+    pthread_cond_init(&matchmaker.wake, NULL);
+    for (size_t g = 0; g < BOARD_GEOMETRY_COUNT; g++) {
+        for (int b = 0; b < NUM_SKILL_BANDS; b++) {
+            pthread_mutex_init(&matchmaker.buckets[g][b].lock, NULL);
         }
-        // After successful registration, don't ask for choice again
-        // Just proceed to login
     }
     
-    // Login process
-    send(client_fd, "Enter email: ", 13, 0);
-    received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) return NULL;
-    buffer[received] = '\0';
-    sscanf(buffer, "%50s", email);
+    if (pthread_create(&thread, NULL, matcher, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// Puts the connection in the bucket for its board size and skill. Tickets
+// are kept oldest first, so a requeued player lands ahead of newer ones.
+void join_matchmaking(Connection *conn) {
+    Ticket *ticket = (Ticket *)calloc(1, sizeof(Ticket));
+    if (ticket == NULL) {
+        conn_send_code(conn, MSG_ERROR, ERR_BUSY);
+        finish_connection(conn);
+        return;
+    }
+    if (conn->queuedAt == 0) {
+        conn->queuedAt = now_ms();
+    }
+    ticket->conn = conn;
+    ticket->geo = conn->geo;
+    ticket->band = skill_band(conn->player);
+    ticket->queuedAt = conn->queuedAt;
+    ticket->bucket = &matchmaker.buckets[conn->geo - boardGeometries][ticket->band];
+    conn->ticket = ticket;
+    conn->state = CONN_WAITING;
     
-    send(client_fd, "Enter password: ", 16, 0);
-    received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) return NULL;
-    buffer[received] = '\0';
-    sscanf(buffer, "%50s", password);
+    Bucket *bucket = ticket->bucket;
+    metrics_lock(&bucket->lock, METRIC_WAIT_BUCKET);
+    Ticket *after = bucket->tail;
+    while (after != NULL && after->queuedAt > ticket->queuedAt) {
+        after = after->prev;
+    }
+    ticket->prev = after;
+    ticket->next = (after != NULL) ? after->next : bucket->head;
+    if (ticket->next != NULL) ticket->next->prev = ticket; else bucket->tail = ticket;
+    if (after != NULL) after->next = ticket; else bucket->head = ticket;
+    ticket->queued = TRUE;
+    bucket->count++;
+    pthread_mutex_unlock(&bucket->lock);
     
-    // Verify credentials
-    pthread_mutex_lock(&scoreboard_lock);
-    PlayerRecord *player = find_player_by_email(email);
+    metrics_lock(&matchmaker.lock, METRIC_WAIT_MATCHMAKER);
+    matchmaker.signalled = TRUE;
+    pthread_cond_signal(&matchmaker.wake);
+    pthread_mutex_unlock(&matchmaker.lock);
+}
+
+// Withdraws a queued ticket. A ticket the matcher already took stays with
+// the connection until match_completions sees it.
+void leave_matchmaking(Connection *conn) {
+    Ticket *ticket = conn->ticket;
+    if (ticket == NULL) return;
     
-    if (player != NULL) {
-        char *encrypted = encrypt_password(password);
-        if (strcmp(player->password, encrypted) == 0) {
-            send(client_fd, "Login successful!\n", 18, 0);
-            pthread_mutex_unlock(&scoreboard_lock);
-            return player;
-        }
+    Bucket *bucket = ticket->bucket;
+    metrics_lock(&bucket->lock, METRIC_WAIT_BUCKET);
+    int queued = ticket->queued;
+    if (queued) {
+        if (ticket->prev != NULL) ticket->prev->next = ticket->next; else bucket->head = ticket->next;
+        if (ticket->next != NULL) ticket->next->prev = ticket->prev; else bucket->tail = ticket->prev;
+        bucket->count--;
     }
+    pthread_mutex_unlock(&bucket->lock);
     
-    pthread_mutex_unlock(&scoreboard_lock);
-    send(client_fd, "Invalid credentials!\n", 21, 0);
-    return NULL;
+    if (queued) {
+        conn->ticket = NULL;
+        free(ticket);
+    }
 }
 
-void *handle_game(void *ptr) {
-    Game *game = (Game *)ptr;
-    char buffer[512];
-    ssize_t received;
-    
-    // Send player names and opponent info
-    snprintf(buffer, sizeof(buffer), "Your name: %s, Opponent name: %s\n", 
-             game->player1->name, game->player2->name);
-    send(game->player1_fd, buffer, strlen(buffer), 0);
+static Ticket *pop_ticket(Bucket *bucket) {
+    Ticket *ticket = bucket->head;
+    bucket->head = ticket->next;
+    if (bucket->head != NULL) bucket->head->prev = NULL; else bucket->tail = NULL;
+    bucket->count--;
+    ticket->queued = FALSE;
+    ticket->prev = ticket->next = NULL;
+    return ticket;
+}
+
+static void add_pair(Ticket *a, Ticket *b, Ticket **matched) {
+    a->partner = b;
+    b->partner = a;
+    a->next = *matched;
+    *matched = a;
+}
+
+// Pairs off the bucket two at a time, oldest first
+int match_bucket(Bucket *bucket, Ticket **matched) {
+    int pairs = 0;
     
-    snprintf(buffer, sizeof(buffer), "Your name: %s, Opponent name: %s\n", 
-             game->player2->name, game->player1->name);
-    send(game->player2_fd, buffer, strlen(buffer), 0);
+    metrics_lock(&bucket->lock, METRIC_WAIT_BUCKET);
+    while (bucket->count >= 2) {
+        Ticket *a = pop_ticket(bucket);
+        Ticket *b = pop_ticket(bucket);
+        add_pair(a, b, matched);
+        pairs++;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    return pairs;
+}
+
+// A lone ticket that has waited long enough is matched one band up.
+// Locks are always taken lower band first.
+int match_across(Bucket *lower, Bucket *upper, uint64_t now, Ticket **matched) {
+    int pairs = 0;
     
-    // Initialize game
-    game->nMoves = 0;
-    game->gameOver = 0;
-    game->stone = 'B';
-    initializeBoard(game);
+    metrics_lock(&lower->lock, METRIC_WAIT_BUCKET);
+    metrics_lock(&upper->lock, METRIC_WAIT_BUCKET);
+    if (lower->count == 1 && upper->count >= 1 &&
+        (now - lower->head->queuedAt >= MATCH_WIDEN_MS || now - upper->head->queuedAt >= MATCH_WIDEN_MS)) {
+        Ticket *a = pop_ticket(lower);
+        Ticket *b = pop_ticket(upper);
+        add_pair(a, b, matched);
+        pairs++;
+    }
+    pthread_mutex_unlock(&upper->lock);
+    pthread_mutex_unlock(&lower->lock);
+    return pairs;
+}
+
+// Whoever is still alone after MATCH_BOT_MS gets the bot: a ticket with no
+// partner
+int match_bot(Bucket *bucket, uint64_t now, Ticket **matched) {
+    int pairs = 0;
     
-    // Send initial board to both players
-    sendBoard(game, game->player1_fd);
-    sendBoard(game, game->player2_fd);
+    metrics_lock(&bucket->lock, METRIC_WAIT_BUCKET);
+    while (bucket->count > 0 && now - bucket->head->queuedAt >= MATCH_BOT_MS) {
+        Ticket *ticket = pop_ticket(bucket);
+        ticket->partner = NULL;
+        ticket->next = *matched;
+        *matched = ticket;
+        pairs++;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    return pairs;
+}
+
+void *matcher(void *ptr) {
+    (void)ptr;
     
-    // Game loop
-    while (game->gameOver == 0) {
-        int current_fd = (game->stone == 'B') ? game->player1_fd : game->player2_fd;
-        
-        // Prompt current player
-        snprintf(buffer, sizeof(buffer), "\n%c stone's turn. Enter x and y (0-7): ", game->stone);
-        send(current_fd, buffer, strlen(buffer), 0);
+    while (1) {
+        // Sleep until tickets arrive, waking now and then to widen the search
+        metrics_lock(&matchmaker.lock, METRIC_WAIT_MATCHMAKER);
+        if (!matchmaker.signalled) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += MATCH_POLL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&matchmaker.wake, &matchmaker.lock, &deadline);
+        }
+        matchmaker.signalled = FALSE;
+        pthread_mutex_unlock(&matchmaker.lock);
         
-        // Receive move
-        received = recv(current_fd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
-            close(game->player1_fd);
-            close(game->player2_fd);
-            pthread_mutex_destroy(&game->lock);
-            free(game);
-            return NULL;
-        }
-        buffer[received] = '\0';
+        Ticket *matched = NULL;
+        int pairs = 0;
+        uint64_t now = now_ms();
+        for (size_t g = 0; g < BOARD_GEOMETRY_COUNT; g++) {
+            Bucket *row = matchmaker.buckets[g];
+            for (int b = 0; b < NUM_SKILL_BANDS; b++) {
+                pairs += match_bucket(&row[b], &matched);
+            }
+            for (int b = 0; b + 1 < NUM_SKILL_BANDS; b++) {
+                pairs += match_across(&row[b], &row[b + 1], now, &matched);
+            }
+            for (int b = 0; b < NUM_SKILL_BANDS && bot_pool.nThreads > 0; b++) {
+                pairs += match_bot(&row[b], now, &matched);
+            }
+        }
+        if (pairs == 0) continue;
         
-        // Parse move
-        if (sscanf(buffer, "%d %d", &game->x, &game->y) != 2) {
-            send(current_fd, "Invalid input format. Try again.\n", 33, 0);
-            continue;
+        // Each pair goes to the first player's shard, by way of the
+        // second's if they are apart. A queued player does not move, and
+        // is not freed while its ticket is out.
+        while (matched != NULL) {
+            Ticket *pair = matched;
+            Shard *to = pair->conn->shard;
+            matched = pair->next;
+            if (pair->partner != NULL && pair->partner->conn->shard != to) to = pair->partner->conn->shard;
+            post_mail(to, NULL, pair, NULL);
         }
+    }
+    return NULL;
+}
+
+// Runs on the shard the pairs were sent to: starts a game for every pair
+// whose players are both still connected and requeues the survivor of a
+// broken pair
+void match_completions(Ticket *pairs) {
+    while (pairs != NULL) {
+        Ticket *pair = pairs;
+        Connection *conns[2] = { pair->conn, pair->partner ? pair->partner->conn : NULL };
+        int alive = 0;
         
-        // Check if move is valid
-        if (checkMove(game) == 1) {
-            snprintf(buffer, sizeof(buffer), "Invalid move at (%d,%d). Try again.\n", 
-                     game->x, game->y);
-            send(current_fd, buffer, strlen(buffer), 0);
+        pairs = pair->next;
+        if (conns[0]->shard != reactor) {
+            release_partner(pair);
             continue;
         }
+        int gone = pair->partner != NULL && conns[1] == NULL;   // left before it could be handed over
+        free(pair->partner);
+        free(pair);
         
-        // Make move
-        game->board[game->x][game->y] = game->stone;
-        game->nMoves++;
-        
-        // Check for win
-        pthread_t hThread, vThread, dThread;
-        pthread_create(&hThread, NULL, horizontalCheck, (void *)game);
-        pthread_create(&vThread, NULL, verticalCheck, (void *)game);
-        pthread_create(&dThread, NULL, diagonalCheck, (void *)game);
+        // A second player from another shard comes with the pair
+        if (conns[1] != NULL && conns[1]->state == CONN_MOVING) adopt_connection(conns[1]);
         
-        pthread_join(hThread, NULL);
-        pthread_join(vThread, NULL);
-        pthread_join(dThread, NULL);
-        
-        // Send updated board to both players
-        sendBoard(game, game->player1_fd);
-        sendBoard(game, game->player2_fd);
+        if (conns[1] == NULL) {
+            conns[0]->ticket = NULL;
+            if (conns[0]->state != CONN_CLOSED && gone) {
+                join_matchmaking(conns[0]);
+            } else if (conns[0]->state != CONN_CLOSED) {
+                start_bot_game(conns[0]);
+            } else if (!conns[0]->authPending) {
+                conns[0]->nextClosed = reactor->closed;
+                reactor->closed = conns[0];
+            }
+            continue;
+        }
         
-        // Check game status and update scoreboard
-        pthread_mutex_lock(game->scoreboard_lock);
+        for (int i = 0; i < 2; i++) {
+            conns[i]->ticket = NULL;
+            if (conns[i]->state != CONN_CLOSED) {
+                alive++;
+            } else if (!conns[i]->authPending) {
+                // close_connection left it for us to free
+                conns[i]->nextClosed = reactor->closed;
+                reactor->closed = conns[i];
+            }
+        }
         
-        if (game->nMoves == 64 && game->gameOver == 0) {
-            game->gameOver = 2;
-            game->player1->ties++;
-            game->player2->ties++;
-            
-            snprintf(buffer, sizeof(buffer), "It was a draw\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
-                     game->player1->name, game->player1->wins, game->player1->losses, game->player1->ties,
-                     game->player2->name, game->player2->wins, game->player2->losses, game->player2->ties);
-            send(game->player1_fd, buffer, strlen(buffer), 0);
-            send(game->player2_fd, buffer, strlen(buffer), 0);
-            
-        } else if (game->gameOver == 1) {
-            if (game->stone == 'B') {
-                game->player1->wins++;
-                game->player2->losses++;
-                
-                snprintf(buffer, sizeof(buffer), "You won and %s lost\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
-                         game->player2->name,
-                         game->player1->name, game->player1->wins, game->player1->losses, game->player1->ties,
-                         game->player2->name, game->player2->wins, game->player2->losses, game->player2->ties);
-                send(game->player1_fd, buffer, strlen(buffer), 0);
-                
-                snprintf(buffer, sizeof(buffer), "You lost and %s won\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
-                         game->player1->name,
-                         game->player1->name, game->player1->wins, game->player1->losses, game->player1->ties,
-                         game->player2->name, game->player2->wins, game->player2->losses, game->player2->ties);
-                send(game->player2_fd, buffer, strlen(buffer), 0);
-            } else {
-                game->player2->wins++;
-                game->player1->losses++;
-                
-                snprintf(buffer, sizeof(buffer), "You won and %s lost\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
-                         game->player1->name,
-                         game->player2->name, game->player2->wins, game->player2->losses, game->player2->ties,
-                         game->player1->name, game->player1->wins, game->player1->losses, game->player1->ties);
-                send(game->player2_fd, buffer, strlen(buffer), 0);
-                
-                snprintf(buffer, sizeof(buffer), "You lost and %s won\n%s: %dW/%dL/%dT - %s: %dW/%dL/%dT\n",
-                         game->player2->name,
-                         game->player2->name, game->player2->wins, game->player2->losses, game->player2->ties,
-                         game->player1->name, game->player1->wins, game->player1->losses, game->player1->ties);
-                send(game->player1_fd, buffer, strlen(buffer), 0);
+        if (alive < 2) {
+            // The survivor keeps its place in the queue
+            for (int i = 0; i < 2; i++) {
+                if (conns[i]->state != CONN_CLOSED) join_matchmaking(conns[i]);
             }
-        } else {
-            game->stone = (game->stone == 'W') ? 'B' : 'W';
+            continue;
         }
         
-        pthread_mutex_unlock(game->scoreboard_lock);
-    }
-    
-    close(game->player1_fd);
-    close(game->player2_fd);
-    pthread_mutex_destroy(&game->lock);
-    free(game);
-    return NULL;
-}
-
-void initializeBoard(Game *game) {
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            game->board[i][j] = '.';
+        // Both tickets came from buckets for the same board size
+        // Out of game slots: requeueing would only spin the matcher
+        Game *game = create_game(conns[0], conns[1], conns[0]->geo);
+        if (game == NULL) {
+            for (int i = 0; i < 2; i++) {
+                turn_away(conns[i], MSG_ERROR, ERR_BUSY, RETRY_BUSY_MS, METRIC_SHED_GAMES);
+            }
+            continue;
         }
+        start_game(game);
     }
 }
 
-void sendBoard(Game *game, int fd) {
-    char buffer[1024];
-    int offset = 0;
+// First stop of a pair split over two shards, on the second player's. A
+// player who left is freed here; one still waiting is let go, and goes on
+// with the pair to the first player's shard after the batch.
+void release_partner(Ticket *pair) {
+    Connection *conn = pair->partner->conn;
     
-    offset += snprintf(buffer + offset, sizeof(buffer) - offset, "\n  0 1 2 3 4 5 6 7\n");
-    for (int i = 0; i < 8; i++) {
-        offset += snprintf(buffer + offset, sizeof(buffer) - offset, "%d ", i);
-        for (int j = 0; j < 8; j++) {
-            offset += snprintf(buffer + offset, sizeof(buffer) - offset, "%c ", game->board[i][j]);
+    if (conn->state == CONN_CLOSED) {
+        conn->ticket = NULL;
+        if (!conn->authPending) {
+            conn->nextClosed = reactor->closed;
+            reactor->closed = conn;
         }
-        offset += snprintf(buffer + offset, sizeof(buffer) - offset, "\n");
+        pair->partner->conn = NULL;
+    } else {
+        detach_connection(conn, pair->conn->shard);
     }
-    send(fd, buffer, strlen(buffer), 0);
+    pair->next = reactor->forwarding;
+    reactor->forwarding = pair;
 }
 
-int checkMove(Game *game) {
-    if (game->x < 0 || game->x >= 8 || game->y < 0 || game->y >= 8) {
-        return 1;
+// Bot moves are searched off the reactors, on the worker pool. A worker
+// makes itself an engine with nThreads search threads for its first bot
+// move; all of them share one transposition table. The bot plays under an
+// account no password can open, and opens from dir/BOOK_FILE when there is
+// one.
+int start_bot_pool(int nThreads, int moveMs, const char *dir) {
+    char bookPath[PATH_MAX];
+    
+    bot_pool.player = find_player_by_email(BOT_EMAIL);
+    if (bot_pool.player == NULL && add_player_to_scoreboard(BOT_EMAIL, "*", BOT_NAME) == 0) {
+        bot_pool.player = find_player_by_email(BOT_EMAIL);
     }
-    if (game->board[game->x][game->y] != '.') {
-        return 1;
+    if (bot_pool.player == NULL || strcmp(bot_pool.player->password, "*") != 0) {
+        fprintf(stderr, "The bot's account \"%s\" is missing or belongs to a player\n", BOT_EMAIL);
+        return -1;
+    }
+    
+    bot_pool.table = aiCreateTable(AI_TABLE_MB);
+    if (bot_pool.table == NULL) {
+        perror("bot pool");
+        return -1;
+    }
+    bot_pool.nThreads = nThreads;
+    bot_pool.moveMs = moveMs;
+    
+    snprintf(bookPath, sizeof(bookPath), "%s/%s", dir, BOOK_FILE);
+    bot_pool.book = open_book(bookPath);
+    if (bot_pool.book != NULL) {
+        printf("Opening book %s: %llu replies\n", bookPath, (unsigned long long)bot_pool.book->count);
     }
     return 0;
 }
 
-void *horizontalCheck(void *ptr) {
-    Game *game = (Game *)ptr;
-    int count = 0;
+// Hands a copy of the board to the shard's task queue; the game carries on
+// when the move comes back. Out of memory or queue room, the bot resigns by
+// leaving.
+void start_bot_move(Game *game, Connection *bot) {
+    BotJob *job = (BotJob *)calloc(1, sizeof(BotJob));
+    if (job == NULL) {
+        connection_lost(bot);
+        return;
+    }
+    job->task.run = run_bot_move;
+    job->task.done = bot_move;
+    job->shard = reactor;
+    job->conn = bot;
+    job->geo = game->geo;
+    job->color = (game->stone == 'W');
+    memcpy(job->board, game->board, game->geo->boardBytes);
     
-    for (int j = 0; j < 8; j++) {
-        if (game->board[game->x][j] == game->stone) {
-            count++;
-            if (count == 5) {
-                game->gameOver = 1;
-                return NULL;
-            }
-        } else {
-            count = 0;
-        }
+    if (pool_submit(&work_pool, reactor->index, &job->task) == -1) {
+        free(job);
+        connection_lost(bot);
+        return;
     }
-    return NULL;
+    bot->searching = TRUE;
 }
 
-void *verticalCheck(void *ptr) {
-    Game *game = (Game *)ptr;
-    int count = 0;
+// Runs on whichever worker takes the job
+void run_bot_move(Task *task) {
+    static __thread AiEngine *engine;   // each worker's own, made on its first search
+    BotJob *job = (BotJob *)task;
+    VcfResult vcf;
     
-    for (int i = 0; i < 8; i++) {
-        if (game->board[i][game->y] == game->stone) {
-            count++;
-            if (count == 5) {
-                game->gameOver = 1;
-                return NULL;
-            }
+    memset(&job->result, 0, sizeof(job->result));
+    if (bot_pool.book != NULL &&
+        bookMove(bot_pool.book, job->geo, job->board, job->color, &job->result.x, &job->result.y)) {
+        metrics_count(METRIC_BOOK_MOVES, 1);
+    } else if (solve_vcf(job->geo, job->board, job->color, &vcf)) {
+        // A forced win needs no search
+        job->result.x = vcf.x;
+        job->result.y = vcf.y;
+    } else {
+        if (engine == NULL) engine = aiCreateEngine(bot_pool.table, bot_pool.nThreads);
+        if (engine != NULL) {
+            aiSearch(engine, job->geo, job->board, job->color, bot_pool.moveMs, &job->result);
+            metrics_count(METRIC_BOT_MOVES, 1);
+            metrics_count(METRIC_BOT_NODES, job->result.nodes);
+            metrics_observe(METRIC_BOT_SEARCH, job->result.micros * 1000);
         } else {
-            count = 0;
+            job->resign = TRUE;
         }
     }
-    return NULL;
+    post_mail(job->shard, task, NULL, NULL);
 }
 
-void *diagonalCheck(void *ptr) {
-    Game *game = (Game *)ptr;
-    int count;
+// Plays the searched move as if the bot had sent it
+void bot_move(Task *task) {
+    BotJob *job = (BotJob *)task;
+    Connection *bot = job->conn;
+    uint8_t move[2] = { (uint8_t)job->result.x, (uint8_t)job->result.y };
+    int resign = job->resign;
     
-    // Check all diagonals (top-left to bottom-right)
-    for (int start = 0; start < 8; start++) {
-        // Diagonals starting from top row
-        count = 0;
-        for (int i = 0, j = start; i < 8 && j < 8; i++, j++) {
-            if (game->board[i][j] == game->stone) {
-                count++;
-                if (count == 5) {
-                    game->gameOver = 1;
-                    return NULL;
-                }
-            } else {
-                count = 0;
-            }
-        }
-        
-        // Diagonals starting from left column (skip 0,0 as it's already covered)
-        if (start > 0) {
-            count = 0;
-            for (int i = start, j = 0; i < 8 && j < 8; i++, j++) {
-                if (game->board[i][j] == game->stone) {
-                    count++;
-                    if (count == 5) {
-                        game->gameOver = 1;
-                        return NULL;
-                    }
-                } else {
-                    count = 0;
-                }
-            }
-        }
-    }
+    bot->searching = FALSE;
+    free(job);
     
-    // Check all diagonals (top-right to bottom-left)
-    for (int start = 0; start < 8; start++) {
-        // Diagonals starting from top row
-        count = 0;
-        for (int i = 0, j = start; i < 8 && j >= 0; i++, j--) {
-            if (game->board[i][j] == game->stone) {
-                count++;
-                if (count == 5) {
-                    game->gameOver = 1;
-                    return NULL;
-                }
-            } else {
-                count = 0;
-            }
-        }
-        
-        // Diagonals starting from right column (skip 0,7 as it's already covered)
-        if (start > 0) {
-            count = 0;
-            for (int i = start, j = 7; i < 8 && j >= 0; i++, j--) {
-                if (game->board[i][j] == game->stone) {
-                    count++;
-                    if (count == 5) {
-                        game->gameOver = 1;
-                        return NULL;
-                    }
-                } else {
-                    count = 0;
-                }
-            }
-        }
+    // The player left while the bot was thinking
+    if (bot->state == CONN_CLOSED) {
+        bot->nextClosed = reactor->closed;
+        reactor->closed = bot;
+        return;
+    }
+    if (resign) {
+        connection_lost(bot);
+        return;
     }
     
-    return NULL;
+    Payload payload = { move, sizeof(move), 0 };
+    handle_game(bot->game, bot, &payload);
+}
+
+// Point-in-time values added to every metrics scrape; runs on the metrics thread
+void server_gauges(MetricsBuffer *out) {
+    SlabStats stats;
+    
+    slab_stats(&game_slab, &stats);
+    
+    metrics_gauge(out, "gomoku_connections", "Open client connections.",
+                  (double)(metrics_total(METRIC_ACCEPTS) - metrics_total(METRIC_CONNECTIONS_CLOSED)));
+    metrics_gauge(out, "gomoku_games_active", "Games in play.", stats.inUse);
+    metrics_gauge(out, "gomoku_spectators", "Connections watching a game.",
+                  (double)(metrics_total(METRIC_SPECTATORS_JOINED) - metrics_total(METRIC_SPECTATORS_LEFT)));
+    metrics_gauge(out, "gomoku_parked_seats", "Players who dropped mid-game and may still resume.",
+                  (double)(metrics_total(METRIC_SEATS_PARKED) - metrics_total(METRIC_SEATS_RELEASED)));
+    metrics_gauge(out, "gomoku_games_peak", "Most games in play at once.", stats.peak);
+    metrics_gauge(out, "gomoku_game_slots", "Games the server reserved room for.", stats.capacity);
+    metrics_gauge(out, "gomoku_task_queue_depth", "Password hashes and bot moves waiting for a worker.",
+                  pool_depth(&work_pool));
+    metrics_gauge(out, "gomoku_auths_pending", "Logins and registrations whose password is queued or being hashed.",
+                  (double)atomic_load(&admission.auths));
+    metrics_printf(out, "# HELP gomoku_tasks_stolen_total Tasks a worker took from another shard's queue.\n"
+                        "# TYPE gomoku_tasks_stolen_total counter\ngomoku_tasks_stolen_total %ld\n",
+                   atomic_load(&work_pool.stolen));
+    metrics_gauge(out, "gomoku_players", "Registered accounts.", count_players());
+}
+
+void initializeBoard(Game *game) {
+    game->geo->clear(game->board);
+}
+
+void sendBoard(Game *game, Connection *conn) {
+    SharedFrame *snapshot = game_snapshot(game);
+    if (snapshot != NULL) conn_send(conn, (const char *)snapshot->data, snapshot->len);
+}
+
+// The move just played, numbered so the client can spot a gap and resync
+void sendMove(Game *game, Connection *conn) {
+    Frame frame;
+    frameBegin(&frame, MSG_MOVE_PLAYED);
+    framePutU16(&frame, game->nMoves);
+    framePutU8(&frame, game->stone == 'W');
+    framePutU8(&frame, game->x);
+    framePutU8(&frame, game->y);
+    if (conn != NULL) {
+        conn_send_frame(conn, &frame);
+    } else {
+        broadcast(game, &frame, FALSE);
+    }
+}
+
+int checkMove(Game *game) {
+    return game->geo->checkMove(game->board, game->x, game->y);
+}
+
+void placeStone(Game *game) {
+    game->geo->place(game->board, game->stone == 'W', game->x, game->y);
+}
+
+int checkWin(Game *game) {
+    return game->geo->checkWin(game->board, game->stone == 'W', game->x, game->y);
 }
 
 int get_server_socket(char *hostname, char *port) {
@@ -611,6 +2833,12 @@ int get_server_socket(char *hostname, char *port) {
             printf("socket option\n");
             continue;
         }
+        
+        // Every shard binds its own listener to the port
+        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+            printf("socket option\n");
+            continue;
+        }
 
         if (bind(server_socket, p->ai_addr, p->ai_addrlen) == -1) {
             printf("socket bind \n");
@@ -630,25 +2858,21 @@ int start_server(char *hostname, char *port, int backlog) {
     
     if ((status = listen(serv_socket, backlog)) == -1) {
         printf("socket listen error\n");
+        close(serv_socket);
+        return -1;
     }
     return serv_socket;
 }
 
+// Accepts and sheds are counted in the metrics rather than logged one by one
 int accept_client(int serv_sock) {
-    int reply_sock_fd = -1;
-    socklen_t sin_size = sizeof(struct sockaddr_storage);
-    struct sockaddr_storage client_addr;
-    char client_printable_addr[INET6_ADDRSTRLEN];
+    int reply_sock_fd = accept4(serv_sock, NULL, NULL, SOCK_NONBLOCK);
 
-    if ((reply_sock_fd = accept(serv_sock, 
-            (struct sockaddr *)&client_addr, &sin_size)) == -1) {
-        printf("socket accept error\n");
-    }
-    else {
-        inet_ntop(client_addr.ss_family, get_in_addr((struct sockaddr *)&client_addr), 
-                    client_printable_addr, sizeof client_printable_addr);
-        printf("server: connection from %s at port %d\n", client_printable_addr,
-                   ((struct sockaddr_in*)&client_addr)->sin_port);
+    // Running out of descriptors is the caller's to handle, and quietly
+    if (reply_sock_fd == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EMFILE && errno != ENFILE) {
+        int error = errno;
+        perror("accept");
+        errno = error;
     }
     return reply_sock_fd;
 }
@@ -679,14 +2903,3 @@ void print_ip( struct addrinfo *ai) {
         printf("serv ip info: %s - %s @%d\n", ipstr, ipver, ntohs(port));
     }
 }
-
-void *get_in_addr(struct sockaddr * sa) {
-    if (sa->sa_family == AF_INET) {
-        printf("ipv4\n");
-        return &(((struct sockaddr_in *)sa)->sin_addr);
-    }
-    else {
-        printf("ipv6\n");
-        return &(((struct sockaddr_in6 *)sa)->sin6_addr);
-    }
-}
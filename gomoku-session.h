@@ -0,0 +1,29 @@
+#ifndef GOMOKU_SESSION_H
+#define GOMOKU_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gomoku-protocol.h"
+
+// Resumption tokens: what a player gets at login to come back without its
+// password. A token is the player id and an expiry time signed with
+// SipHash-2-4 under a key only the server knows, so checking one is a hash
+// of 12 bytes rather than a crypt, and nothing has to be looked up or
+// stored per token. The key is drawn at startup; a restart invalidates
+// every token.
+//
+// Layout: u64 player id, u32 expiry in Unix seconds, u64 MAC, big-endian.
+
+#define SESSION_KEY_BYTES 16
+
+uint64_t siphash24(const uint8_t key[SESSION_KEY_BYTES], const void *data, size_t len);
+
+// Fills key from the kernel's random pool; 0 on success
+int new_session_key(uint8_t key[SESSION_KEY_BYTES]);
+void make_session_token(const uint8_t key[SESSION_KEY_BYTES], uint64_t player, uint32_t expires,
+                        uint8_t token[PROTO_TOKEN_BYTES]);
+// 1 and the player id if key signed the token and it has not expired by now
+int check_session_token(const uint8_t key[SESSION_KEY_BYTES], const uint8_t token[PROTO_TOKEN_BYTES],
+                        uint32_t now, uint64_t *player);
+
+#endif
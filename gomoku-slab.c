@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gomoku-slab.h"
+
+#define SLAB_EMPTY UINT32_MAX
+
+static uint64_t pack_head(uint64_t tag, uint32_t index) {
+    return (tag << 32) | index;
+}
+
+int slab_init(Slab *slab, size_t objectSize, uint32_t capacity, void (*construct)(void *object)) {
+    memset(slab, 0, sizeof(*slab));
+    if (capacity == 0 || capacity == SLAB_EMPTY) return -1;
+    
+    slab->slotSize = (objectSize + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+    slab->capacity = capacity;
+    slab->slots = (unsigned char *)aligned_alloc(SLAB_ALIGN, slab->slotSize * capacity);
+    slab->next = (_Atomic uint32_t *)calloc(capacity, sizeof(*slab->next));
+    if (slab->slots == NULL || slab->next == NULL) {
+        free(slab->slots);
+        free((void *)slab->next);
+        return -1;
+    }
+    
+    // Chain the slots in address order so the first allocations share pages
+    for (uint32_t i = 0; i < capacity; i++) {
+        if (construct != NULL) construct(slab->slots + (size_t)i * slab->slotSize);
+        atomic_init(&slab->next[i], i + 1 < capacity ? i + 1 : SLAB_EMPTY);
+    }
+    atomic_init(&slab->head, pack_head(0, 0));
+    atomic_init(&slab->inUse, 0);
+    atomic_init(&slab->peak, 0);
+    return 0;
+}
+
+void *slab_alloc(Slab *slab) {
+    uint64_t head = atomic_load_explicit(&slab->head, memory_order_acquire);
+    uint32_t index;
+    
+    do {
+        index = (uint32_t)head;
+        if (index == SLAB_EMPTY) return NULL;
+        uint32_t next = atomic_load_explicit(&slab->next[index], memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&slab->head, &head, pack_head((head >> 32) + 1, next),
+                                                  memory_order_acquire, memory_order_acquire)) {
+            break;
+        }
+    } while (1);
+    
+    long inUse = atomic_fetch_add_explicit(&slab->inUse, 1, memory_order_relaxed) + 1;
+    long peak = atomic_load_explicit(&slab->peak, memory_order_relaxed);
+    while (inUse > peak &&
+           !atomic_compare_exchange_weak_explicit(&slab->peak, &peak, inUse, memory_order_relaxed, memory_order_relaxed)) {
+    }
+    return slab->slots + (size_t)index * slab->slotSize;
+}
+
+void slab_free(Slab *slab, void *object) {
+    uint32_t index = (uint32_t)(((unsigned char *)object - slab->slots) / slab->slotSize);
+    uint64_t head = atomic_load_explicit(&slab->head, memory_order_relaxed);
+    
+    do {
+        atomic_store_explicit(&slab->next[index], (uint32_t)head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&slab->head, &head, pack_head((head >> 32) + 1, index),
+                                                     memory_order_release, memory_order_relaxed));
+    atomic_fetch_sub_explicit(&slab->inUse, 1, memory_order_relaxed);
+}
+
+void slab_stats(Slab *slab, SlabStats *stats) {
+    stats->capacity = slab->capacity;
+    stats->inUse = atomic_load_explicit(&slab->inUse, memory_order_relaxed);
+    stats->peak = atomic_load_explicit(&slab->peak, memory_order_relaxed);
+    stats->slotSize = slab->slotSize;
+    stats->bytes = slab->slotSize * slab->capacity;
+}
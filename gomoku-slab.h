@@ -0,0 +1,47 @@
+#ifndef GOMOKU_SLAB_H
+#define GOMOKU_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Fixed-capacity object slab: one allocation made up front, carved into
+// cache-line-aligned slots of the same size.
+//
+// Free slots sit on a lock-free stack of slot indices. The stack head packs
+// a 32-bit index with a 32-bit tag that changes on every update, so a slot
+// popped and pushed back between another thread's read and compare-and-swap
+// cannot be mistaken for the old head. Link words live beside the slots, not
+// in them, so an object keeps its contents while free: anything set up once
+// by the constructor (a mutex, say) is reused as is and only reset in place.
+
+#define SLAB_ALIGN 64
+
+typedef struct SLAB {
+    unsigned char *slots;
+    size_t slotSize;           // object size rounded up to SLAB_ALIGN
+    uint32_t capacity;
+    _Atomic uint32_t *next;    // free stack links, by slot index
+    _Atomic uint64_t head;     // tag << 32 | index of the top free slot
+    atomic_long inUse;
+    atomic_long peak;
+} Slab;
+
+// Usage numbers for reports
+typedef struct SLABSTATS {
+    long capacity;
+    long inUse;
+    long peak;
+    size_t slotSize;
+    size_t bytes;              // memory reserved for the slots
+} SlabStats;
+
+// Reserves capacity slots of objectSize bytes and runs construct, if given,
+// once on each; 0 on success
+int slab_init(Slab *slab, size_t objectSize, uint32_t capacity, void (*construct)(void *object));
+// NULL when every slot is taken
+void *slab_alloc(Slab *slab);
+void slab_free(Slab *slab, void *object);
+void slab_stats(Slab *slab, SlabStats *stats);
+
+#endif
@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gomoku-store.h"
+
+#define SHARD_INITIAL_SLOTS 1024   // power of two
+#define RECORDS_PER_BLOCK 1024
+#define SNAPSHOT_MAGIC "GMKSNAP1"
+#define SNAPSHOT_FILE "players.snapshot"
+#define LOG_PREFIX "players.log."
+
+// Snapshot file: this header, the count record hashes, then count
+// PlayerRecords as they sit in memory. Loading only has to read the hashes;
+// record pages are faulted in as players log in.
+typedef struct SNAPSHOTHEADER {
+    char magic[8];
+    uint32_t recordSize;   // sizeof(PlayerRecord) of the writer
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t logGen;       // logs from this generation on are replayed on top
+} SnapshotHeader;
+
+// Log entries hold absolute values and counters only grow, so replay keeps
+// the largest value seen. Replaying an entry twice, replaying a log over a
+// snapshot that already includes part of it, or entries from two threads
+// landing out of order all give the same state.
+enum { LOG_REGISTER = 1, LOG_RESULT = 2 };
+
+typedef struct LOGHEADER {
+    uint32_t type;
+    uint32_t checksum;     // of the payload, to stop at a torn tail
+} LogHeader;
+
+typedef struct LOGREGISTER {
+    char email[51];
+    char password[128];
+    char name[51];
+} LogRegister;
+
+typedef struct LOGRESULT {
+    char email[51];
+    int32_t wins;
+    int32_t losses;
+    int32_t ties;
+} LogResult;
+
+typedef struct LOGBUFFER {
+    char *data;
+    size_t len;
+    size_t cap;
+} LogBuffer;
+
+typedef struct JOURNAL {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;       // entries queued
+    pthread_cond_t synced;     // a batch reached the disk
+    LogBuffer pending;         // queued, not yet written
+    uint64_t queued;           // batches are numbered to let sync wait
+    uint64_t written;
+    int enabled;               // off until loading is done
+    char dir[256];
+    int fd;                    // current log, only used by the writer
+    uint64_t gen;
+    long logBytes;             // log written since the last snapshot
+} Journal;
+
+// One open-addressing slot; hash 0 marks an empty slot
+typedef struct SLOT {
+    uint64_t hash;
+    PlayerRecord *player;
+} Slot;
+
+// Records are carved out of blocks that are never freed
+typedef struct RECORDBLOCK {
+    struct RECORDBLOCK *next;
+    int used;
+    PlayerRecord records[RECORDS_PER_BLOCK];
+} RecordBlock;
+
+typedef struct SHARD {
+    pthread_rwlock_t lock;
+    Slot *slots;
+    size_t mask;       // slot count - 1
+    size_t count;
+    RecordBlock *blocks;
+    char pad[64];      // keep neighbouring shard locks off one cache line
+} Shard;
+
+static Shard shards[STORE_SHARDS];
+static Journal journal = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                           PTHREAD_COND_INITIALIZER, { NULL, 0, 0 }, 0, 0, 0, "", -1, 0, 0 };
+
+static void journal_append(uint32_t type, const void *payload, size_t len);
+
+// FNV-1a with a final avalanche so the low bits pick shards and slots well
+static uint64_t hash_email(const char *email) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)email; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+uint64_t player_id(const char *email) {
+    return hash_email(email);
+}
+
+void initialize_scoreboard() {
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        pthread_rwlock_init(&shards[i].lock, NULL);
+        shards[i].slots = (Slot *)calloc(SHARD_INITIAL_SLOTS, sizeof(Slot));
+        shards[i].mask = shards[i].slots ? SHARD_INITIAL_SLOTS - 1 : 0;
+        shards[i].count = 0;
+        shards[i].blocks = NULL;
+    }
+}
+
+static Shard *shard_for(uint64_t hash) {
+    // Slots use the low bits, so shards take the high ones
+    return &shards[hash >> 58 & (STORE_SHARDS - 1)];
+}
+
+// A NULL email matches on the hash alone
+static PlayerRecord *shard_find(Shard *shard, uint64_t hash, const char *email) {
+    if (shard->slots == NULL) return NULL;
+    for (size_t i = hash & shard->mask; shard->slots[i].hash != 0; i = (i + 1) & shard->mask) {
+        if (shard->slots[i].hash == hash && (email == NULL || strcmp(shard->slots[i].player->email, email) == 0)) {
+            return shard->slots[i].player;
+        }
+    }
+    return NULL;
+}
+
+static void shard_insert(Slot *slots, size_t mask, uint64_t hash, PlayerRecord *player) {
+    size_t i = hash & mask;
+    while (slots[i].hash != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].player = player;
+}
+
+// Makes room for n more records, keeping the table under 70% full
+static int shard_reserve(Shard *shard, size_t n) {
+    size_t slotCount = shard->mask + 1;
+    size_t needed = (shard->count + n) * 10 / 7 + 1;
+    if (shard->slots != NULL && needed < slotCount) return 0;
+    
+    size_t newCount = SHARD_INITIAL_SLOTS;
+    while (newCount < needed) newCount *= 2;
+    Slot *slots = (Slot *)calloc(newCount, sizeof(Slot));
+    if (slots == NULL) return -1;
+    if (shard->slots != NULL) {
+        for (size_t i = 0; i < slotCount; i++) {
+            if (shard->slots[i].hash != 0) {
+                shard_insert(slots, newCount - 1, shard->slots[i].hash, shard->slots[i].player);
+            }
+        }
+        free(shard->slots);
+    }
+    shard->slots = slots;
+    shard->mask = newCount - 1;
+    return 0;
+}
+
+static PlayerRecord *shard_new_record(Shard *shard) {
+    if (shard->blocks == NULL || shard->blocks->used == RECORDS_PER_BLOCK) {
+        RecordBlock *block = (RecordBlock *)calloc(1, sizeof(RecordBlock));
+        if (block == NULL) return NULL;
+        block->next = shard->blocks;
+        shard->blocks = block;
+    }
+    return &shard->blocks->records[shard->blocks->used++];
+}
+
+PlayerRecord* find_player_by_email(const char *email) {
+    uint64_t hash = hash_email(email);
+    Shard *shard = shard_for(hash);
+    
+    pthread_rwlock_rdlock(&shard->lock);
+    PlayerRecord *player = shard_find(shard, hash, email);
+    pthread_rwlock_unlock(&shard->lock);
+    return player;
+}
+
+PlayerRecord* find_player_by_id(uint64_t id) {
+    Shard *shard = shard_for(id);
+    
+    pthread_rwlock_rdlock(&shard->lock);
+    PlayerRecord *player = shard_find(shard, id, NULL);
+    pthread_rwlock_unlock(&shard->lock);
+    return player;
+}
+
+int add_player_to_scoreboard(const char *email, const char *password, const char *name) {
+    uint64_t hash = hash_email(email);
+    Shard *shard = shard_for(hash);
+    
+    pthread_rwlock_wrlock(&shard->lock);
+    
+    // Check if email already exists
+    if (shard_find(shard, hash, email) != NULL) {
+        pthread_rwlock_unlock(&shard->lock);
+        return -1;  // Email already registered
+    }
+    
+    PlayerRecord *player = NULL;
+    if (shard_reserve(shard, 1) == 0) {
+        player = shard_new_record(shard);
+    }
+    if (player == NULL) {
+        pthread_rwlock_unlock(&shard->lock);
+        return -2;  // Out of memory
+    }
+    
+    // The record is filled in before it becomes visible to readers
+    strncpy(player->email, email, sizeof(player->email) - 1);
+    strncpy(player->password, password, sizeof(player->password) - 1);
+    strncpy(player->name, name, sizeof(player->name) - 1);
+    player->wins = 0;
+    player->losses = 0;
+    player->ties = 0;
+    player->hash = hash;
+    shard_insert(shard->slots, shard->mask, hash, player);
+    shard->count++;
+    
+    pthread_rwlock_unlock(&shard->lock);
+    
+    if (journal.enabled) {
+        LogRegister entry;
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.email, player->email, sizeof(entry.email));
+        memcpy(entry.password, player->password, sizeof(entry.password));
+        memcpy(entry.name, player->name, sizeof(entry.name));
+        journal_append(LOG_REGISTER, &entry, sizeof(entry));
+    }
+    return 0;
+}
+
+long count_players() {
+    long total = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        pthread_rwlock_rdlock(&shards[i].lock);
+        total += (long)shards[i].count;
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+    return total;
+}
+
+static uint32_t checksum(uint32_t type, const void *data, size_t len) {
+    uint32_t h = 2166136261u ^ type;
+    for (const unsigned char *p = (const unsigned char *)data; len > 0; p++, len--) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void journal_append(uint32_t type, const void *payload, size_t len) {
+    LogHeader header = { type, checksum(type, payload, len) };
+    size_t total = sizeof(header) + len;
+    
+    pthread_mutex_lock(&journal.lock);
+    LogBuffer *buf = &journal.pending;
+    if (buf->len + total > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 65536;
+        while (cap < buf->len + total) cap *= 2;
+        char *data = (char *)realloc(buf->data, cap);
+        if (data == NULL) {
+            pthread_mutex_unlock(&journal.lock);
+            fprintf(stderr, "player log: out of memory, entry dropped\n");
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, &header, sizeof(header));
+    memcpy(buf->data + buf->len + sizeof(header), payload, len);
+    buf->len += total;
+    pthread_cond_signal(&journal.wake);
+    pthread_mutex_unlock(&journal.lock);
+}
+
+void add_player_result(PlayerRecord *player, int wins, int losses, int ties, PlayerScore *out) {
+    out->wins = atomic_fetch_add_explicit(&player->wins, wins, memory_order_relaxed) + wins;
+    out->losses = atomic_fetch_add_explicit(&player->losses, losses, memory_order_relaxed) + losses;
+    out->ties = atomic_fetch_add_explicit(&player->ties, ties, memory_order_relaxed) + ties;
+    
+    if (journal.enabled) {
+        LogResult entry;
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.email, player->email, sizeof(entry.email));
+        entry.wins = out->wins;
+        entry.losses = out->losses;
+        entry.ties = out->ties;
+        journal_append(LOG_RESULT, &entry, sizeof(entry));
+    }
+}
+
+void sync_player_store() {
+    if (!journal.enabled) return;
+    pthread_mutex_lock(&journal.lock);
+    uint64_t target = journal.queued + (journal.pending.len > 0);
+    pthread_cond_signal(&journal.wake);
+    while (journal.written < target) {
+        pthread_cond_wait(&journal.synced, &journal.lock);
+    }
+    pthread_mutex_unlock(&journal.lock);
+}
+
+static void store_path(char *path, const char *name, uint64_t gen) {
+    if (gen) {
+        snprintf(path, PATH_MAX, "%s/%s%llu", journal.dir, name, (unsigned long long)gen);
+    } else {
+        snprintf(path, PATH_MAX, "%s/%s", journal.dir, name);
+    }
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void sync_dir() {
+    int fd = open(journal.dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static int open_log(uint64_t gen) {
+    char path[PATH_MAX];
+    store_path(path, LOG_PREFIX, gen);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd >= 0) sync_dir();
+    return fd;
+}
+
+// Maps the snapshot and indexes its records in place. The mapping is private,
+// so later W/L/T updates stay in memory until the next snapshot.
+static int load_snapshot(uint64_t *logGen) {
+    char path[PATH_MAX];
+    struct stat st;
+    
+    *logGen = 1;
+    store_path(path, SNAPSHOT_FILE, 0);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;  // first start
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        fprintf(stderr, "%s: truncated snapshot\n", path);
+        return -1;
+    }
+    
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    
+    SnapshotHeader *header = (SnapshotHeader *)map;
+    uint64_t *hashes = (uint64_t *)(header + 1);
+    PlayerRecord *records = (PlayerRecord *)(hashes + header->count);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0 || header->recordSize != sizeof(PlayerRecord) ||
+        sizeof(SnapshotHeader) + header->count * (sizeof(uint64_t) + sizeof(PlayerRecord)) > (size_t)st.st_size) {
+        fprintf(stderr, "%s: not a snapshot written by this build\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    
+    // Size every table once, then insert with the stored hashes
+    size_t perShard[STORE_SHARDS] = { 0 };
+    for (uint64_t i = 0; i < header->count; i++) {
+        perShard[shard_for(hashes[i]) - shards]++;
+    }
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        if (shard_reserve(&shards[i], perShard[i]) == -1) return -1;
+    }
+    for (uint64_t i = 0; i < header->count; i++) {
+        Shard *shard = shard_for(hashes[i]);
+        shard_insert(shard->slots, shard->mask, hashes[i], &records[i]);
+        shard->count++;
+    }
+    
+    *logGen = header->logGen;
+    return 0;
+}
+
+// Applies one log file; stops quietly at a torn or corrupt tail
+static long replay_log(uint64_t gen) {
+    char path[PATH_MAX];
+    LogHeader header;
+    LogRegister reg;
+    LogResult result;
+    long bytes = 0;
+    
+    store_path(path, LOG_PREFIX, gen);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return 0;
+    
+    while (fread(&header, sizeof(header), 1, fp) == 1) {
+        if (header.type == LOG_REGISTER) {
+            if (fread(&reg, sizeof(reg), 1, fp) != 1 ||
+                checksum(header.type, &reg, sizeof(reg)) != header.checksum) break;
+            reg.email[50] = reg.password[127] = reg.name[50] = '\0';
+            add_player_to_scoreboard(reg.email, reg.password, reg.name);  // known emails are skipped
+            bytes += sizeof(header) + sizeof(reg);
+        } else if (header.type == LOG_RESULT) {
+            if (fread(&result, sizeof(result), 1, fp) != 1 ||
+                checksum(header.type, &result, sizeof(result)) != header.checksum) break;
+            result.email[50] = '\0';
+            PlayerRecord *player = find_player_by_email(result.email);
+            if (player != NULL) {
+                if (result.wins > player->wins) player->wins = result.wins;
+                if (result.losses > player->losses) player->losses = result.losses;
+                if (result.ties > player->ties) player->ties = result.ties;
+            }
+            bytes += sizeof(header) + sizeof(result);
+        } else {
+            break;
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+
+// Log generations present in the directory, lowest first
+static int list_logs(uint64_t *gens, int max) {
+    DIR *dir = opendir(journal.dir);
+    struct dirent *entry;
+    int n = 0;
+    
+    if (dir == NULL) return 0;
+    while ((entry = readdir(dir)) != NULL && n < max) {
+        if (strncmp(entry->d_name, LOG_PREFIX, strlen(LOG_PREFIX)) == 0) {
+            uint64_t gen = strtoull(entry->d_name + strlen(LOG_PREFIX), NULL, 10);
+            if (gen > 0) gens[n++] = gen;
+        }
+    }
+    closedir(dir);
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && gens[j - 1] > gens[j]; j--) {
+            uint64_t t = gens[j];
+            gens[j] = gens[j - 1];
+            gens[j - 1] = t;
+        }
+    }
+    return n;
+}
+
+static void remove_logs_before(uint64_t gen) {
+    uint64_t gens[64];
+    char path[PATH_MAX];
+    int n = list_logs(gens, 64);
+    for (int i = 0; i < n && gens[i] < gen; i++) {
+        store_path(path, LOG_PREFIX, gens[i]);
+        unlink(path);
+    }
+}
+
+// Runs on the writer thread. New entries go to a fresh log generation first;
+// the snapshot then records that generation, so whichever of the two files a
+// crash leaves behind, snapshot plus logs still replays to the latest state.
+static void compact_store() {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    uint64_t gen = journal.gen + 1;
+    int logFd = open_log(gen);
+    if (logFd < 0) {
+        perror("player log");
+        return;
+    }
+    close(journal.fd);
+    journal.fd = logFd;
+    journal.gen = gen;
+    journal.logBytes = 0;
+    
+    store_path(path, SNAPSHOT_FILE, 0);
+    store_path(tmp, SNAPSHOT_FILE ".tmp", 0);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    FILE *fp = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+    if (fp == NULL) {
+        perror("player snapshot");
+        if (fd >= 0) close(fd);
+        return;
+    }
+    
+    // Collect the records first so the hash section can be written ahead
+    // of them. Anything registered meanwhile is also in the new log.
+    long n = 0, cap = count_players() + 1024;
+    PlayerRecord **players = (PlayerRecord **)malloc(cap * sizeof(PlayerRecord *));
+    for (int i = 0; i < STORE_SHARDS && players != NULL; i++) {
+        Shard *shard = &shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        for (size_t j = 0; shard->slots != NULL && j <= shard->mask; j++) {
+            if (shard->slots[j].hash == 0) continue;
+            if (n == cap) {
+                PlayerRecord **grown = (PlayerRecord **)realloc(players, cap * 2 * sizeof(PlayerRecord *));
+                if (grown == NULL) {
+                    free(players);
+                    players = NULL;
+                    break;
+                }
+                players = grown;
+                cap *= 2;
+            }
+            players[n++] = shard->slots[j].player;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    if (players == NULL) {
+        fprintf(stderr, "player snapshot: out of memory\n");
+        fclose(fp);
+        unlink(tmp);
+        return;
+    }
+    
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.recordSize = sizeof(PlayerRecord);
+    header.count = n;
+    header.logGen = gen;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (long i = 0; i < n && ok; i++) {
+        ok = fwrite(&players[i]->hash, sizeof(uint64_t), 1, fp) == 1;
+    }
+    for (long i = 0; i < n && ok; i++) {
+        ok = fwrite(players[i], sizeof(PlayerRecord), 1, fp) == 1;
+    }
+    free(players);
+    
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, path) == -1) {
+        perror("player snapshot");
+        unlink(tmp);
+        return;
+    }
+    sync_dir();
+    remove_logs_before(gen);
+}
+
+// Group commit: everything queued while the previous batch was being synced
+// goes out with one write and one fdatasync
+static void *journal_writer(void *ptr) {
+    LogBuffer batch = { NULL, 0, 0 };
+    (void)ptr;
+    
+    while (1) {
+        pthread_mutex_lock(&journal.lock);
+        while (journal.pending.len == 0) {
+            pthread_cond_wait(&journal.wake, &journal.lock);
+        }
+        LogBuffer swap = journal.pending;
+        journal.pending = batch;
+        batch = swap;
+        uint64_t number = ++journal.queued;
+        pthread_mutex_unlock(&journal.lock);
+        
+        if (write_all(journal.fd, batch.data, batch.len) == -1 || fdatasync(journal.fd) == -1) {
+            perror("player log");
+        }
+        journal.logBytes += (long)batch.len;
+        batch.len = 0;
+        
+        pthread_mutex_lock(&journal.lock);
+        journal.written = number;
+        pthread_cond_broadcast(&journal.synced);
+        pthread_mutex_unlock(&journal.lock);
+        
+        if (journal.logBytes >= STORE_COMPACT_BYTES) {
+            compact_store();
+        }
+    }
+    return NULL;
+}
+
+int open_player_store(const char *dir) {
+    uint64_t logGen, gens[64];
+    pthread_t writer;
+    struct timespec start, end;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (strlen(dir) >= sizeof(journal.dir)) {
+        fprintf(stderr, "%s: path too long\n", dir);
+        return -1;
+    }
+    strcpy(journal.dir, dir);
+    mkdir(dir, 0700);
+    
+    if (load_snapshot(&logGen) == -1) return -1;
+    long snapshotPlayers = count_players();
+    
+    // Replay every log the snapshot does not cover, oldest first
+    int n = list_logs(gens, 64);
+    uint64_t lastGen = logGen;
+    for (int i = 0; i < n; i++) {
+        if (gens[i] < logGen) continue;
+        journal.logBytes += replay_log(gens[i]);
+        lastGen = gens[i];
+    }
+    remove_logs_before(logGen);
+    
+    // Appends continue in a new generation so a torn tail is never extended
+    journal.gen = lastGen + (n > 0);
+    journal.fd = open_log(journal.gen);
+    if (journal.fd < 0) {
+        perror("player log");
+        return -1;
+    }
+    journal.enabled = 1;
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Player store: %ld from snapshot, %ld after log replay, loaded in %.1f ms\n",
+           snapshotPlayers, count_players(),
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    
+    if (pthread_create(&writer, NULL, journal_writer, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(writer);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef GOMOKU_STORE_H
+#define GOMOKU_STORE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Player store: every registered account, indexed by email.
+//
+// Accounts are spread over STORE_SHARDS shards by a hash of the email.
+// Each shard has its own reader-writer lock and a growable open-addressing
+// table, so lookups for different players rarely touch the same lock and
+// cost O(1) on average. Records are never moved or freed once added, so a
+// PlayerRecord pointer stays valid for the life of the process. W/L/T are
+// atomic counters, so recording a result takes no lock at all.
+//
+// When opened on a directory the store is durable. New accounts and result
+// updates are appended to an in-memory batch that a writer thread commits
+// to a log file (one write and fdatasync per batch), so callers never wait
+// on the disk. Once the log grows past STORE_COMPACT_BYTES the writer folds
+// everything into a snapshot file, which the next start maps straight into
+// memory instead of reading record by record.
+
+#define STORE_SHARDS 64   // power of two
+#define STORE_COMPACT_BYTES (64L * 1024 * 1024)
+
+typedef struct PLAYERRECORD {
+    char email[51];
+    char password[128];  // encrypted password
+    char name[51];
+    atomic_int wins;
+    atomic_int losses;
+    atomic_int ties;
+    uint64_t hash;       // index key and player id, set by the store
+} PlayerRecord;
+
+// Totals produced by one add_player_result call
+typedef struct PLAYERSCORE {
+    int wins;
+    int losses;
+    int ties;
+} PlayerScore;
+
+void initialize_scoreboard();
+PlayerRecord* find_player_by_email(const char *email);
+// By player_id(), for callers that kept the id rather than the email
+PlayerRecord* find_player_by_id(uint64_t id);
+// Returns 0 on success, -1 if the email is taken, -2 if out of memory
+int add_player_to_scoreboard(const char *email, const char *password, const char *name);
+long count_players();
+// Stable id of an account (its index hash), as kept in game records
+uint64_t player_id(const char *email);
+
+// Loads the snapshot and logs in dir and starts the log writer; 0 on success
+int open_player_store(const char *dir);
+// Adds to the player's counters and queues the new totals for the log; no
+// locks held by the caller and no I/O on its thread. out gets the totals.
+void add_player_result(PlayerRecord *player, int wins, int losses, int ties, PlayerScore *out);
+// Blocks until everything queued so far is on disk
+void sync_player_store();
+
+#endif
@@ -0,0 +1,128 @@
+#include <stddef.h>
+#include "gomoku-timer.h"
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_SPAN(level) ((uint64_t)1 << (TIMER_SLOT_BITS * (level)))   // ticks per slot
+#define TIMER_RANGE TIMER_SPAN(TIMER_LEVELS)
+
+static void list_init(Timer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_add(Timer *head, Timer *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// Moves a whole slot onto a local head, so callbacks that arm timers into
+// the same slot are not seen by the loop emptying it
+static void list_take(Timer *slot, Timer *local) {
+    list_init(local);
+    if (slot->next == slot) return;
+    local->next = slot->next;
+    local->prev = slot->prev;
+    local->next->prev = local;
+    local->prev->next = local;
+    list_init(slot);
+}
+
+// Links the timer into the lowest level whose range covers its deadline.
+// A deadline beyond the top level waits in its last slot and is placed
+// again when that slot comes round.
+static void place_timer(TimerWheel *wheel, Timer *timer) {
+    uint64_t expires = timer->expires < wheel->tick ? wheel->tick : timer->expires;
+    uint64_t delta = expires - wheel->tick;
+    int level = 0;
+
+    if (delta >= TIMER_RANGE) {
+        expires = wheel->tick + TIMER_RANGE - 1;
+        delta = TIMER_RANGE - 1;
+    }
+    while (level < TIMER_LEVELS - 1 && delta >= TIMER_SPAN(level + 1)) level++;
+    list_add(&wheel->slots[level][(expires >> (TIMER_SLOT_BITS * level)) & TIMER_MASK], timer);
+}
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t nowMs) {
+    wheel->tick = nowMs / TIMER_TICK_MS;
+    wheel->armed = 0;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void timer_arm(TimerWheel *wheel, Timer *timer, uint64_t nowMs, uint64_t ms, TimerFn fn, void *data) {
+    uint64_t expires = (nowMs + ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+    timer_cancel(wheel, timer);
+    timer->expires = expires > wheel->tick ? expires : wheel->tick + 1;
+    timer->fn = fn;
+    timer->data = data;
+    place_timer(wheel, timer);
+    wheel->armed++;
+}
+
+void timer_cancel(TimerWheel *wheel, Timer *timer) {
+    if (timer->next == NULL) return;
+    list_unlink(timer);
+    wheel->armed--;
+}
+
+// One tick: spread out the slots of every level that wrapped, then fire
+// level 0's slot for the tick
+static void timer_step(TimerWheel *wheel) {
+    Timer local;
+    uint64_t tick = ++wheel->tick;
+
+    for (int level = 1; level < TIMER_LEVELS && (tick & (TIMER_SPAN(level) - 1)) == 0; level++) {
+        list_take(&wheel->slots[level][(tick >> (TIMER_SLOT_BITS * level)) & TIMER_MASK], &local);
+        while (local.next != &local) {
+            Timer *timer = local.next;
+            list_unlink(timer);
+            place_timer(wheel, timer);
+        }
+    }
+
+    list_take(&wheel->slots[0][tick & TIMER_MASK], &local);
+    while (local.next != &local) {
+        Timer *timer = local.next;
+        list_unlink(timer);
+        wheel->armed--;
+        timer->fn(timer->data);
+    }
+}
+
+void timer_advance(TimerWheel *wheel, uint64_t nowMs) {
+    uint64_t target = nowMs / TIMER_TICK_MS;
+
+    if (wheel->armed == 0 && target > wheel->tick) {
+        wheel->tick = target;
+        return;
+    }
+    while (wheel->tick < target) timer_step(wheel);
+}
+
+// The next level 0 slot with timers in it, or the next wrap of level 0,
+// where timers from above may come down
+int timer_timeout(const TimerWheel *wheel, uint64_t nowMs) {
+    uint64_t tick = wheel->tick;
+
+    if (wheel->armed == 0) return -1;
+    do {
+        tick++;
+    } while ((tick & TIMER_MASK) != 0 && wheel->slots[0][tick & TIMER_MASK].next == &wheel->slots[0][tick & TIMER_MASK]);
+
+    uint64_t due = tick * TIMER_TICK_MS;
+    return due > nowMs ? (int)(due - nowMs) : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef GOMOKU_TIMER_H
+#define GOMOKU_TIMER_H
+
+#include <stdint.h>
+
+// Hierarchical timer wheel for the reactor: login timeouts, game clocks and
+// parked seats. Not thread-safe; the reactor owns its wheel.
+//
+// Time is counted in TIMER_TICK_MS ticks. Level 0 has a slot for each of the
+// next TIMER_SLOTS ticks, and every level up has slots TIMER_SLOTS times as
+// wide. A timer is linked into the slot of the lowest level its deadline
+// reaches, so arming is a shift, a mask and a list insert, and cancelling
+// unlinks it; neither depends on how many timers there are. Each time a
+// level wraps around, the next slot of the level above is spread over the
+// levels below, so a timer is moved at most once per level before it fires.
+
+#define TIMER_TICK_MS 10
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4            // 10 ms ticks reach 46 hours; later deadlines wait at the top
+
+typedef void (*TimerFn)(void *data);
+
+// Embedded in whatever it times; zeroed, it is not armed
+typedef struct TIMER {
+    struct TIMER *next;        // NULL when not armed
+    struct TIMER *prev;
+    uint64_t expires;          // tick
+    TimerFn fn;
+    void *data;
+} Timer;
+
+typedef struct TIMERWHEEL {
+    uint64_t tick;             // every timer due by this tick has fired
+    long armed;
+    Timer slots[TIMER_LEVELS][TIMER_SLOTS];   // list heads
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t nowMs);
+// Calls fn(data) once ms have passed since nowMs, never earlier; an armed
+// timer is moved to the new deadline
+void timer_arm(TimerWheel *wheel, Timer *timer, uint64_t nowMs, uint64_t ms, TimerFn fn, void *data);
+// Safe on a timer that is not armed, and from any callback
+void timer_cancel(TimerWheel *wheel, Timer *timer);
+// Fires every timer due by nowMs. Callbacks may arm and cancel any timer,
+// their own included.
+void timer_advance(TimerWheel *wheel, uint64_t nowMs);
+// Milliseconds until timer_advance may have work, for epoll_wait; -1 when
+// nothing is armed
+int timer_timeout(const TimerWheel *wheel, uint64_t nowMs);
+
+static inline int timer_armed(const Timer *timer) {
+    return timer->next != NULL;
+}
+
+#endif
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "gomoku-vcf.h"
+
+#define VCF_MAX_SIZE 19
+#define VCF_MAX_CELLS (VCF_MAX_SIZE * VCF_MAX_SIZE)
+#define VCF_MAX_WINDOWS (4 * VCF_MAX_SIZE * (VCF_MAX_SIZE - 4))
+#define VCF_CELL_WINDOWS 20       // 5 per direction
+
+enum { PROOF_WIN = 1, PROOF_FAIL };
+
+// Where the five-cell windows of one board size lie
+typedef struct VCFLAYOUT {
+    int size;
+    int nWindows;
+    int16_t start[VCF_MAX_WINDOWS];
+    int16_t step[VCF_MAX_WINDOWS];
+    uint8_t nCellWindows[VCF_MAX_CELLS];
+    int16_t cellWindows[VCF_MAX_CELLS][VCF_CELL_WINDOWS];
+} VcfLayout;
+
+typedef struct VCFPOSITION {
+    const VcfLayout *layout;
+    uint64_t hash;
+    uint8_t cells[VCF_MAX_CELLS];            // 0 empty, 1 B, 2 W
+    uint8_t counts[VCF_MAX_WINDOWS][2];      // stones of each color per window
+    uint8_t makesFour[2][VCF_MAX_CELLS];     // windows where a stone here makes a four
+    int fours[2];                            // windows one stone short of five
+} VcfPosition;
+
+typedef struct VCFENTRY {
+    _Atomic uint64_t check;   // key ^ data
+    _Atomic uint64_t data;    // cell + 1, moves, proof; see packProof
+} VcfEntry;
+
+struct VCFCACHE {
+    VcfEntry *entries;
+    uint64_t mask;
+};
+
+typedef struct VCFSOLVER {
+    VcfCache *cache;
+    VcfPosition pos;
+    int attacker;
+    uint64_t nodes;
+    uint64_t maxNodes;
+    int aborted;
+} VcfSolver;
+
+static const int dirX[4] = { 0, 1, 1, 1 };
+static const int dirY[4] = { 1, 0, 1, -1 };
+
+static VcfLayout layouts[BOARD_GEOMETRY_COUNT];
+static uint64_t zobrist[2][VCF_MAX_CELLS];
+static uint64_t attackerKeys[2];
+static pthread_once_t setupOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void setupLayout(VcfLayout *layout, int n) {
+    layout->size = n;
+    for (int d = 0; d < 4; d++) {
+        for (int x = 0; x < n; x++) {
+            for (int y = 0; y < n; y++) {
+                int ex = x + 4 * dirX[d], ey = y + 4 * dirY[d];
+                if (ex < 0 || ex >= n || ey < 0 || ey >= n) continue;
+                int w = layout->nWindows++;
+                layout->start[w] = (int16_t)(x * n + y);
+                layout->step[w] = (int16_t)(dirX[d] * n + dirY[d]);
+                for (int i = 0; i < 5; i++) {
+                    int cell = layout->start[w] + i * layout->step[w];
+                    layout->cellWindows[cell][layout->nCellWindows[cell]++] = (int16_t)w;
+                }
+            }
+        }
+    }
+}
+
+// Layouts for every size, and splitmix64 keys from a fixed seed
+static void setupTables() {
+    uint64_t state = 0x766366ULL;
+    uint64_t *keys[] = { zobrist[0], zobrist[1], attackerKeys };
+    size_t counts[] = { VCF_MAX_CELLS, VCF_MAX_CELLS, 2 };
+
+    for (size_t i = 0; i < BOARD_GEOMETRY_COUNT; i++) {
+        setupLayout(&layouts[i], boardGeometries[i].size);
+    }
+    for (int k = 0; k < 3; k++) {
+        for (size_t i = 0; i < counts[k]; i++) {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            keys[k][i] = z ^ (z >> 31);
+        }
+    }
+}
+
+/* Position */
+
+// Adds (sign 1) or takes back (-1) what a window contributes to makesFour
+// and fours, given the cells as they are now
+static void countWindow(VcfPosition *pos, int w, int sign) {
+    const VcfLayout *layout = pos->layout;
+
+    for (int c = 0; c < 2; c++) {
+        if (pos->counts[w][!c] != 0) continue;
+        if (pos->counts[w][c] == 4) {
+            pos->fours[c] += sign;
+        } else if (pos->counts[w][c] == 3) {
+            for (int i = 0; i < 5; i++) {
+                int cell = layout->start[w] + i * layout->step[w];
+                if (pos->cells[cell] == 0) pos->makesFour[c][cell] += sign;
+            }
+        }
+    }
+}
+
+static void makeMove(VcfPosition *pos, int cell, int color) {
+    const VcfLayout *layout = pos->layout;
+    int nWindows = layout->nCellWindows[cell];
+
+    for (int i = 0; i < nWindows; i++) countWindow(pos, layout->cellWindows[cell][i], -1);
+    pos->cells[cell] = (uint8_t)(color + 1);
+    pos->hash ^= zobrist[color][cell];
+    for (int i = 0; i < nWindows; i++) {
+        int w = layout->cellWindows[cell][i];
+        pos->counts[w][color]++;
+        countWindow(pos, w, 1);
+    }
+}
+
+static void unmakeMove(VcfPosition *pos, int cell, int color) {
+    const VcfLayout *layout = pos->layout;
+    int nWindows = layout->nCellWindows[cell];
+
+    for (int i = 0; i < nWindows; i++) countWindow(pos, layout->cellWindows[cell][i], -1);
+    pos->cells[cell] = 0;
+    pos->hash ^= zobrist[color][cell];
+    for (int i = 0; i < nWindows; i++) {
+        int w = layout->cellWindows[cell][i];
+        pos->counts[w][color]--;
+        countWindow(pos, w, 1);
+    }
+}
+
+// The empty cell of a window holding a four
+static int gapOf(const VcfPosition *pos, int w) {
+    const VcfLayout *layout = pos->layout;
+    for (int i = 0; i < 5; i++) {
+        int cell = layout->start[w] + i * layout->step[w];
+        if (pos->cells[cell] == 0) return cell;
+    }
+    return -1;
+}
+
+// Up to two different cells where color would make five, looking only at
+// the windows through cell, or at all of them if cell is -1; returns how
+// many it found
+static int fiveCells(const VcfPosition *pos, int color, int cell, int *gaps) {
+    const VcfLayout *layout = pos->layout;
+    int nWindows = (cell >= 0) ? layout->nCellWindows[cell] : layout->nWindows;
+    int found = 0;
+
+    for (int i = 0; i < nWindows && found < 2; i++) {
+        int w = (cell >= 0) ? layout->cellWindows[cell][i] : i;
+        if (pos->counts[w][color] != 4 || pos->counts[w][!color] != 0) continue;
+        int gap = gapOf(pos, w);
+        if (found == 0 || gaps[0] != gap) gaps[found++] = gap;
+    }
+    return found;
+}
+
+/* Cache */
+
+static uint64_t packProof(int cell, int moves, int proof) {
+    return (uint64_t)(cell + 1) | (uint64_t)moves << 16 | (uint64_t)proof << 24;
+}
+
+static int probeCache(VcfCache *cache, uint64_t key, uint64_t *data) {
+    VcfEntry *entry = &cache->entries[key & cache->mask];
+    *data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    return (atomic_load_explicit(&entry->check, memory_order_relaxed) ^ *data) == key;
+}
+
+static void storeCache(VcfCache *cache, uint64_t key, int cell, int moves, int proof) {
+    VcfEntry *entry = &cache->entries[key & cache->mask];
+    uint64_t data = packProof(cell, moves, proof);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+}
+
+/* Search */
+
+// Attacker to move with at most movesLeft fours to go; lastDefence is the
+// defender's last stone, the only place a new defending four can be. Returns
+// the attacking moves to five and sets *winCell, or 0 if there is no VCF.
+static int attack(VcfSolver *s, int lastDefence, int movesLeft, int *winCell) {
+    VcfPosition *pos = &s->pos;
+    int a = s->attacker, d = !a;
+    int n = pos->layout->size;
+    int gaps[2];
+    uint64_t data;
+
+    if (++s->nodes > s->maxNodes) {
+        s->aborted = 1;
+        return 0;
+    }
+    if (pos->fours[a] > 0) {
+        fiveCells(pos, a, -1, gaps);
+        *winCell = gaps[0];
+        return 1;
+    }
+
+    uint64_t key = pos->hash ^ attackerKeys[a];
+    if (probeCache(s->cache, key, &data)) {
+        int proof = (int)((data >> 24) & 0xff), moves = (int)((data >> 16) & 0xff);
+        if (proof == PROOF_WIN && moves <= movesLeft) {
+            *winCell = (int)(data & 0xffff) - 1;
+            return moves;
+        }
+        if (proof == PROOF_FAIL && moves >= movesLeft) return 0;
+    }
+    if (movesLeft < 2) return 0;
+
+    // A defending four must be blocked, and the block has to be a four too
+    int forced = -1;
+    if (pos->fours[d] > 0) {
+        if (fiveCells(pos, d, lastDefence, gaps) != 1 || pos->makesFour[a][gaps[0]] == 0) {
+            storeCache(s->cache, key, -1, VCF_MAX_MOVES, PROOF_FAIL);
+            return 0;
+        }
+        forced = gaps[0];
+    }
+
+    // Double fours first, then row order
+    int moves[VCF_MAX_CELLS], nMoves = 0;
+    if (forced >= 0) {
+        moves[nMoves++] = forced;
+    } else {
+        for (int pass = 0; pass < 2; pass++) {
+            for (int cell = 0; cell < n * n; cell++) {
+                if (pos->cells[cell] == 0 && pos->makesFour[a][cell] > 0 &&
+                    (pos->makesFour[a][cell] > 1) == (pass == 0)) {
+                    moves[nMoves++] = cell;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < nMoves; i++) {
+        int cell = moves[i], result = 0;
+        makeMove(pos, cell, a);
+        int nGaps = fiveCells(pos, a, cell, gaps);
+        if (nGaps == 2 && pos->fours[d] == 0) {
+            result = 2;  // two ways to five, one block
+        } else if (nGaps >= 1) {
+            int block = gaps[0], next;
+            makeMove(pos, block, d);
+            int after = attack(s, block, movesLeft - 1, &next);
+            unmakeMove(pos, block, d);
+            if (after > 0) result = after + 1;
+        }
+        unmakeMove(pos, cell, a);
+        if (result > 0) {
+            storeCache(s->cache, key, cell, result, PROOF_WIN);
+            *winCell = cell;
+            return result;
+        }
+        if (s->aborted) return 0;
+    }
+    storeCache(s->cache, key, -1, movesLeft, PROOF_FAIL);
+    return 0;
+}
+
+VcfCache *vcfCreateCache(size_t megabytes) {
+    VcfCache *cache = (VcfCache *)malloc(sizeof(VcfCache));
+    uint64_t count = 1;
+
+    while (count * 2 * sizeof(VcfEntry) <= megabytes * 1024 * 1024) count *= 2;
+    if (cache == NULL) return NULL;
+    cache->entries = (VcfEntry *)calloc(count, sizeof(VcfEntry));
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->mask = count - 1;
+    return cache;
+}
+
+int vcfSolve(VcfCache *cache, const BoardGeometry *geo, const void *board, int color, uint64_t maxNodes,
+             VcfResult *result) {
+    uint64_t started = now_ns();
+    int n = geo->size, cell = -1;
+
+    pthread_once(&setupOnce, setupTables);
+    memset(result, 0, sizeof(*result));
+
+    VcfSolver *s = (VcfSolver *)calloc(1, sizeof(VcfSolver));
+    if (s == NULL) return 0;
+    for (size_t i = 0; i < BOARD_GEOMETRY_COUNT; i++) {
+        if (layouts[i].size == n) s->pos.layout = &layouts[i];
+    }
+    if (s->pos.layout == NULL) {
+        free(s);
+        return 0;
+    }
+    s->cache = cache;
+    s->attacker = color;
+    s->maxNodes = maxNodes;
+    s->pos.hash = (uint64_t)n * 0x9e3779b97f4a7c15ULL;
+    for (int x = 0; x < n; x++) {
+        for (int y = 0; y < n; y++) {
+            char c = geo->cell(board, x, y);
+            if (c != '.') makeMove(&s->pos, x * n + y, c == 'W');
+        }
+    }
+
+    result->moves = attack(s, -1, VCF_MAX_MOVES, &cell);
+    result->found = result->moves > 0;
+    if (result->found) {
+        result->x = cell / n;
+        result->y = cell % n;
+    }
+    result->nodes = s->nodes;
+    result->complete = !s->aborted;
+    result->micros = (now_ns() - started) / 1000;
+    free(s);
+    return result->found;
+}
@@ -0,0 +1,40 @@
+#ifndef GOMOKU_VCF_H
+#define GOMOKU_VCF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gomoku-board.h"
+
+// Threat-space solver for victory by continuous fours (VCF): every
+// attacking move makes a four, so the defender's reply is forced and the
+// tree stays narrow enough to prove wins many moves deep in microseconds
+// to milliseconds.
+//
+// The solver keeps, for every five-cell window, how many stones of each
+// color it holds, and updates only the windows through a placed stone.
+// From those counts it knows at once which empty cells make a four and
+// where a four would be completed, with no scanning along lines. Proven
+// wins and proven failures go into a cache any number of solvers share
+// without locks, laid out like the search's transposition table.
+
+#define VCF_MAX_MOVES 40          // attacking moves, five included, before giving up
+
+typedef struct VCFCACHE VcfCache;
+
+typedef struct VCFRESULT {
+    int found;            // 1 if color wins by continuous fours
+    int x, y;             // the first move of the win
+    int moves;            // attacking moves to five, this one included
+    uint64_t nodes;
+    uint64_t micros;
+    int complete;         // 0 if maxNodes ran out, so a miss proves nothing
+} VcfResult;
+
+// Rounded down to a power-of-two number of entries; NULL if out of memory
+VcfCache *vcfCreateCache(size_t megabytes);
+// Looks for a VCF for color (0 = B, 1 = W) to move, visiting at most
+// maxNodes positions; returns result->found
+int vcfSolve(VcfCache *cache, const BoardGeometry *geo, const void *board, int color, uint64_t maxNodes,
+             VcfResult *result);
+
+#endif